@@ -0,0 +1,427 @@
+// Copyright 2011 Jason Marcell
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include <gsl/gsl_cdf.h>
+
+#include "lib/NormalCdfTable.h"
+#include "lib/FastGaussTransform.h"
+#include "lib/Matrix.h"
+#include "lib/GaussianKernel.h"
+#include "lib/KernelCache.h"
+#include "lib/QuantizedModel.h"
+#include "lib/Trainer.h"
+#include "lib/Reduction.h"
+#include "lib/Scheduler.h"
+#include "lib/Simd.h"
+#include "lib/Vector.h"
+#include "lib/RandomNumberGenerator.h"
+#include "lib/Log.h"
+
+namespace jason {
+
+double Now() {
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec * 1e-6;
+}
+
+// Compares gsl_cdf_ugaussian_P against the tabulated CDF at several
+// tolerances: time per call and the observed maximum absolute error.
+void BenchmarkNormalCdf() {
+  const size_t kPoints = 2000000;
+  const double kTolerances[] = { 1e-4, 1e-7, 1e-10, 1e-13 };
+  RandomNumberGenerator *r = new RandomNumberGenerator();
+  double *xs = new double[kPoints];
+  double *exact = new double[kPoints];
+  for (size_t i = 0; i < kPoints; ++i) {
+    xs[i] = r->SampleUniform(-9.0, 9.0);
+  }
+  delete r;
+
+  double start = Now();
+  for (size_t i = 0; i < kPoints; ++i) {
+    exact[i] = gsl_cdf_ugaussian_P(xs[i]);
+  }
+  double exact_time = Now() - start;
+  printf("normal_cdf exact:            %7.2f ns/call\n",
+      1e9 * exact_time / kPoints);
+
+  for (size_t t = 0; t < sizeof(kTolerances) / sizeof(*kTolerances); ++t) {
+    NormalCdfTable *table = new NormalCdfTable(kTolerances[t]);
+    double sum = 0;
+    start = Now();
+    for (size_t i = 0; i < kPoints; ++i) {
+      sum += table->P(xs[i]);
+    }
+    double fast_time = Now() - start;
+    double max_error = 0;
+    for (size_t i = 0; i < kPoints; ++i) {
+      double error = fabs(table->P(xs[i]) - exact[i]);
+      if (error > max_error) max_error = error;
+    }
+    printf("normal_cdf table tol=%.0e: %7.2f ns/call  speedup %5.2fx  "
+        "max err %.2e  nodes %zu  (checksum %.1f)\n", kTolerances[t],
+        1e9 * fast_time / kPoints, exact_time / fast_time, max_error,
+        table->Size(), sum);
+    delete table;
+  }
+  delete[] exact;
+  delete[] xs;
+}
+
+// Fast Gauss transform against direct summation of the Gaussian score sums
+// for uniformly scattered points: time and observed max absolute error.
+void BenchmarkFastGaussTransform() {
+  const size_t kSources = 20000;
+  const size_t kTargets = 5000;
+  const size_t kClasses = 3;
+  const size_t kDims[] = { 2, 3 };
+  const double kTheta = 2.0;
+  const double kTolerance = 1e-6;
+  RandomNumberGenerator *r = new RandomNumberGenerator(1);
+  for (size_t i = 0; i < sizeof(kDims) / sizeof(*kDims); ++i) {
+    size_t dims = kDims[i];
+    Matrix *sources = new Matrix(kSources, dims);
+    Matrix *targets = new Matrix(kTargets, dims);
+    Matrix *weights = new Matrix(kSources, kClasses);
+    Vector *theta = new Vector(dims);
+    for (size_t m = 0; m < kSources; ++m) {
+      for (size_t d = 0; d < dims; ++d) {
+        sources->Set(m, d, r->SampleUniform(0, 1));
+      }
+      for (size_t c = 0; c < kClasses; ++c) {
+        weights->Set(m, c, r->SampleGaussian(1.0));
+      }
+    }
+    for (size_t n = 0; n < kTargets; ++n) {
+      for (size_t d = 0; d < dims; ++d) {
+        targets->Set(n, d, r->SampleUniform(0, 1));
+      }
+    }
+    for (size_t d = 0; d < dims; ++d) {
+      theta->Set(d, kTheta);
+    }
+
+    double start = Now();
+    FastGaussTransform *fast = new FastGaussTransform(sources, weights, theta,
+        kTolerance);
+    Matrix *approx = fast->Evaluate(targets);
+    double fast_time = Now() - start;
+    start = Now();
+    FastGaussTransform *direct = new FastGaussTransform(sources, weights,
+        theta, 0);
+    Matrix *exact = direct->Evaluate(targets);
+    double direct_time = Now() - start;
+
+    double max_error = 0;
+    for (size_t n = 0; n < kTargets; ++n) {
+      for (size_t c = 0; c < kClasses; ++c) {
+        double error = fabs(approx->Get(n, c) - exact->Get(n, c));
+        if (error > max_error) max_error = error;
+      }
+    }
+    printf("fast_gauss d=%zu tol=%.0e: %.3fs  direct %.3fs  speedup %5.2fx"
+        "  max err %.2e\n", dims, kTolerance, fast_time, direct_time,
+        direct_time / fast_time, max_error);
+    delete exact;
+    delete direct;
+    delete approx;
+    delete fast;
+    delete theta;
+    delete weights;
+    delete targets;
+    delete sources;
+  }
+  delete r;
+}
+
+// Quantized Gaussian scoring against the double precision test kernel and
+// GEMM used by Predictor: time, model memory and max score difference.
+void BenchmarkQuantizedModel() {
+  const size_t kRelevanceVectors = 1000;
+  const size_t kSamples = 1000;
+  const size_t kDims = 64;
+  const size_t kClasses = 4;
+  const Quantization kModes[] = { QUANTIZE_INT8, QUANTIZE_FP16 };
+  RandomNumberGenerator *r = new RandomNumberGenerator(1);
+  Matrix *relevance_vectors = new Matrix(kRelevanceVectors, kDims);
+  Matrix *samples = new Matrix(kSamples, kDims);
+  Matrix *w = new Matrix(kRelevanceVectors, kClasses);
+  for (size_t m = 0; m < kRelevanceVectors; ++m) {
+    for (size_t d = 0; d < kDims; ++d) {
+      relevance_vectors->Set(m, d, r->SampleUniform(0, 0.5));
+    }
+    for (size_t c = 0; c < kClasses; ++c) {
+      w->Set(m, c, r->SampleGaussian(1.0));
+    }
+  }
+  for (size_t n = 0; n < kSamples; ++n) {
+    for (size_t d = 0; d < kDims; ++d) {
+      samples->Set(n, d, r->SampleUniform(0, 0.5));
+    }
+  }
+  delete r;
+
+  double start = Now();
+  GaussianKernel *kernel = new GaussianKernel(relevance_vectors, samples, 1);
+  kernel->Init();
+  Matrix *exact = kernel->TransposeMultiply(w);
+  double double_time = Now() - start;
+  printf("quantized double:  %.3fs\n", double_time);
+
+  for (size_t i = 0; i < sizeof(kModes) / sizeof(*kModes); ++i) {
+    start = Now();
+    QuantizedModel *model = new QuantizedModel(relevance_vectors, w,
+        GAUSSIAN, 1, kModes[i]);
+    Matrix *scores = model->Scores(samples);
+    double time = Now() - start;
+    double max_error = 0;
+    for (size_t n = 0; n < kSamples; ++n) {
+      for (size_t c = 0; c < kClasses; ++c) {
+        max_error = fmax(max_error, fabs(scores->Get(n, c) - exact->Get(n, c)));
+      }
+    }
+    printf("quantized %s:    %.3fs  speedup %6.2fx  memory %5.2fx smaller"
+        "  max err %.2e\n", kModes[i] == QUANTIZE_INT8 ? "int8" : "fp16",
+        time, double_time / time,
+        static_cast<double>(model->DoubleBytes()) / model->Bytes(), max_error);
+    delete scores;
+    delete model;
+  }
+  delete exact;
+  delete kernel;
+  delete w;
+  delete samples;
+  delete relevance_vectors;
+}
+
+// Trains on a three class Gaussian blob problem with `threads` threads in
+// the given reduction mode and returns w.
+Matrix *TrainBlobs(Matrix *x, Vector *labels, size_t threads,
+    ReductionMode mode, double *time) {
+  Scheduler::Configure(threads, NULL);
+  Reduction::SetMode(mode);
+  double start = Now();
+  GaussianKernel *kernel = new GaussianKernel(x, x, 1);
+  Trainer *trainer = new Trainer(x, labels, 3, kernel);
+  trainer->SetSeed(1);
+  trainer->Process(1e-6, 1e-6);
+  *time = Now() - start;
+  Matrix *w = trainer->GetW()->Copy();
+  delete trainer;
+  delete kernel;
+  return w;
+}
+
+bool SameBits(Matrix *a, Matrix *b) {
+  if (a->Height() != b->Height() || a->Width() != b->Width()) {
+    return false;
+  }
+  for (size_t i = 0; i < a->Height(); ++i) {
+    for (size_t j = 0; j < a->Width(); ++j) {
+      double x = a->Get(i, j);
+      double y = b->Get(i, j);
+      if (memcmp(&x, &y, sizeof(x)) != 0) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+// Cost of the reproducible reduction mode and whether its w is bitwise
+// identical on one thread and on several.
+void BenchmarkReproducible() {
+  const size_t kSamples = 300;
+  const size_t kThreads = 4;
+  const size_t kDims = 8;
+  RandomNumberGenerator *r = new RandomNumberGenerator(1);
+  Matrix *x = new Matrix(kSamples, kDims);
+  Vector *labels = new Vector(kSamples);
+  for (size_t n = 0; n < kSamples; ++n) {
+    size_t c = n % 3;
+    labels->Set(n, c);
+    for (size_t d = 0; d < kDims; ++d) {
+      x->Set(n, d, r->SampleGaussian(1.0) + (d % 3 == c ? 2 : 0));
+    }
+  }
+  delete r;
+
+  double fast_time, single_time, parallel_time;
+  Matrix *fast = TrainBlobs(x, labels, kThreads, REDUCTION_FAST, &fast_time);
+  Matrix *single = TrainBlobs(x, labels, 1, REDUCTION_REPRODUCIBLE,
+      &single_time);
+  Matrix *parallel = TrainBlobs(x, labels, kThreads, REDUCTION_REPRODUCIBLE,
+      &parallel_time);
+  printf("reproducible fast:  %.3fs  (%zu threads)\n", fast_time, kThreads);
+  printf("reproducible fixed: %.3fs  slowdown %5.2fx  1 vs %zu threads %s\n",
+      parallel_time, parallel_time / fast_time, kThreads,
+      SameBits(single, parallel) ? "identical" : "DIFFER");
+  Reduction::SetMode(REDUCTION_FAST);
+  delete parallel;
+  delete single;
+  delete fast;
+  delete labels;
+  delete x;
+}
+
+// Time to build a Gaussian kernel for each of several params from the
+// features against from a distance cache computed once, and the largest
+// difference between the two.
+void BenchmarkKernelSweep() {
+  const size_t kSamples = 1000;
+  const size_t kDims = 16;
+  const int kParams[] = { 1, 2, 4, 8 };
+  const size_t kSweep = sizeof(kParams) / sizeof(kParams[0]);
+  RandomNumberGenerator *r = new RandomNumberGenerator(1);
+  Matrix *x = new Matrix(kSamples, kDims);
+  for (size_t n = 0; n < kSamples; ++n) {
+    for (size_t d = 0; d < kDims; ++d) {
+      x->Set(n, d, r->SampleGaussian(1.0) * 0.25);
+    }
+  }
+  delete r;
+
+  GaussianKernel *direct = new GaussianKernel(x, x, 1);
+  GaussianKernel *cached = new GaussianKernel(x, x, 1);
+  double start = Now();
+  for (size_t i = 0; i < kSweep; ++i) {
+    direct->SetParam(kParams[i]);
+    direct->Init();
+  }
+  double direct_time = Now() - start;
+
+  start = Now();
+  KernelCache *cache = new KernelCache(x, x, BASE_DISTANCES);
+  cached->SetCache(cache);
+  double error = 0;
+  for (size_t i = 0; i < kSweep; ++i) {
+    cached->SetParam(kParams[i]);
+    cached->Init();
+  }
+  double cached_time = Now() - start;
+  for (size_t row = 0; row < kSamples; ++row) {
+    for (size_t col = 0; col < kSamples; ++col) {
+      error = fmax(error, fabs(cached->Get(row, col) - direct->Get(row, col)));
+    }
+  }
+  printf("kernel sweep direct: %.3fs  (%zu params, %zux%zu)\n", direct_time,
+      kSweep, kSamples, kSamples);
+  printf("kernel sweep cached: %.3fs  speedup %5.2fx  max error %.2e\n",
+      cached_time, direct_time / cached_time, error);
+  delete cache;
+  delete cached;
+  delete direct;
+  delete x;
+}
+
+// Every ISA level this CPU supports, on the loops it vectorizes: a
+// Gaussian kernel built from the features, a batch of tabulated CDF
+// values (which must give the scalar bits) and the update of y.
+void BenchmarkIsa() {
+  const size_t kSamples = 1500;
+  const size_t kDims = 16;
+  const size_t kPoints = 2000000;
+  RandomNumberGenerator *r = new RandomNumberGenerator(1);
+  Matrix *x = new Matrix(kSamples, kDims);
+  Vector *labels = new Vector(kSamples / 5);
+  for (size_t n = 0; n < kSamples; ++n) {
+    for (size_t d = 0; d < kDims; ++d) {
+      x->Set(n, d, r->SampleGaussian(1.0) * 0.25 + (d == n % 4 ? 1 : 0));
+    }
+  }
+  for (size_t n = 0; n < labels->Size(); ++n) {
+    labels->Set(n, n % 4);
+  }
+  double *xs = new double[kPoints];
+  double *scalar = new double[kPoints];
+  double *cdfs = new double[kPoints];
+  for (size_t i = 0; i < kPoints; ++i) {
+    xs[i] = r->SampleUniform(-9.0, 9.0);
+  }
+  delete r;
+  NormalCdfTable *table = new NormalCdfTable(1e-7);
+  GaussianKernel *kernel = new GaussianKernel(x, x, 1);
+  Matrix *subset = new Matrix(kSamples / 5, kDims);
+  for (size_t n = 0; n < subset->Height(); ++n) {
+    for (size_t d = 0; d < kDims; ++d) {
+      subset->Set(n, d, x->Get(n, d));
+    }
+  }
+  double base_kernel = 0, base_cdf = 0, base_train = 0;
+  for (int level = SIMD_SCALAR; level <= Simd::Detect(); ++level) {
+    Simd::Select(static_cast<SimdLevel>(level));
+    double start = Now();
+    kernel->Init();
+    double kernel_time = Now() - start;
+
+    start = Now();
+    table->P(xs, cdfs, kPoints);
+    double cdf_time = Now() - start;
+    if (level == SIMD_SCALAR) {
+      memcpy(scalar, cdfs, kPoints * sizeof(*cdfs));
+    }
+    bool same = memcmp(scalar, cdfs, kPoints * sizeof(*cdfs)) == 0;
+
+    GaussianKernel *train_kernel = new GaussianKernel(subset, subset, 1);
+    Trainer *trainer = new Trainer(subset, labels, 4, train_kernel);
+    trainer->SetSeed(1);
+    trainer->SetCdfTable(table);
+    trainer->SetIterations(5);
+    start = Now();
+    trainer->Process(1e-6, 1e-6);
+    double train_time = Now() - start;
+    delete trainer;
+    delete train_kernel;
+
+    if (level == SIMD_SCALAR) {
+      base_kernel = kernel_time;
+      base_cdf = cdf_time;
+      base_train = train_time;
+    }
+    printf("isa %-7s kernel %zux%zu: %.3fs (%5.2fx)  cdf batch: %5.2f ns "
+        "(%5.2fx, %s)  train 5 iter: %.3fs (%5.2fx)\n",
+        Simd::Name(static_cast<SimdLevel>(level)), kSamples, kSamples,
+        kernel_time, base_kernel / kernel_time, 1e9 * cdf_time / kPoints,
+        base_cdf / cdf_time, same ? "same bits" : "BITS DIFFER",
+        train_time, base_train / train_time);
+  }
+  Simd::Select(Simd::Detect());
+  delete subset;
+  delete kernel;
+  delete table;
+  delete[] cdfs;
+  delete[] scalar;
+  delete[] xs;
+  delete labels;
+  delete x;
+}
+}
+
+int main(int argc, char **argv) {
+  verbosity = 0;
+  const char *only = argc > 1 ? argv[1] : NULL;
+  if (!only || strcmp(only, "normal_cdf") == 0) {
+    jason::BenchmarkNormalCdf();
+  }
+  if (!only || strcmp(only, "fast_gauss") == 0) {
+    jason::BenchmarkFastGaussTransform();
+  }
+  if (!only || strcmp(only, "quantized") == 0) {
+    jason::BenchmarkQuantizedModel();
+  }
+  if (!only || strcmp(only, "reproducible") == 0) {
+    jason::BenchmarkReproducible();
+  }
+  if (!only || strcmp(only, "kernel_sweep") == 0) {
+    jason::BenchmarkKernelSweep();
+  }
+  if (!only || strcmp(only, "isa") == 0) {
+    jason::BenchmarkIsa();
+  }
+  return 0;
+}
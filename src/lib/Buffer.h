@@ -0,0 +1,16 @@
+// Copyright 2011 Jason Marcell
+
+#ifndef SRC_LIB_BUFFER_H_
+#define SRC_LIB_BUFFER_H_
+
+namespace jason {
+
+// What a Matrix or Vector wrapping a caller's buffer does with it.  Either
+// way the buffer is used in place, and writes (Sphere, Set, ...) go to it.
+enum BufferOwnership {
+  BUFFER_VIEW,   // The caller keeps the buffer alive and frees it
+  BUFFER_ADOPT   // The object free()s it; it must come from malloc
+};
+}
+
+#endif  // SRC_LIB_BUFFER_H_
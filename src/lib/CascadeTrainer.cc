@@ -0,0 +1,188 @@
+// Copyright 2011 Jason Marcell
+
+#include <algorithm>
+
+#include "lib/CascadeTrainer.h"
+#include "lib/RandomNumberGenerator.h"
+#include "lib/Scheduler.h"
+#include "lib/Log.h"
+
+#define MERGE_ITERATIONS 20  // Rounds after a merge, which starts near a model
+#define MAX_BASE_SEED 2147483647.0
+
+namespace jason {
+
+CascadeTrainer::CascadeTrainer(Matrix *x, Vector *labels, size_t classes,
+    Kernel *kernel, size_t partitions) {
+  this->x = x;
+  this->t = labels;
+  this->classes = classes;
+  this->kernel = kernel;
+  this->partitions = partitions > 0 ? partitions : 1;
+  this->readmit = (x->Height() + this->partitions - 1) / this->partitions;
+  this->seed = 0;
+  this->base_seed = 1;
+  this->cdf_table = NULL;
+  Node empty = { NULL, NULL, NULL, NULL, NULL };
+  this->root = empty;
+}
+
+CascadeTrainer::~CascadeTrainer() {
+  Free(&root);
+}
+
+void CascadeTrainer::SetSeed(unsigned long seed) {
+  this->seed = seed;
+}
+
+void CascadeTrainer::SetCdfTable(NormalCdfTable *table) {
+  this->cdf_table = table;
+}
+
+Trainer *CascadeTrainer::GetTrainer() {
+  return root.trainer;
+}
+
+void CascadeTrainer::Free(Node *node) {
+  delete node->trainer;
+  delete node->t;
+  delete node->x;
+  delete node->landmarks;
+  delete node->rows;
+  node->trainer = NULL;
+  node->t = NULL;
+  node->x = NULL;
+  node->landmarks = NULL;
+  node->rows = NULL;
+}
+
+// Shuffles each class and deals its samples round-robin over the
+// partitions, carrying the turn from one class to the next, so every
+// partition gets about its share of each class.  Without a seed, also
+// draws the base of the node seeds here, on the calling thread: nodes
+// train in parallel, and only seeded generators are safe to construct
+// there.
+void CascadeTrainer::Partition(Node *nodes) {
+  size_t samples = x->Height();
+  RandomNumberGenerator *r = seed == 0 ? new RandomNumberGenerator()
+      : new RandomNumberGenerator(seed);
+  base_seed = seed != 0 ? seed
+      : 1 + static_cast<unsigned long>(r->SampleUniform(0, MAX_BASE_SEED));
+  size_t *members = new size_t[samples];
+  size_t *owner = new size_t[samples];
+  size_t *sizes = new size_t[partitions];
+  for (size_t p = 0; p < partitions; ++p) {
+    sizes[p] = 0;
+  }
+  size_t turn = 0;
+  for (size_t c = 0; c < classes; ++c) {
+    size_t count = 0;
+    for (size_t n = 0; n < samples; ++n) {
+      if (t->Get(n) == c) {
+        members[count++] = n;
+      }
+    }
+    for (size_t i = 0; i < count; ++i) {
+      size_t j = i + static_cast<size_t>(r->SampleUniform(0, count - i));
+      j = j < count ? j : count - 1;
+      std::swap(members[i], members[j]);
+      owner[members[i]] = turn;
+      sizes[turn]++;
+      turn = (turn + 1) % partitions;
+    }
+  }
+  for (size_t p = 0; p < partitions; ++p) {
+    Node node = { new Vector(sizes[p]), NULL, NULL, NULL, NULL };
+    nodes[p] = node;
+    sizes[p] = 0;
+  }
+  for (size_t n = 0; n < samples; ++n) {
+    nodes[owner[n]].rows->Set(sizes[owner[n]]++, n);
+  }
+  delete[] sizes;
+  delete[] owner;
+  delete[] members;
+  delete r;
+}
+
+void CascadeTrainer::TrainTile(size_t begin, size_t end, void *arg) {
+  TrainTask *task = reinterpret_cast<TrainTask*>(arg);
+  for (size_t i = begin; i < end; ++i) {
+    task->cascade->Train(&task->nodes[i], i, task->level, task->tau,
+        task->upsilon);
+  }
+}
+
+void CascadeTrainer::Train(Node *node, size_t index, size_t level,
+    double tau, double upsilon) {
+  size_t size = node->rows->Size();
+  node->x = x->GatherRows(node->rows);
+  node->t = new Vector(size);
+  for (size_t n = 0; n < size; ++n) {
+    node->t->Set(n, t->Get(node->rows->Get(n)));
+  }
+  node->trainer = new Trainer(node->x, node->t, classes, kernel);
+  node->trainer->SetSeed(base_seed + level * partitions + index);
+  node->trainer->SetCdfTable(cdf_table);
+  if (node->landmarks == NULL) {
+    // Leaves train on their whole partition.
+    node->trainer->SetLandmarks(LANDMARKS_STRATIFIED, size);
+  } else {
+    node->trainer->SetLandmarkRows(node->landmarks, readmit);
+    node->trainer->SetIterations(MERGE_ITERATIONS);
+  }
+  node->trainer->Process(tau, upsilon);
+  LOG(VERBOSE, "Cascade level %zu part %zu: %zu samples, %zu relevance "
+      "vectors.\n", level, index, size, node->trainer->GetActive()->Size());
+}
+
+// The union of the nodes' samples, in node order, starting from the union
+// of their relevance vectors.  Frees the nodes.
+CascadeTrainer::Node CascadeTrainer::Merge(Node *nodes, size_t count) {
+  size_t size = 0;
+  size_t landmarks = 0;
+  for (size_t i = 0; i < count; ++i) {
+    size += nodes[i].rows->Size();
+    landmarks += nodes[i].trainer->GetActive()->Size();
+  }
+  Node ret = { new Vector(size), new Vector(landmarks), NULL, NULL, NULL };
+  size_t offset = 0;
+  size_t landmark = 0;
+  for (size_t i = 0; i < count; ++i) {
+    Vector *active = nodes[i].trainer->GetActive();
+    for (size_t j = 0; j < active->Size(); ++j) {
+      ret.landmarks->Set(landmark++, offset + active->Get(j));
+    }
+    for (size_t n = 0; n < nodes[i].rows->Size(); ++n) {
+      ret.rows->Set(offset + n, nodes[i].rows->Get(n));
+    }
+    offset += nodes[i].rows->Size();
+    Free(&nodes[i]);
+  }
+  return ret;
+}
+
+void CascadeTrainer::Process(double tau, double upsilon) {
+  Free(&root);
+  size_t count = partitions < x->Height() ? partitions : x->Height();
+  partitions = count;
+  Node *nodes = new Node[count];
+  Partition(nodes);
+  for (size_t level = 0; ; ++level) {
+    TrainTask task = { this, nodes, level, tau, upsilon };
+    Scheduler::ParallelFor("cascade", count, 1, TrainTile, &task);
+    if (count == 1) {
+      break;
+    }
+    // Pairs of neighbours merge; with an odd count the last three do.
+    size_t merged = count / 2;
+    for (size_t i = 0; i < merged; ++i) {
+      size_t width = i + 1 == merged && count % 2 == 1 ? 3 : 2;
+      nodes[i] = Merge(&nodes[2 * i], width);
+    }
+    count = merged;
+  }
+  root = nodes[0];
+  delete[] nodes;
+}
+}
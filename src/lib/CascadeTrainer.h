@@ -0,0 +1,74 @@
+// Copyright 2011 Jason Marcell
+
+#ifndef SRC_LIB_CASCADETRAINER_H_
+#define SRC_LIB_CASCADETRAINER_H_
+
+#include "lib/Matrix.h"
+#include "lib/Vector.h"
+#include "lib/Kernel.h"
+#include "lib/Trainer.h"
+#include "lib/NormalCdfTable.h"
+
+namespace jason {
+
+class Matrix;
+class Vector;
+class Kernel;
+class Trainer;
+class NormalCdfTable;
+
+// Divide-and-conquer training.  The samples are dealt into class-stratified
+// partitions, each trained by its own Trainer as one Scheduler task.
+// Neighbouring partitions are then merged in pairs, each merge training on
+// the union of their samples but starting from the union of their
+// relevance vectors as landmarks, and the merging repeats until a single
+// model covers every sample.  No trainer ever holds more than a
+// partition's square kernel, or the kernel rows of its active set against
+// its samples, so memory grows with N^2 / partitions + M N rather than N^2.
+// The kernel is only used through Block() and is shared by every trainer.
+class CascadeTrainer {
+  public:
+    CascadeTrainer(Matrix *x, Vector *labels, size_t classes, Kernel *kernel,
+        size_t partitions);
+    virtual ~CascadeTrainer();
+    void SetSeed(unsigned long seed);
+    void SetCdfTable(NormalCdfTable *table);
+    void Process(double tau, double upsilon);
+    // The trainer of the final merge, whose training matrix holds every
+    // sample in partition order.  Owned by the cascade.
+    Trainer *GetTrainer();
+  private:
+    struct Node {
+      Vector *rows;       // Sample indices into x
+      Vector *landmarks;  // Indices into rows to start from, or NULL
+      Matrix *x;
+      Vector *t;
+      Trainer *trainer;
+    };
+    struct TrainTask {
+      CascadeTrainer *cascade;
+      Node *nodes;
+      size_t level;
+      double tau;
+      double upsilon;
+    };
+    static void TrainTile(size_t begin, size_t end, void *arg);
+    void Train(Node *node, size_t index, size_t level, double tau,
+        double upsilon);
+    Node Merge(Node *nodes, size_t count);
+    void Partition(Node *nodes);
+    void Free(Node *node);
+    Matrix *x;
+    Vector *t;
+    size_t classes;
+    Kernel *kernel;
+    size_t partitions;
+    size_t readmit;  // Samples per partition, bounding each re-admission
+    unsigned long seed;
+    unsigned long base_seed;  // Nonzero; node seeds count up from it
+    NormalCdfTable *cdf_table;
+    Node root;
+};
+}
+
+#endif  // SRC_LIB_CASCADETRAINER_H_
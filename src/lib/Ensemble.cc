@@ -0,0 +1,181 @@
+// Copyright 2011 Jason Marcell
+
+#include "lib/Ensemble.h"
+#include "lib/Predictor.h"
+#include "lib/RandomNumberGenerator.h"
+#include "lib/Scheduler.h"
+#include "lib/Log.h"
+
+namespace jason {
+
+struct EnsembleTask {
+  Trainer **trainers;
+  double tau;
+  double upsilon;
+};
+
+static void TrainModels(size_t begin, size_t end, void *arg) {
+  EnsembleTask *task = reinterpret_cast<EnsembleTask*>(arg);
+  for (size_t m = begin; m < end; ++m) {
+    task->trainers[m]->Process(task->tau, task->upsilon);
+  }
+}
+
+Ensemble::Ensemble(Matrix *x, Vector *labels, size_t classes, Kernel *kernel,
+    size_t models, bool bootstrap) {
+  this->x = x;
+  this->t = labels;
+  this->k = kernel;
+  this->classes = classes;
+  this->models = models;
+  this->bootstrap = bootstrap;
+  this->seed = 1;
+  this->train_cdf_table = NULL;
+  this->predict_cdf_table = NULL;
+  this->rows = new Vector*[models];
+  this->trainers = new Trainer*[models];
+  for (size_t m = 0; m < models; ++m) {
+    rows[m] = NULL;
+    trainers[m] = NULL;
+  }
+  this->relevance_vectors = NULL;
+  this->w = NULL;
+}
+
+Ensemble::~Ensemble() {
+  for (size_t m = 0; m < models; ++m) {
+    delete trainers[m];
+    delete rows[m];
+  }
+  delete[] trainers;
+  delete[] rows;
+  delete relevance_vectors;
+  delete w;
+}
+
+void Ensemble::SetSeed(unsigned long seed) {
+  this->seed = seed;
+}
+
+void Ensemble::SetCdfTables(NormalCdfTable *train, NormalCdfTable *predict) {
+  this->train_cdf_table = train;
+  this->predict_cdf_table = predict;
+}
+
+void Ensemble::Process(double tau, double upsilon) {
+  LOG(DEBUG, "== Beginning Ensemble of %zu. ==\n", models);
+  k->Init();
+
+  size_t samples = x->Height();
+  RandomNumberGenerator *r = new RandomNumberGenerator(seed);
+  for (size_t m = 0; m < models; ++m) {
+    rows[m] = new Vector(samples);
+    for (size_t n = 0; n < samples; ++n) {
+      if (bootstrap) {
+        size_t draw = r->SampleUniform(0, samples);
+        rows[m]->Set(n, draw < samples ? draw : samples - 1);
+      } else {
+        rows[m]->Set(n, n);
+      }
+    }
+    trainers[m] = new Trainer(k, t, classes, rows[m]);
+    trainers[m]->SetSeed(seed + m + 1);
+    trainers[m]->SetCdfTable(train_cdf_table);
+  }
+  delete r;
+
+  // One task per model; each model's own loops nest inside it and share
+  // the scheduler's threads.
+  EnsembleTask task = { trainers, tau, upsilon };
+  Scheduler::ParallelFor("ensemble", models, 1, TrainModels, &task);
+  for (size_t m = 0; m < models; ++m) {
+    LOG(VERBOSE, "Model %zu kept %zu relevance vectors.\n", m,
+        trainers[m]->GetActive()->Size());
+  }
+
+  Merge();
+  LOG(DEBUG, "== End Ensemble. ==\n");
+}
+
+// Collects the union of the models' relevance vectors and lays their
+// weights out side by side, so that a single test kernel and a single GEMM
+// score every model.  A bootstrap model can hold the same training row more
+// than once; its weights for that row are summed.
+void Ensemble::Merge() {
+  size_t samples = x->Height();
+  Vector *slot = new Vector(samples);
+  for (size_t n = 0; n < samples; ++n) {
+    slot->Set(n, -1);
+  }
+  size_t count = 0;
+  for (size_t m = 0; m < models; ++m) {
+    Vector *active = trainers[m]->GetActive();
+    for (size_t row = 0; row < active->Size(); ++row) {
+      size_t n = active->Get(row);
+      if (slot->Get(n) < 0) {
+        slot->Set(n, count++);
+      }
+    }
+  }
+  Vector *union_rows = new Vector(count);
+  for (size_t n = 0; n < samples; ++n) {
+    if (slot->Get(n) >= 0) {
+      union_rows->Set(slot->Get(n), n);
+    }
+  }
+
+  w = new Matrix(count, models * classes);
+  w->SetAll(0.0);
+  for (size_t m = 0; m < models; ++m) {
+    Vector *active = trainers[m]->GetActive();
+    Matrix *w_m = trainers[m]->GetW();
+    for (size_t row = 0; row < active->Size(); ++row) {
+      size_t dst = slot->Get(active->Get(row));
+      for (size_t c = 0; c < classes; ++c) {
+        size_t col = m * classes + c;
+        w->Set(dst, col, w->Get(dst, col) + w_m->Get(row, c));
+      }
+    }
+  }
+  relevance_vectors = x->GatherRows(union_rows);
+  LOG(VERBOSE, "Ensemble uses %zu distinct relevance vectors.\n", count);
+  delete union_rows;
+  delete slot;
+}
+
+Matrix *Ensemble::GetRelevanceVectors() {
+  return relevance_vectors;
+}
+
+Matrix *Ensemble::Predict(Matrix *x_predict, Kernel *test_kernel) {
+  Predictor *predictor = new Predictor(w, relevance_vectors, x_predict,
+      test_kernel);
+  predictor->SetCdfTable(predict_cdf_table);
+  test_kernel->Init();
+  Matrix *scores = predictor->Scores();
+
+  Matrix *result = new Matrix(scores->Height(), classes);
+  result->SetAll(0.0);
+  Matrix *model_scores = new Matrix(scores->Height(), classes);
+  for (size_t m = 0; m < models; ++m) {
+    for (size_t n = 0; n < scores->Height(); ++n) {
+      for (size_t c = 0; c < classes; ++c) {
+        model_scores->Set(n, c, scores->Get(n, m * classes + c));
+      }
+    }
+    Matrix *probabilities = predictor->QuadratureApproximation(model_scores);
+    probabilities->NormalizeResults();
+    for (size_t n = 0; n < scores->Height(); ++n) {
+      for (size_t c = 0; c < classes; ++c) {
+        result->Set(n, c,
+            result->Get(n, c) + probabilities->Get(n, c) / models);
+      }
+    }
+    delete probabilities;
+  }
+  delete model_scores;
+  delete scores;
+  delete predictor;
+  return result;
+}
+}
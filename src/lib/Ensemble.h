@@ -0,0 +1,54 @@
+// Copyright 2011 Jason Marcell
+
+#ifndef SRC_LIB_ENSEMBLE_H_
+#define SRC_LIB_ENSEMBLE_H_
+
+#include "lib/Matrix.h"
+#include "lib/Vector.h"
+#include "lib/Kernel.h"
+#include "lib/Trainer.h"
+#include "lib/NormalCdfTable.h"
+
+namespace jason {
+
+class Matrix;
+class Vector;
+class Kernel;
+class Trainer;
+class NormalCdfTable;
+
+// Trains several mRVMs concurrently, one Scheduler task each, from
+// different seeds and optionally on bootstrap samples.  The training kernel
+// is computed once and shared read-only by every model.  Prediction
+// evaluates one test kernel against the union of all models' relevance
+// vectors and averages the class probabilities of the models.
+class Ensemble {
+  public:
+    Ensemble(Matrix *x, Vector *labels, size_t classes, Kernel *kernel,
+        size_t models, bool bootstrap);
+    virtual ~Ensemble();
+    void SetSeed(unsigned long seed);
+    void SetCdfTables(NormalCdfTable *train, NormalCdfTable *predict);
+    void Process(double tau, double upsilon);
+    // Training rows that are relevance vectors of at least one model.  The
+    // test kernel passed to Predict() must be built against this matrix.
+    Matrix *GetRelevanceVectors();
+    Matrix *Predict(Matrix *x_predict, Kernel *test_kernel);
+  private:
+    void Merge();
+    Matrix *x;
+    Vector *t;
+    Kernel *k;
+    size_t classes, models;
+    bool bootstrap;
+    unsigned long seed;
+    NormalCdfTable *train_cdf_table;
+    NormalCdfTable *predict_cdf_table;
+    Vector **rows;
+    Trainer **trainers;
+    Matrix *relevance_vectors;
+    Matrix *w;  // Weights of every model side by side, one row per RV
+};
+}
+
+#endif  // SRC_LIB_ENSEMBLE_H_
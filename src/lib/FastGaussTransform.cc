@@ -0,0 +1,397 @@
+// Copyright 2011 Jason Marcell
+
+#include <math.h>
+
+#include "lib/FastGaussTransform.h"
+#include "lib/Scheduler.h"
+#include "lib/Log.h"
+
+#define MAX_ORDER 20
+#define MAX_TERMS 2000
+#define MAX_CLUSTERS 1024
+// Rough costs relative to a multiply-add in the direct sum, measured on
+// x86-64: exp() and one expansion term (monomial plus class coefficients).
+#define EXP_COST 40
+#define TERM_COST 3
+#define RANGE_PROBES 256  // Centers sampled to estimate the visited clusters
+#define TARGET_GRAIN 64   // Targets per evaluation task
+
+namespace jason {
+
+FastGaussTransform::FastGaussTransform(Matrix *sources, Matrix *weights,
+    Vector *theta, double tolerance) {
+  this->sources = sources->Height();
+  this->dims = sources->Width();
+  this->classes = weights->Width();
+  this->weights = weights;
+  scale = new double[dims];
+  for (size_t d = 0; d < dims; ++d) {
+    scale[d] = sqrt(theta->Get(d) / 2.0);
+  }
+  x = new double[this->sources * dims];
+  Scale(sources, x);
+  owner = new size_t[this->sources];
+  heads = new size_t[dims];
+  centers = NULL;
+  radii = NULL;
+  alpha = NULL;
+  constants = NULL;
+  coefficients = NULL;
+  direct = true;
+
+  // Total absolute weight bounds the error of every class sum.
+  double q = 0;
+  for (size_t c = 0; c < classes; ++c) {
+    double q_c = 0;
+    for (size_t m = 0; m < this->sources; ++m) {
+      q_c += fabs(weights->Get(m, c));
+    }
+    if (q_c > q) q = q_c;
+  }
+  if (q == 0 || tolerance <= 0) {
+    LOG(VERBOSE, "FastGaussTransform: direct evaluation.\n");
+    return;
+  }
+
+  // More clusters shrink the source radius and so the order needed, but
+  // each target then visits more clusters.  Pick the cluster count with
+  // the lowest estimated cost per target, if it beats a direct sum.
+  double best_cost = static_cast<double>(this->sources)
+      * (dims + classes + EXP_COST);
+  size_t best_clusters = 0;
+  size_t max_clusters = this->sources / 4;
+  if (max_clusters > MAX_CLUSTERS) max_clusters = MAX_CLUSTERS;
+  double spread = 2.0 * q / tolerance;
+  Cluster(max_clusters);
+  for (size_t k = 1; k <= max_clusters; k *= 2) {
+    clusters = k;
+    source_radius = radii[k];
+    // Clusters farther than the cutoff contribute at most tolerance / 2.
+    cutoff = source_radius + (spread > 1 ? sqrt(log(spread)) : 0);
+    size_t p = ChooseOrder(tolerance / (2.0 * q));
+    if (p == 0) continue;
+    // Number of monomials of degree < p in dims variables.
+    double count = 1;
+    for (size_t i = 1; i <= dims; ++i) {
+      count = count * (p - 1 + i) / i;
+    }
+    if (count > MAX_TERMS) continue;
+    double cost = ClustersInRange()
+        * (count * (classes + 1) * TERM_COST + EXP_COST);
+    LOG(DEBUG, "FastGaussTransform: %zu clusters, order %zu, cost %g.\n", k,
+        p, cost);
+    if (cost < best_cost) {
+      best_cost = cost;
+      best_clusters = k;
+      order = p;
+      terms = static_cast<size_t>(count + 0.5);
+    }
+  }
+  if (best_clusters > 0) {
+    Assign(best_clusters);
+    cutoff = source_radius + (spread > 1 ? sqrt(log(spread)) : 0);
+    direct = false;
+  }
+  if (direct) {
+    LOG(VERBOSE, "FastGaussTransform: direct sums are cheaper.\n");
+    return;
+  }
+  LOG(VERBOSE, "FastGaussTransform: %zu clusters, radius %.3f, order %zu, "
+      "%zu terms, cutoff %.3f.\n", clusters, source_radius, order, terms,
+      cutoff);
+  ComputeCoefficients();
+}
+
+FastGaussTransform::~FastGaussTransform() {
+  delete[] coefficients;
+  delete[] constants;
+  delete[] alpha;
+  delete[] radii;
+  delete[] centers;
+  delete[] owner;
+  delete[] heads;
+  delete[] x;
+  delete[] scale;
+}
+
+void FastGaussTransform::Scale(Matrix *points, double *out) {
+  for (size_t row = 0; row < points->Height(); ++row) {
+    for (size_t d = 0; d < dims; ++d) {
+      out[row * dims + d] = points->Get(row, d) * scale[d];
+    }
+  }
+}
+
+// Farthest-point clustering (Gonzalez): a 2-approximation of the smallest
+// maximum cluster radius.  Centers are source points, and the first k
+// centers are the clustering for k clusters, so one pass records the
+// radius for every k up to max_clusters.
+void FastGaussTransform::Cluster(size_t max_clusters) {
+  centers = new double[max_clusters * dims];
+  radii = new double[max_clusters + 1];
+  double *distance = new double[sources];
+  size_t next = 0;
+  for (size_t m = 0; m < sources; ++m) {
+    distance[m] = HUGE_VAL;
+  }
+  radii[0] = HUGE_VAL;
+  for (size_t j = 0; j < max_clusters; ++j) {
+    for (size_t d = 0; d < dims; ++d) {
+      centers[j * dims + d] = x[next * dims + d];
+    }
+    size_t farthest = 0;
+    for (size_t m = 0; m < sources; ++m) {
+      double dist = 0;
+      for (size_t d = 0; d < dims; ++d) {
+        double diff = x[m * dims + d] - centers[j * dims + d];
+        dist += diff * diff;
+      }
+      if (dist < distance[m]) {
+        distance[m] = dist;
+      }
+      if (distance[m] > distance[farthest]) {
+        farthest = m;
+      }
+    }
+    next = farthest;
+    radii[j + 1] = sqrt(distance[next]);
+  }
+  delete[] distance;
+}
+
+// Assigns every source to its nearest of the first k centers.
+void FastGaussTransform::Assign(size_t k) {
+  clusters = k;
+  source_radius = 0;
+  for (size_t m = 0; m < sources; ++m) {
+    double best = HUGE_VAL;
+    for (size_t j = 0; j < k; ++j) {
+      double dist = 0;
+      for (size_t d = 0; d < dims; ++d) {
+        double diff = x[m * dims + d] - centers[j * dims + d];
+        dist += diff * diff;
+      }
+      if (dist < best) {
+        best = dist;
+        owner[m] = j;
+      }
+    }
+    if (best > source_radius) source_radius = best;
+  }
+  source_radius = sqrt(source_radius);
+}
+
+// Expected number of clusters a target visits, estimated with (up to
+// RANGE_PROBES) cluster centers standing in for targets.
+double FastGaussTransform::ClustersInRange() {
+  size_t probes = clusters < RANGE_PROBES ? clusters : RANGE_PROBES;
+  size_t stride = clusters / probes;
+  double cutoff2 = cutoff * cutoff;
+  size_t in_range = 0;
+  for (size_t i = 0; i < probes; ++i) {
+    const double *probe = centers + i * stride * dims;
+    for (size_t j = 0; j < clusters; ++j) {
+      double dist = 0;
+      for (size_t d = 0; d < dims; ++d) {
+        double diff = probe[d] - centers[j * dims + d];
+        dist += diff * diff;
+      }
+      in_range += dist <= cutoff2;
+    }
+  }
+  return static_cast<double>(in_range) / probes;
+}
+
+// Smallest order p with (2^p / p!) (r_x r_y)^p below the relative
+// tolerance, or 0 if none up to MAX_ORDER.
+size_t FastGaussTransform::ChooseOrder(double relative) {
+  double rr = source_radius * cutoff;
+  double bound = 1;
+  for (size_t p = 1; p <= MAX_ORDER; ++p) {
+    bound *= 2.0 * rr / p;
+    if (bound <= relative) {
+      return p;
+    }
+  }
+  return 0;
+}
+
+// All monomials of x of degree < order, in graded order.
+void FastGaussTransform::Monomials(const double *v, double *out,
+    size_t *heads) {
+  for (size_t d = 0; d < dims; ++d) {
+    heads[d] = 0;
+  }
+  out[0] = 1;
+  size_t t = 1;
+  for (size_t k = 1, tail = 1; k < order; ++k, tail = t) {
+    for (size_t d = 0; d < dims; ++d) {
+      size_t head = heads[d];
+      heads[d] = t;
+      for (size_t j = head; j < tail; ++j, ++t) {
+        out[t] = v[d] * out[j];
+      }
+    }
+  }
+}
+
+void FastGaussTransform::ComputeCoefficients() {
+  // Multi-indices and 2^|alpha| / alpha!, built with the same recursion as
+  // Monomials() so that the term order matches.
+  alpha = new size_t[terms * dims];
+  constants = new double[terms];
+  for (size_t d = 0; d < dims; ++d) {
+    heads[d] = 0;
+    alpha[d] = 0;
+  }
+  constants[0] = 1;
+  size_t t = 1;
+  for (size_t k = 1, tail = 1; k < order; ++k, tail = t) {
+    for (size_t d = 0; d < dims; ++d) {
+      size_t head = heads[d];
+      heads[d] = t;
+      for (size_t j = head; j < tail; ++j, ++t) {
+        for (size_t e = 0; e < dims; ++e) {
+          alpha[t * dims + e] = alpha[j * dims + e];
+        }
+        alpha[t * dims + d] += 1;
+        constants[t] = constants[j] * 2.0 / alpha[t * dims + d];
+      }
+    }
+  }
+
+  coefficients = new double[clusters * terms * classes];
+  for (size_t i = 0; i < clusters * terms * classes; ++i) {
+    coefficients[i] = 0;
+  }
+  double *dx = new double[dims];
+  double *mono = new double[terms];
+  for (size_t m = 0; m < sources; ++m) {
+    size_t j = owner[m];
+    double dist = 0;
+    for (size_t d = 0; d < dims; ++d) {
+      dx[d] = x[m * dims + d] - centers[j * dims + d];
+      dist += dx[d] * dx[d];
+    }
+    Monomials(dx, mono, heads);
+    double e = exp(-dist);
+    for (size_t c = 0; c < classes; ++c) {
+      double wc = weights->Get(m, c) * e;
+      double *coef = coefficients + (j * classes + c) * terms;
+      for (size_t a = 0; a < terms; ++a) {
+        coef[a] += wc * mono[a];
+      }
+    }
+  }
+  for (size_t jc = 0; jc < clusters * classes; ++jc) {
+    for (size_t a = 0; a < terms; ++a) {
+      coefficients[jc * terms + a] *= constants[a];
+    }
+  }
+  delete[] mono;
+  delete[] dx;
+}
+
+struct EvaluateTask {
+  FastGaussTransform *transform;
+  const double *y;
+  const double *w;  // Weights for the direct sum, NULL for the expansion
+  Matrix *result;
+};
+
+Matrix *FastGaussTransform::Evaluate(Matrix *targets) {
+  size_t count = targets->Height();
+  double *y = new double[count * dims];
+  Scale(targets, y);
+  double *w = NULL;
+  if (direct) {
+    w = new double[sources * classes];
+    for (size_t m = 0; m < sources; ++m) {
+      for (size_t c = 0; c < classes; ++c) {
+        w[m * classes + c] = weights->Get(m, c);
+      }
+    }
+  }
+  Matrix *result = new Matrix(count, classes);
+  EvaluateTask task = { this, y, w, result };
+  Scheduler::ParallelFor("fast_gauss", count, TARGET_GRAIN, EvaluateTile,
+      &task);
+  delete[] w;
+  delete[] y;
+  return result;
+}
+
+void FastGaussTransform::EvaluateTile(size_t begin, size_t end, void *arg) {
+  EvaluateTask *task = reinterpret_cast<EvaluateTask*>(arg);
+  if (task->w != NULL) {
+    task->transform->EvaluateDirectRows(begin, end, task->y, task->w,
+        task->result);
+  } else {
+    task->transform->EvaluateRows(begin, end, task->y, task->result);
+  }
+}
+
+void FastGaussTransform::EvaluateRows(size_t begin, size_t end,
+    const double *y, Matrix *result) {
+  double *dy = new double[dims];
+  double *mono = new double[terms];
+  double *sums = new double[classes];
+  size_t *scratch = new size_t[dims];
+  double cutoff2 = cutoff * cutoff;
+  for (size_t n = begin; n < end; ++n) {
+    for (size_t c = 0; c < classes; ++c) {
+      sums[c] = 0;
+    }
+    for (size_t j = 0; j < clusters; ++j) {
+      double dist = 0;
+      for (size_t d = 0; d < dims; ++d) {
+        dy[d] = y[n * dims + d] - centers[j * dims + d];
+        dist += dy[d] * dy[d];
+      }
+      if (dist > cutoff2) continue;
+      Monomials(dy, mono, scratch);
+      double e = exp(-dist);
+      for (size_t c = 0; c < classes; ++c) {
+        const double *coef = coefficients + (j * classes + c) * terms;
+        double sum = 0;
+        for (size_t a = 0; a < terms; ++a) {
+          sum += coef[a] * mono[a];
+        }
+        sums[c] += e * sum;
+      }
+    }
+    for (size_t c = 0; c < classes; ++c) {
+      result->Set(n, c, sums[c]);
+    }
+  }
+  delete[] scratch;
+  delete[] sums;
+  delete[] mono;
+  delete[] dy;
+}
+
+void FastGaussTransform::EvaluateDirectRows(size_t begin, size_t end,
+    const double *y, const double *w, Matrix *result) {
+  double *sums = new double[classes];
+  for (size_t n = begin; n < end; ++n) {
+    for (size_t c = 0; c < classes; ++c) {
+      sums[c] = 0;
+    }
+    for (size_t m = 0; m < sources; ++m) {
+      double dist = 0;
+      for (size_t d = 0; d < dims; ++d) {
+        double diff = y[n * dims + d] - x[m * dims + d];
+        dist += diff * diff;
+      }
+      double e = exp(-dist);
+      for (size_t c = 0; c < classes; ++c) {
+        sums[c] += e * w[m * classes + c];
+      }
+    }
+    for (size_t c = 0; c < classes; ++c) {
+      result->Set(n, c, sums[c]);
+    }
+  }
+  delete[] sums;
+}
+}
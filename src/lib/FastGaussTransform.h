@@ -0,0 +1,68 @@
+// Copyright 2011 Jason Marcell
+
+#ifndef SRC_LIB_FASTGAUSSTRANSFORM_H_
+#define SRC_LIB_FASTGAUSSTRANSFORM_H_
+
+#include <stddef.h>
+
+#include "lib/Matrix.h"
+#include "lib/Vector.h"
+
+namespace jason {
+
+class Matrix;
+class Vector;
+
+// Improved Fast Gauss Transform (Yang, Duraiswami, Gumerov, Davis).
+// Computes, for every target y and class c,
+//
+//   G_c(y) = sum_m w_mc exp(-0.5 * sum_d theta_d (y_d - x_md)^2)
+//
+// without forming the source/target kernel.  Sources are grouped by
+// farthest-point clustering and each cluster's contribution is replaced by
+// a truncated Taylor expansion about its center; clusters beyond a cutoff
+// radius from a target are skipped.  The number of clusters, the expansion
+// order and the cutoff are chosen so that the absolute error of every sum
+// stays below the tolerance.  When no such choice is cheaper than a direct
+// sum, the transform evaluates the sums directly.
+class FastGaussTransform {
+  public:
+    FastGaussTransform(Matrix *sources, Matrix *weights, Vector *theta,
+        double tolerance);
+    virtual ~FastGaussTransform();
+    Matrix *Evaluate(Matrix *targets);
+  private:
+    void Scale(Matrix *points, double *out);
+    void Cluster(size_t max_clusters);
+    void Assign(size_t clusters);
+    size_t ChooseOrder(double tolerance);
+    double ClustersInRange();
+    // `heads` is dims scratch values.
+    void Monomials(const double *x, double *out, size_t *heads);
+    void ComputeCoefficients();
+    static void EvaluateTile(size_t begin, size_t end, void *arg);
+    void EvaluateRows(size_t begin, size_t end, const double *y,
+        Matrix *result);
+    void EvaluateDirectRows(size_t begin, size_t end, const double *y,
+        const double *w, Matrix *result);
+    size_t sources, dims, classes;
+    double *x;          // Sources scaled so the kernel is exp(-|y - x|^2)
+    double *scale;      // sqrt(theta_d / 2)
+    Matrix *weights;
+    size_t clusters;
+    size_t *owner;      // Cluster of every source
+    double *centers;
+    double *radii;      // Clustering radius with the first k centers
+    double source_radius;
+    double cutoff;      // Targets farther than this from a center skip it
+    size_t order;       // Expansion uses monomials of degree < order
+    size_t terms;
+    size_t *alpha;      // Multi-index of every term
+    double *constants;  // 2^|alpha| / alpha!
+    double *coefficients;  // clusters x classes x terms
+    size_t *heads;      // Scratch for ComputeCoefficients()
+    bool direct;
+};
+}
+
+#endif  // SRC_LIB_FASTGAUSSTRANSFORM_H_
@@ -3,8 +3,12 @@
 #include <math.h>
 
 #include "lib/GaussianKernel.h"
+#include "lib/Scheduler.h"
 #include "lib/Log.h"
 
+#define FEATURE_GRAIN 4  // Features per relevance task
+#define SAMPLE_GRAIN 64  // Samples per margin task
+
 namespace jason {
 
 GaussianKernel::GaussianKernel(Matrix *m1, Matrix *m2, int param)
@@ -36,4 +40,159 @@ double GaussianKernel::KernelElementFunction(Vector *vec1, Vector *vec2) {
   delete v2;
   return exp(-0.5 * ret);
 }
+
+void GaussianKernel::SetParam(int param) {
+  for (size_t i = 0; i < theta->Height(); ++i) {
+    theta->Set(i, i, static_cast<double>(param));
+  }
+}
+
+// exp(-theta d^2 / 2) needs a single theta; after per-feature scaling the
+// kernel is no function of the plain distances.
+KernelBaseType GaussianKernel::BaseType() {
+  for (size_t i = 1; i < theta->Height(); ++i) {
+    if (theta->Get(i, i) != theta->Get(0, 0)) {
+      return BASE_NONE;
+    }
+  }
+  return BASE_DISTANCES;
+}
+
+// The kernel is 1 on the diagonal, so needs no normalization.
+void GaussianKernel::TransformRow(const double *base, double norm1,
+    const double *norms2, double *out, size_t width) {
+  double scale = -0.5 * theta->Get(0, 0);
+  for (size_t col = 0; col < width; ++col) {
+    out[col] = exp(scale * base[col]);
+  }
+}
+
+// The per-dimension inverse squared length scales.
+Vector *GaussianKernel::GetTheta() {
+  Vector *ret = new Vector(theta->Height());
+  for (size_t i = 0; i < theta->Height(); ++i) {
+    ret->Set(i, theta->Get(i, i));
+  }
+  return ret;
+}
+
+namespace {
+
+struct RelevanceTask {
+  Matrix *theta;
+  Matrix *relevance_vectors;
+  Matrix *w;
+  Matrix *samples;
+  Vector *labels;
+  Matrix *distances;  // sum_d theta_d (x_d - r_d)^2 per sample and vector
+  double *margins;
+  Vector *relevance;
+};
+
+double Margin(const double *scores, size_t classes, size_t label) {
+  double others = 0;
+  for (size_t c = 0; c < classes; ++c) {
+    if (c != label) {
+      others += scores[c];
+    }
+  }
+  return scores[label] - others / (classes - 1);
+}
+}  // namespace
+
+Vector *GaussianKernel::FeatureRelevance(Matrix *relevance_vectors,
+    Matrix *w, Matrix *samples, Vector *labels) {
+  Matrix *distances = new Matrix(samples->Height(),
+      relevance_vectors->Height());
+  double *margins = new double[samples->Height()];
+  Vector *ret = new Vector(samples->Width());
+  RelevanceTask task = { theta, relevance_vectors, w, samples, labels,
+      distances, margins, ret };
+  Scheduler::ParallelFor("feature_margins", samples->Height(), SAMPLE_GRAIN,
+      MarginTile, &task);
+  Scheduler::ParallelFor("feature_relevance", samples->Width(),
+      FEATURE_GRAIN, RelevanceTile, &task);
+  delete[] margins;
+  delete distances;
+  return ret;
+}
+
+// The weighted squared distances of samples [begin, end) to every
+// relevance vector, and their margins with every feature.
+void GaussianKernel::MarginTile(size_t begin, size_t end, void *arg) {
+  RelevanceTask *task = reinterpret_cast<RelevanceTask*>(arg);
+  Matrix *w = task->w;
+  Matrix *rvs = task->relevance_vectors;
+  size_t classes = w->Width();
+  double *scores = new double[classes];
+  for (size_t n = begin; n < end; ++n) {
+    for (size_t c = 0; c < classes; ++c) {
+      scores[c] = 0;
+    }
+    for (size_t m = 0; m < rvs->Height(); ++m) {
+      double d2 = 0;
+      for (size_t d = 0; d < rvs->Width(); ++d) {
+        double diff = task->samples->Get(n, d) - rvs->Get(m, d);
+        d2 += task->theta->Get(d, d) * diff * diff;
+      }
+      task->distances->Set(n, m, d2);
+      double elem = exp(-0.5 * d2);
+      for (size_t c = 0; c < classes; ++c) {
+        scores[c] += elem * w->Get(m, c);
+      }
+    }
+    task->margins[n] = Margin(scores, classes, task->labels->Get(n));
+  }
+  delete[] scores;
+}
+
+// Leaving feature d out takes theta_d (x_d - r_d)^2 off the squared
+// distance.  Rounding can take the difference just below zero.
+void GaussianKernel::RelevanceTile(size_t begin, size_t end, void *arg) {
+  RelevanceTask *task = reinterpret_cast<RelevanceTask*>(arg);
+  Matrix *w = task->w;
+  Matrix *rvs = task->relevance_vectors;
+  size_t classes = w->Width();
+  double *scores = new double[classes];
+  for (size_t d = begin; d < end; ++d) {
+    double theta = task->theta->Get(d, d);
+    double loss = 0;
+    for (size_t n = 0; n < task->samples->Height(); ++n) {
+      double x = task->samples->Get(n, d);
+      for (size_t c = 0; c < classes; ++c) {
+        scores[c] = 0;
+      }
+      for (size_t m = 0; m < rvs->Height(); ++m) {
+        double diff = x - rvs->Get(m, d);
+        double d2 = task->distances->Get(n, m) - theta * diff * diff;
+        double elem = exp(-0.5 * (d2 > 0 ? d2 : 0));
+        for (size_t c = 0; c < classes; ++c) {
+          scores[c] += elem * w->Get(m, c);
+        }
+      }
+      loss += task->margins[n]
+          - Margin(scores, classes, task->labels->Get(n));
+    }
+    task->relevance->Set(d, loss / task->samples->Height());
+  }
+  delete[] scores;
+}
+
+// exp(-0.5 * sum_d theta_d diff_d^2) <= exp(-0.5 * min(theta) |diff|^2), so
+// beyond this radius every entry is below the tolerance.
+double GaussianKernel::CutoffRadius(double tolerance) {
+  if (tolerance <= 0 || tolerance >= 1) {
+    return -1;
+  }
+  double min_theta = theta->Get(0, 0);
+  for (size_t i = 1; i < theta->Height(); ++i) {
+    if (theta->Get(i, i) < min_theta) {
+      min_theta = theta->Get(i, i);
+    }
+  }
+  if (min_theta <= 0) {
+    return -1;
+  }
+  return sqrt(-2.0 * log(tolerance) / min_theta);
+}
 }
@@ -19,7 +19,23 @@ class GaussianKernel: public jason::Kernel {
     GaussianKernel(Matrix *m1, Matrix *m2, int param);
     virtual ~GaussianKernel();
     double KernelElementFunction(Vector *vec1, Vector *vec2);
+    double CutoffRadius(double tolerance);
+    void SetParam(int param);
+    KernelBaseType BaseType();
+    void TransformRow(const double *base, double norm1, const double *norms2,
+        double *out, size_t width);
+    Vector *GetTheta();
+    // Leave-one-feature-out relevance of each feature to a trained model:
+    // how much the margin of each sample's labelled class, f_t(x) minus the
+    // mean of the other class scores with f = k(x, relevance_vectors) w,
+    // falls on average over `samples` when the feature is left out of the
+    // kernel.  Features the model does not rely on score near zero or
+    // below.  Theta itself is not changed.
+    Vector *FeatureRelevance(Matrix *relevance_vectors, Matrix *w,
+        Matrix *samples, Vector *labels);
   private:
+    static void MarginTile(size_t begin, size_t end, void *arg);
+    static void RelevanceTile(size_t begin, size_t end, void *arg);
     Matrix *theta;
 };
 }
@@ -0,0 +1,198 @@
+// Copyright 2011 Jason Marcell
+
+#include <stdio.h>
+#include <string.h>
+
+#include "lib/KMeans.h"
+#include "lib/Scheduler.h"
+#include "lib/Log.h"
+
+#define ASSIGN_GRAIN 64  // Points per assignment task
+
+namespace jason {
+
+struct KMeansAssignTask {
+  KMeans *kmeans;
+  const double *points;  // Row-major, `dims` wide
+  size_t *out;
+};
+
+KMeans::KMeans(Matrix *points, size_t clusters) {
+  size = points->Height();
+  dims = points->Width();
+  this->clusters = clusters < size ? clusters : size;
+  data = new double[size * dims];
+  for (size_t row = 0; row < size; ++row) {
+    for (size_t col = 0; col < dims; ++col) {
+      data[row * dims + col] = points->Get(row, col);
+    }
+  }
+  centroids = new double[this->clusters * dims];
+  assignments = new size_t[size];
+  memset(assignments, 0, size * sizeof(*assignments));
+}
+
+KMeans::~KMeans() {
+  delete[] assignments;
+  delete[] centroids;
+  delete[] data;
+}
+
+size_t KMeans::Clusters() {
+  return clusters;
+}
+
+// k-means++: each further centroid is a point drawn with probability
+// proportional to its squared distance from the nearest centroid so far.
+void KMeans::Seed(RandomNumberGenerator *r) {
+  double *nearest = new double[size];
+  size_t first = static_cast<size_t>(r->SampleUniform(0, size));
+  first = first < size ? first : size - 1;
+  memcpy(centroids, data + first * dims, dims * sizeof(double));
+  for (size_t n = 0; n < size; ++n) {
+    nearest[n] = Distance2(data + n * dims, 0);
+  }
+  for (size_t c = 1; c < clusters; ++c) {
+    double total = 0;
+    for (size_t n = 0; n < size; ++n) {
+      total += nearest[n];
+    }
+    double draw = r->SampleUniform(0, total);
+    size_t pick = 0;
+    for (double sum = nearest[0]; sum < draw && pick + 1 < size;) {
+      sum += nearest[++pick];
+    }
+    memcpy(centroids + c * dims, data + pick * dims, dims * sizeof(double));
+    for (size_t n = 0; n < size; ++n) {
+      double d2 = Distance2(data + n * dims, c);
+      if (d2 < nearest[n]) {
+        nearest[n] = d2;
+      }
+    }
+  }
+  delete[] nearest;
+}
+
+void KMeans::Process(RandomNumberGenerator *r, size_t iterations) {
+  if (clusters == 0) {
+    return;
+  }
+  Seed(r);
+  size_t *next = new size_t[size];
+  size_t *counts = new size_t[clusters];
+  for (size_t i = 0; i < iterations; ++i) {
+    KMeansAssignTask task = { this, data, next };
+    Scheduler::ParallelFor("kmeans", size, ASSIGN_GRAIN, AssignTile, &task);
+    size_t changed = 0;
+    for (size_t n = 0; n < size; ++n) {
+      changed += i == 0 || next[n] != assignments[n];
+      assignments[n] = next[n];
+    }
+    LOG(DEBUG, "KMeans iteration %zu: %zu changed.\n", i, changed);
+    if (changed == 0) {
+      break;
+    }
+    // An empty cluster keeps its previous centroid.
+    memset(counts, 0, clusters * sizeof(*counts));
+    for (size_t n = 0; n < size; ++n) {
+      if (counts[assignments[n]]++ == 0) {
+        memset(centroids + assignments[n] * dims, 0, dims * sizeof(double));
+      }
+      double *centroid = centroids + assignments[n] * dims;
+      for (size_t d = 0; d < dims; ++d) {
+        centroid[d] += data[n * dims + d];
+      }
+    }
+    for (size_t c = 0; c < clusters; ++c) {
+      for (size_t d = 0; counts[c] > 0 && d < dims; ++d) {
+        centroids[c * dims + d] /= counts[c];
+      }
+    }
+  }
+  delete[] counts;
+  delete[] next;
+}
+
+void KMeans::AssignTile(size_t begin, size_t end, void *arg) {
+  KMeansAssignTask *task = reinterpret_cast<KMeansAssignTask*>(arg);
+  KMeans *kmeans = task->kmeans;
+  for (size_t n = begin; n < end; ++n) {
+    double distance;
+    task->out[n] = kmeans->Nearest(task->points + n * kmeans->dims,
+        &distance);
+  }
+}
+
+size_t KMeans::Nearest(const double *point, double *distance) {
+  size_t best = 0;
+  *distance = Distance2(point, 0);
+  for (size_t c = 1; c < clusters; ++c) {
+    double d2 = Distance2(point, c);
+    if (d2 < *distance) {
+      *distance = d2;
+      best = c;
+    }
+  }
+  return best;
+}
+
+double KMeans::Distance2(const double *point, size_t cluster) {
+  const double *centroid = centroids + cluster * dims;
+  double ret = 0;
+  for (size_t d = 0; d < dims; ++d) {
+    double diff = point[d] - centroid[d];
+    ret += diff * diff;
+  }
+  return ret;
+}
+
+Matrix *KMeans::GetCentroids() {
+  return new Matrix(centroids, clusters, dims);
+}
+
+Vector *KMeans::Assign(Matrix *points) {
+  size_t rows = points->Height();
+  double *buffer = new double[rows * dims];
+  for (size_t row = 0; row < rows; ++row) {
+    for (size_t col = 0; col < dims; ++col) {
+      buffer[row * dims + col] = points->Get(row, col);
+    }
+  }
+  size_t *out = new size_t[rows];
+  KMeansAssignTask task = { this, buffer, out };
+  Scheduler::ParallelFor("kmeans", rows, ASSIGN_GRAIN, AssignTile, &task);
+  Vector *ret = new Vector(rows);
+  for (size_t row = 0; row < rows; ++row) {
+    ret->Set(row, out[row]);
+  }
+  delete[] out;
+  delete[] buffer;
+  return ret;
+}
+
+Vector *KMeans::GetAssignments() {
+  Vector *ret = new Vector(size);
+  for (size_t n = 0; n < size; ++n) {
+    ret->Set(n, assignments[n]);
+  }
+  return ret;
+}
+
+Vector *KMeans::GetExemplars() {
+  Vector *ret = new Vector(clusters);
+  double *best = new double[clusters];
+  for (size_t c = 0; c < clusters; ++c) {
+    ret->Set(c, -1);
+  }
+  for (size_t n = 0; n < size; ++n) {
+    size_t c = assignments[n];
+    double d2 = Distance2(data + n * dims, c);
+    if (ret->Get(c) < 0 || d2 < best[c]) {
+      best[c] = d2;
+      ret->Set(c, n);
+    }
+  }
+  delete[] best;
+  return ret;
+}
+}
@@ -0,0 +1,49 @@
+// Copyright 2011 Jason Marcell
+
+#ifndef SRC_LIB_KMEANS_H_
+#define SRC_LIB_KMEANS_H_
+
+#include <stddef.h>
+
+#include "lib/Matrix.h"
+#include "lib/Vector.h"
+#include "lib/RandomNumberGenerator.h"
+
+namespace jason {
+
+class Matrix;
+class Vector;
+class RandomNumberGenerator;
+
+// Lloyd's k-means over the rows of a matrix, seeded by k-means++.  The
+// assignment step runs on the scheduler.
+class KMeans {
+  public:
+    KMeans(Matrix *points, size_t clusters);
+    virtual ~KMeans();
+    // Runs at most `iterations` rounds, stopping early once no point
+    // changes cluster.
+    void Process(RandomNumberGenerator *r, size_t iterations);
+    size_t Clusters();
+    Matrix *GetCentroids();
+    // Cluster of every row of `points`, which need not be the training
+    // points.
+    Vector *Assign(Matrix *points);
+    // Cluster of every training point.
+    Vector *GetAssignments();
+    // Row index of the training point nearest each centroid among the
+    // cluster's own points, or -1 for an empty cluster.
+    Vector *GetExemplars();
+  private:
+    static void AssignTile(size_t begin, size_t end, void *arg);
+    void Seed(RandomNumberGenerator *r);
+    size_t Nearest(const double *point, double *distance);
+    double Distance2(const double *point, size_t cluster);
+    size_t size, dims, clusters;
+    double *data;       // Row-major copy of the points
+    double *centroids;  // clusters x dims
+    size_t *assignments;
+};
+}
+
+#endif  // SRC_LIB_KMEANS_H_
@@ -0,0 +1,129 @@
+// Copyright 2011 Jason Marcell
+
+#include <algorithm>
+
+#include "lib/KdTree.h"
+#include "lib/Log.h"
+
+#define LEAF_SIZE 8
+
+namespace jason {
+
+class CompareCoordinate {
+  public:
+    CompareCoordinate(const double *data, size_t dims, size_t dim)
+      : data(data), dims(dims), dim(dim) {}
+    bool operator()(size_t a, size_t b) const {
+      return data[a * dims + dim] < data[b * dims + dim];
+    }
+  private:
+    const double *data;
+    size_t dims, dim;
+};
+
+KdTree::KdTree(Matrix *points) {
+  size = points->Height();
+  dims = points->Width();
+  data = new double[size * dims];
+  index = new size_t[size];
+  for (size_t row = 0; row < size; ++row) {
+    index[row] = row;
+    for (size_t col = 0; col < dims; ++col) {
+      data[row * dims + col] = points->Get(row, col);
+    }
+  }
+  nodes = new Node[2 * size + 1];  // Every leaf holds at least one point
+  node_count = 0;
+  Build(0, size);
+  LOG(DEBUG, "KdTree over %zu points, %d nodes.\n", size, node_count);
+}
+
+KdTree::~KdTree() {
+  delete[] nodes;
+  delete[] index;
+  delete[] data;
+}
+
+size_t KdTree::Size() {
+  return size;
+}
+
+double KdTree::Coordinate(size_t point, size_t dim) {
+  return data[point * dims + dim];
+}
+
+int KdTree::Build(size_t begin, size_t end) {
+  int id = node_count++;
+  Node *node = &nodes[id];
+  node->begin = begin;
+  node->end = end;
+  node->left = -1;
+  node->right = -1;
+  node->dim = 0;
+  node->split = 0;
+  if (end - begin <= LEAF_SIZE || dims == 0) {
+    return id;
+  }
+  double best_spread = -1;
+  for (size_t dim = 0; dim < dims; ++dim) {
+    double lo = Coordinate(index[begin], dim);
+    double hi = lo;
+    for (size_t i = begin + 1; i < end; ++i) {
+      double val = Coordinate(index[i], dim);
+      if (val < lo) lo = val;
+      if (val > hi) hi = val;
+    }
+    if (hi - lo > best_spread) {
+      best_spread = hi - lo;
+      node->dim = dim;
+    }
+  }
+  size_t mid = begin + (end - begin) / 2;
+  std::nth_element(index + begin, index + mid, index + end,
+      CompareCoordinate(data, dims, node->dim));
+  node->split = Coordinate(index[mid], node->dim);
+  int left = Build(begin, mid);
+  int right = Build(mid, end);
+  nodes[id].left = left;
+  nodes[id].right = right;
+  return id;
+}
+
+size_t KdTree::RadiusSearch(Vector *point, double radius, size_t *out) {
+  if (size == 0) return 0;
+  double *query = new double[dims];
+  for (size_t dim = 0; dim < dims; ++dim) {
+    query[dim] = point->Get(dim);
+  }
+  size_t count = Search(0, query, radius * radius, out, 0);
+  delete[] query;
+  return count;
+}
+
+size_t KdTree::Search(int id, const double *query, double radius2,
+    size_t *out, size_t count) {
+  Node *node = &nodes[id];
+  if (node->left < 0) {
+    for (size_t i = node->begin; i < node->end; ++i) {
+      double dist2 = 0;
+      const double *p = data + index[i] * dims;
+      for (size_t dim = 0; dim < dims && dist2 <= radius2; ++dim) {
+        double diff = p[dim] - query[dim];
+        dist2 += diff * diff;
+      }
+      if (dist2 <= radius2) {
+        out[count++] = index[i];
+      }
+    }
+    return count;
+  }
+  double diff = query[node->dim] - node->split;
+  int near = diff < 0 ? node->left : node->right;
+  int far = diff < 0 ? node->right : node->left;
+  count = Search(near, query, radius2, out, count);
+  if (diff * diff <= radius2) {
+    count = Search(far, query, radius2, out, count);
+  }
+  return count;
+}
+}
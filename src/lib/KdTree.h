@@ -0,0 +1,46 @@
+// Copyright 2011 Jason Marcell
+
+#ifndef SRC_LIB_KDTREE_H_
+#define SRC_LIB_KDTREE_H_
+
+#include <stddef.h>
+
+#include "lib/Matrix.h"
+#include "lib/Vector.h"
+
+namespace jason {
+
+class Matrix;
+class Vector;
+
+// KD-tree over the rows of a matrix, answering fixed-radius queries.  Each
+// node splits its points at the median of the dimension with the largest
+// spread; leaves hold at most a handful of points.
+class KdTree {
+  public:
+    explicit KdTree(Matrix *points);
+    virtual ~KdTree();
+    // Writes the row indices of all points within `radius` of `point` to
+    // `out` (which must hold Size() entries) and returns their count.
+    size_t RadiusSearch(Vector *point, double radius, size_t *out);
+    size_t Size();
+  private:
+    struct Node {
+      size_t begin, end;  // Range of index[] covered by the node
+      size_t dim;
+      double split;
+      int left, right;    // Children, -1 for a leaf
+    };
+    int Build(size_t begin, size_t end);
+    size_t Search(int node, const double *query, double radius2,
+        size_t *out, size_t count);
+    double Coordinate(size_t point, size_t dim);
+    size_t size, dims;
+    double *data;    // Row-major copy of the points
+    size_t *index;   // Point order, grouped by leaf
+    Node *nodes;
+    int node_count;
+};
+}
+
+#endif  // SRC_LIB_KDTREE_H_
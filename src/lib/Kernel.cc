@@ -1,42 +1,292 @@
 // Copyright 2011 Jason Marcell
 
 #include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
 
 #include "lib/Kernel.h"
 #include "lib/Matrix.h"
+#include "lib/Numa.h"
+#include "lib/Scheduler.h"
+#include "lib/Simd.h"
 #include "lib/Log.h"
 
+#define KERNEL_ROW_GRAIN 16     // Rows of a kernel block per task
+#define KERNEL_COLUMN_GRAIN 64  // Test samples per radius search task
+
 namespace jason {
 
 Kernel::Kernel(Matrix *m1, Matrix *m2) : Matrix(m1->Height(), m2->Height()) {
   LOG(DEBUG, "Base Kernel constructor with params.\n");
   this->m1 = m1;
   this->m2 = m2;
+  this->cache = NULL;
 }
 
 Kernel::Kernel(gsl_matrix *mat) : Matrix(mat) {
   LOG(DEBUG, "Matrix Constructor with mat.\n");
+  this->cache = NULL;
 }
 
 Kernel::~Kernel() {
   LOG(DEBUG, "Base Kernel Destructor.\n");
 }
 
+void Kernel::SetOperands(Matrix *m1, Matrix *m2) {
+  this->m1 = m1;
+  this->m2 = m2;
+  if (this->Height() != m1->Height() || this->Width() != m2->Height()) {
+    gsl_matrix_free(this->m);
+    this->m = gsl_matrix_alloc(m1->Height(), m2->Height());
+  }
+}
+
+struct KernelBlockTask {
+  Kernel *kernel;
+  Matrix *rows1;
+  Matrix *out;
+  Vector **vecs2;
+  double *self2;
+  Matrix *rows2;
+  double *norms2;  // Set instead of vecs2 and self2 for BaseRows()
+};
+
+struct KernelCacheTask {
+  Kernel *kernel;
+  KernelCache *cache;
+};
+
+struct KernelIndexTask {
+  Kernel *kernel;
+  KdTree *index;
+  double radius;
+  double *norms1;  // Squared norms of the m1 rows for BaseRows()' path
+  Vector **vecs1;  // Otherwise the m1 rows and their self-similarities
+  double *self1;
+};
+
+// Row blocks are computed by the scheduler's blocked loop, so with pinned
+// threads each block is first touched, and kept, on its thread's node.
 void Kernel::Init() {
+  if (cache != NULL && cache->Covers(m1, m2, BaseType())) {
+    LOG(DEBUG, "= Kernel Init from cache. =\n");
+    Numa::Place(this->m->data, this->Height(), this->m->tda * sizeof(double));
+    KernelCacheTask task = { this, cache };
+    Scheduler::ParallelBlocks("kernel_cache", this->Height(), CacheTile,
+        &task);
+    return;
+  }
   LOG(DEBUG, "= Begin Base Kernel Init. =\n");
-  for (size_t row = 0; row < this->Height(); ++row) {
-    for (size_t col = 0; col < this->Width(); ++col) {
-      Vector* vec1 = m1->Row(row);
-      Vector* vec2 = m2->Row(col);
-      double elem = this->KernelElementFunction(vec1, vec2);
-      double s1 = this->KernelElementFunction(vec1, vec1);
-      double s2 = this->KernelElementFunction(vec2, vec2);
-      elem = elem / sqrt(s1 * s2);
-      this->Set(row, col, elem);
-      delete vec2;
-      delete vec1;
-    }
+  Numa::Place(this->m->data, this->Height(), this->m->tda * sizeof(double));
+  double *norms2 = SimdNorms(m2);
+  if (norms2 != NULL) {
+    KernelBlockTask task = { this, m1, this, NULL, NULL, m2, norms2 };
+    Scheduler::ParallelBlocks("kernel", this->Height(), BlockTile, &task);
+    delete[] norms2;
+    LOG(DEBUG, "= End Base Kernel Init. =\n");
+    return;
   }
+  Vector **vecs2 = new Vector*[this->Width()];
+  double *self2 = new double[this->Width()];
+  for (size_t col = 0; col < this->Width(); ++col) {
+    vecs2[col] = m2->Row(col);
+    self2[col] = this->KernelElementFunction(vecs2[col], vecs2[col]);
+  }
+  KernelBlockTask task = { this, m1, this, vecs2, self2, m2, NULL };
+  Scheduler::ParallelBlocks("kernel", this->Height(), BlockTile, &task);
+  for (size_t col = 0; col < this->Width(); ++col) {
+    delete vecs2[col];
+  }
+  delete[] self2;
+  delete[] vecs2;
   LOG(DEBUG, "= End Base Kernel Init. =\n");
 }
+
+void Kernel::CacheTile(size_t begin, size_t end, void *arg) {
+  KernelCacheTask *task = reinterpret_cast<KernelCacheTask*>(arg);
+  Kernel *kernel = task->kernel;
+  gsl_matrix *base = task->cache->GetBase()->m;
+  for (size_t row = begin; row < end; ++row) {
+    kernel->TransformRow(base->data + row * base->tda,
+        task->cache->GetNorms1()[row], task->cache->GetNorms2(),
+        kernel->m->data + row * kernel->m->tda, kernel->Width());
+  }
+}
+
+void Kernel::BlockTile(size_t begin, size_t end, void *arg) {
+  KernelBlockTask *task = reinterpret_cast<KernelBlockTask*>(arg);
+  if (task->norms2 != NULL) {
+    task->kernel->BaseRows(task->rows1, task->rows2, task->out, begin, end,
+        task->norms2);
+    return;
+  }
+  task->kernel->BlockRows(task->rows1, task->out, begin, end, task->vecs2,
+      task->self2);
+}
+
+// Squared norms of the rows of `rows` if the kernel can be built from its
+// base with the vectorized distances and dot products, otherwise NULL.
+// The scalar level keeps the element function, whose vector arithmetic
+// follows the reduction mode.
+double *Kernel::SimdNorms(Matrix *rows) {
+  if (Simd::Level() == SIMD_SCALAR || BaseType() == BASE_NONE) {
+    return NULL;
+  }
+  gsl_matrix *mat = rows->m;
+  double *norms = new double[mat->size1];
+  for (size_t row = 0; row < mat->size1; ++row) {
+    const double *x = mat->data + row * mat->tda;
+    norms[row] = Simd::Dot(x, x, mat->size2);
+  }
+  return norms;
+}
+
+// Base values of each row straight from the features, without a Vector
+// per entry, then the kernel's element-wise transform.
+void Kernel::BaseRows(Matrix *rows1, Matrix *rows2, Matrix *out,
+    size_t begin, size_t end, const double *norms2) {
+  gsl_matrix *mat1 = rows1->m;
+  gsl_matrix *mat2 = rows2->m;
+  size_t dims = mat1->size2;
+  size_t width = out->Width();
+  bool distances = BaseType() == BASE_DISTANCES;
+  double *base = new double[width];
+  for (size_t row = begin; row < end; ++row) {
+    const double *x = mat1->data + row * mat1->tda;
+    for (size_t col = 0; col < width; ++col) {
+      const double *y = mat2->data + col * mat2->tda;
+      base[col] = distances ? Simd::SquaredDistance(x, y, dims)
+          : Simd::Dot(x, y, dims);
+    }
+    this->TransformRow(base, Simd::Dot(x, x, dims), norms2,
+        out->m->data + row * out->m->tda, width);
+  }
+  delete[] base;
+}
+
+void Kernel::BlockRows(Matrix *rows1, Matrix *out, size_t begin, size_t end,
+    Vector **vecs2, double *self2) {
+  for (size_t row = begin; row < end; ++row) {
+    Vector *vec1 = rows1->Row(row);
+    double s1 = this->KernelElementFunction(vec1, vec1);
+    for (size_t col = 0; col < out->Width(); ++col) {
+      double elem = this->KernelElementFunction(vec1, vecs2[col]);
+      out->Set(row, col, elem / sqrt(s1 * self2[col]));
+    }
+    delete vec1;
+  }
+}
+
+void Kernel::InitWithIndex(KdTree *index, double radius) {
+  LOG(DEBUG, "= Begin Kernel Init with radius %f. =\n", radius);
+  Numa::Place(this->m->data, this->Height(), this->m->tda * sizeof(double));
+  this->SetAll(0.0);
+  KernelIndexTask task = { this, index, radius, SimdNorms(m1), NULL, NULL };
+  if (task.norms1 == NULL) {
+    task.vecs1 = new Vector*[this->Height()];
+    task.self1 = new double[this->Height()];
+    for (size_t row = 0; row < this->Height(); ++row) {
+      task.vecs1[row] = m1->Row(row);
+      task.self1[row] = this->KernelElementFunction(task.vecs1[row],
+          task.vecs1[row]);
+    }
+  }
+  double visited;
+  Scheduler::ParallelReduce("kernel_index", this->Width(),
+      KERNEL_COLUMN_GRAIN, 1, IndexTile, &task, &visited);
+  LOG(VERBOSE, "Kernel cutoff evaluated %.0f of %zu entries.\n", visited,
+      this->Height() * this->Width());
+  if (task.vecs1 != NULL) {
+    for (size_t row = 0; row < this->Height(); ++row) {
+      delete task.vecs1[row];
+    }
+  }
+  delete[] task.self1;
+  delete[] task.vecs1;
+  delete[] task.norms1;
+}
+
+// Fills columns [begin, end), each from its own radius search, and counts
+// the entries evaluated.  Each entry is computed like BaseRows() or
+// BlockRows() would.
+void Kernel::IndexTile(size_t begin, size_t end, void *arg,
+    double *visited) {
+  KernelIndexTask *task = reinterpret_cast<KernelIndexTask*>(arg);
+  Kernel *kernel = task->kernel;
+  gsl_matrix *mat1 = kernel->m1->m;
+  gsl_matrix *mat2 = kernel->m2->m;
+  size_t dims = mat1->size2;
+  bool distances = kernel->BaseType() == BASE_DISTANCES;
+  size_t *neighbours = new size_t[task->index->Size()];
+  for (size_t col = begin; col < end; ++col) {
+    Vector *vec2 = kernel->m2->Row(col);
+    size_t count = task->index->RadiusSearch(vec2, task->radius, neighbours);
+    double *out = kernel->m->data + col;
+    if (task->norms1 != NULL) {
+      const double *y = mat2->data + col * mat2->tda;
+      double norm2 = Simd::Dot(y, y, dims);
+      for (size_t i = 0; i < count; ++i) {
+        size_t row = neighbours[i];
+        const double *x = mat1->data + row * mat1->tda;
+        double base = distances ? Simd::SquaredDistance(x, y, dims)
+            : Simd::Dot(x, y, dims);
+        kernel->TransformRow(&base, task->norms1[row], &norm2,
+            out + row * kernel->m->tda, 1);
+      }
+    } else {
+      double s2 = kernel->KernelElementFunction(vec2, vec2);
+      for (size_t i = 0; i < count; ++i) {
+        size_t row = neighbours[i];
+        double elem = kernel->KernelElementFunction(task->vecs1[row], vec2);
+        out[row * kernel->m->tda] = elem / sqrt(task->self1[row] * s2);
+      }
+    }
+    *visited += count;
+    delete vec2;
+  }
+  delete[] neighbours;
+}
+
+double Kernel::CutoffRadius(double tolerance) {
+  return -1;
+}
+
+void Kernel::SetParam(int param) {
+}
+
+KernelBaseType Kernel::BaseType() {
+  return BASE_NONE;
+}
+
+void Kernel::SetCache(KernelCache *cache) {
+  this->cache = cache;
+}
+
+Matrix *Kernel::Block(Matrix *rows1, Matrix *rows2) {
+  LOG(DEBUG, "= Kernel Block %zux%zu. =\n", rows1->Height(), rows2->Height());
+  Matrix *block = new Matrix(rows1->Height(), rows2->Height());
+  double *norms2 = SimdNorms(rows2);
+  if (norms2 != NULL) {
+    KernelBlockTask task = { this, rows1, block, NULL, NULL, rows2, norms2 };
+    Scheduler::ParallelFor("kernel_block", rows1->Height(), KERNEL_ROW_GRAIN,
+        BlockTile, &task);
+    delete[] norms2;
+    return block;
+  }
+  Vector **vecs2 = new Vector*[rows2->Height()];
+  double *self2 = new double[rows2->Height()];
+  for (size_t col = 0; col < rows2->Height(); ++col) {
+    vecs2[col] = rows2->Row(col);
+    self2[col] = this->KernelElementFunction(vecs2[col], vecs2[col]);
+  }
+  KernelBlockTask task = { this, rows1, block, vecs2, self2, rows2, NULL };
+  Scheduler::ParallelFor("kernel_block", rows1->Height(), KERNEL_ROW_GRAIN,
+      BlockTile, &task);
+  for (size_t col = 0; col < rows2->Height(); ++col) {
+    delete vecs2[col];
+  }
+  delete[] self2;
+  delete[] vecs2;
+  return block;
+}
 }
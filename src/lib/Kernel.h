@@ -4,10 +4,14 @@
 #define SRC_LIB_KERNEL_H_
 
 #include "lib/Matrix.h"
+#include "lib/KdTree.h"
+#include "lib/KernelCache.h"
 
 namespace jason {
 
 class Matrix;
+class KdTree;
+class KernelCache;
 
 enum KernelType { LINEAR, POLYNOMIAL, GAUSSIAN };
 
@@ -17,10 +21,46 @@ class Kernel: public jason::Matrix {
     explicit Kernel(gsl_matrix *mat);
     virtual ~Kernel();
     void Init();
+    // Rebinds the kernel to new operands, resizing it to
+    // m1->Height() x m2->Height().  Init() must be called again.
+    void SetOperands(Matrix *m1, Matrix *m2);
+    // Kernel values between the rows of rows1 and the rows of rows2,
+    // normalized like Init().  Does not touch this kernel's own entries.
+    Matrix *Block(Matrix *rows1, Matrix *rows2);
+    // Like Init(), but only evaluates the (m1 row, m2 row) pairs closer
+    // than `radius`, found through a KD-tree built over m1.  The other
+    // entries are set to zero.
+    void InitWithIndex(KdTree *index, double radius);
+    // Distance beyond which every normalized kernel value is below
+    // `tolerance`, or a negative value if the kernel has no such cutoff.
+    virtual double CutoffRadius(double tolerance);
     virtual double KernelElementFunction(Vector *vec1, Vector *vec2) = 0;
+    // Changes the kernel parameter; Init() must be called again.
+    virtual void SetParam(int param);
+    // What the kernel is an element-wise function of, or BASE_NONE.
+    virtual KernelBaseType BaseType();
+    // Normalized kernel values of one row from its base values, the squared
+    // norm of the m1 row and those of the m2 rows.  Only called when
+    // BaseType() is not BASE_NONE.
+    virtual void TransformRow(const double *base, double norm1,
+        const double *norms2, double *out, size_t width) = 0;
+    // Init() builds the kernel from `cache` (not owned) instead of from the
+    // features whenever the cache covers the operands and base type.
+    void SetCache(KernelCache *cache);
   protected:
     Matrix *m1;
     Matrix *m2;
+  private:
+    static void CacheTile(size_t begin, size_t end, void *arg);
+    KernelCache *cache;
+    static void BlockTile(size_t begin, size_t end, void *arg);
+    static void IndexTile(size_t begin, size_t end, void *arg,
+        double *visited);
+    void BlockRows(Matrix *rows1, Matrix *out, size_t begin, size_t end,
+        Vector **vecs2, double *self2);
+    double *SimdNorms(Matrix *rows);
+    void BaseRows(Matrix *rows1, Matrix *rows2, Matrix *out, size_t begin,
+        size_t end, const double *norms2);
 };
 }
 
@@ -0,0 +1,65 @@
+// Copyright 2011 Jason Marcell
+
+#include "lib/KernelCache.h"
+#include "lib/Log.h"
+
+namespace jason {
+
+namespace {
+
+double *SquaredNorms(Matrix *m) {
+  double *ret = new double[m->Height()];
+  for (size_t row = 0; row < m->Height(); ++row) {
+    Vector *vec = m->Row(row);
+    ret[row] = vec->Multiply(vec);
+    delete vec;
+  }
+  return ret;
+}
+}  // namespace
+
+// Distances come from |a|^2 + |b|^2 - 2 a.b so that both bases share the
+// GEMM; rounding can leave them slightly negative, so they are clamped.
+KernelCache::KernelCache(Matrix *m1, Matrix *m2, KernelBaseType type) {
+  LOG(DEBUG, "= Kernel cache %zux%zu. =\n", m1->Height(), m2->Height());
+  this->m1 = m1;
+  this->m2 = m2;
+  this->type = type;
+  this->base = m1->Multiply(m2);
+  this->norms1 = SquaredNorms(m1);
+  this->norms2 = m2 == m1 ? norms1 : SquaredNorms(m2);
+  if (type == BASE_DISTANCES) {
+    for (size_t row = 0; row < base->Height(); ++row) {
+      for (size_t col = 0; col < base->Width(); ++col) {
+        double d2 = norms1[row] + norms2[col] - 2 * base->Get(row, col);
+        base->Set(row, col, m1 == m2 && row == col ? 0 : d2 > 0 ? d2 : 0);
+      }
+    }
+  }
+}
+
+KernelCache::~KernelCache() {
+  if (norms2 != norms1) {
+    delete[] norms2;
+  }
+  delete[] norms1;
+  delete base;
+}
+
+bool KernelCache::Covers(Matrix *m1, Matrix *m2, KernelBaseType type) {
+  return type != BASE_NONE && type == this->type && m1 == this->m1
+      && m2 == this->m2;
+}
+
+Matrix *KernelCache::GetBase() {
+  return base;
+}
+
+const double *KernelCache::GetNorms1() {
+  return norms1;
+}
+
+const double *KernelCache::GetNorms2() {
+  return norms2;
+}
+}
@@ -0,0 +1,43 @@
+// Copyright 2011 Jason Marcell
+
+#ifndef SRC_LIB_KERNELCACHE_H_
+#define SRC_LIB_KERNELCACHE_H_
+
+#include <stddef.h>
+
+#include "lib/Matrix.h"
+
+namespace jason {
+
+class Matrix;
+
+// The parameter-free quantity a kernel is an element-wise function of.
+enum KernelBaseType { BASE_NONE, BASE_DISTANCES, BASE_INNER_PRODUCTS };
+
+// Squared distances or inner products between the rows of two matrices,
+// computed once with a single GEMM, together with the squared norms of both
+// sets of rows.  A kernel given the cache through Kernel::SetCache() builds
+// itself from it by one element-wise pass instead of from the features, so
+// trying several kernel parameters on the same data only pays for the
+// features once.  Costs one more m1 x m2 matrix of memory.
+class KernelCache {
+  public:
+    KernelCache(Matrix *m1, Matrix *m2, KernelBaseType type);
+    virtual ~KernelCache();
+    // Whether the cache holds `type` for exactly these operands.
+    bool Covers(Matrix *m1, Matrix *m2, KernelBaseType type);
+    // m1->Height() x m2->Height().
+    Matrix *GetBase();
+    const double *GetNorms1();
+    const double *GetNorms2();
+  private:
+    Matrix *m1;
+    Matrix *m2;
+    KernelBaseType type;
+    Matrix *base;
+    double *norms1;  // Squared norm of every row of m1
+    double *norms2;
+};
+}
+
+#endif  // SRC_LIB_KERNELCACHE_H_
@@ -21,4 +21,15 @@ double LinearKernel::KernelElementFunction(Vector *vec1, Vector *vec2) {
   LOG(DEBUG, "Linear KernelElementFunction.\n");
   return vec1->Multiply(vec2);
 }
+
+KernelBaseType LinearKernel::BaseType() {
+  return BASE_INNER_PRODUCTS;
+}
+
+void LinearKernel::TransformRow(const double *base, double norm1,
+    const double *norms2, double *out, size_t width) {
+  for (size_t col = 0; col < width; ++col) {
+    out[col] = base[col] / sqrt(norm1 * norms2[col]);
+  }
+}
 }
@@ -18,6 +18,9 @@ class LinearKernel: public jason::Kernel {
     LinearKernel(Matrix *m1, Matrix *m2);
     virtual ~LinearKernel();
     double KernelElementFunction(Vector *vec1, Vector *vec2);
+    KernelBaseType BaseType();
+    void TransformRow(const double *base, double norm1, const double *norms2,
+        double *out, size_t width);
 };
 }
 
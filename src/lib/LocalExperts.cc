@@ -0,0 +1,283 @@
+// Copyright 2011 Jason Marcell
+
+#include <math.h>
+
+#include <algorithm>
+#include <utility>
+
+#include "lib/LocalExperts.h"
+#include "lib/Predictor.h"
+#include "lib/RandomNumberGenerator.h"
+#include "lib/Scheduler.h"
+#include "lib/Log.h"
+
+#define KMEANS_ITERATIONS 20  // Lloyd rounds when partitioning the samples
+#define MAX_BASE_SEED 2147483647.0
+
+namespace jason {
+
+LocalExperts::LocalExperts(Matrix *x, Vector *labels, size_t classes,
+    Kernel *kernel, size_t experts) {
+  this->x = x;
+  this->t = labels;
+  this->classes = classes;
+  this->kernel = kernel;
+  this->count = experts > 0 ? experts : 1;
+  this->routes = 1;
+  this->landmark_mode = LANDMARKS_NONE;
+  this->landmark_count = 0;
+  this->seed = 0;
+  this->base_seed = 1;
+  this->train_cdf_table = NULL;
+  this->predict_cdf_table = NULL;
+  this->centroids = NULL;
+  this->experts = NULL;
+}
+
+LocalExperts::~LocalExperts() {
+  Free();
+}
+
+void LocalExperts::SetSeed(unsigned long seed) {
+  this->seed = seed;
+}
+
+void LocalExperts::SetCdfTables(NormalCdfTable *train,
+    NormalCdfTable *predict) {
+  this->train_cdf_table = train;
+  this->predict_cdf_table = predict;
+}
+
+void LocalExperts::SetLandmarks(LandmarkMode mode, size_t count) {
+  this->landmark_mode = mode;
+  this->landmark_count = count;
+}
+
+void LocalExperts::SetRoutes(size_t routes) {
+  this->routes = routes > 0 ? routes : 1;
+}
+
+void LocalExperts::Free() {
+  for (size_t e = 0; experts != NULL && e < count; ++e) {
+    delete experts[e].w;
+    delete experts[e].relevance_vectors;
+    delete experts[e].rows;
+  }
+  delete[] experts;
+  delete centroids;
+  experts = NULL;
+  centroids = NULL;
+}
+
+// Clusters the samples and keeps one expert per non-empty cluster.  Without
+// a seed, also draws the base of the expert seeds here, on the calling
+// thread: experts train in parallel, and only seeded generators are safe to
+// construct there.
+void LocalExperts::Partition() {
+  size_t samples = x->Height();
+  RandomNumberGenerator *r = seed == 0 ? new RandomNumberGenerator()
+      : new RandomNumberGenerator(seed);
+  base_seed = seed != 0 ? seed
+      : 1 + static_cast<unsigned long>(r->SampleUniform(0, MAX_BASE_SEED));
+  KMeans *kmeans = new KMeans(x, count);
+  kmeans->Process(r, KMEANS_ITERATIONS);
+  Vector *assignments = kmeans->GetAssignments();
+  size_t clusters = kmeans->Clusters();
+  size_t *sizes = new size_t[clusters];
+  for (size_t c = 0; c < clusters; ++c) {
+    sizes[c] = 0;
+  }
+  for (size_t n = 0; n < samples; ++n) {
+    sizes[(size_t)assignments->Get(n)]++;
+  }
+  size_t *slot = new size_t[clusters];
+  count = 0;
+  for (size_t c = 0; c < clusters; ++c) {
+    slot[c] = count;
+    count += sizes[c] > 0;
+  }
+  experts = new Expert[count];
+  Vector *kept = new Vector(count);
+  for (size_t c = 0; c < clusters; ++c) {
+    if (sizes[c] > 0) {
+      Expert expert = { new Vector(sizes[c]), -1, NULL, NULL };
+      experts[slot[c]] = expert;
+      kept->Set(slot[c], c);
+      sizes[c] = 0;
+    }
+  }
+  for (size_t n = 0; n < samples; ++n) {
+    size_t c = assignments->Get(n);
+    experts[slot[c]].rows->Set(sizes[c]++, n);
+  }
+  Matrix *all = kmeans->GetCentroids();
+  centroids = all->GatherRows(kept);
+  delete all;
+  delete kept;
+  delete[] slot;
+  delete[] sizes;
+  delete assignments;
+  delete kmeans;
+  delete r;
+}
+
+void LocalExperts::TrainTile(size_t begin, size_t end, void *arg) {
+  TrainTask *task = reinterpret_cast<TrainTask*>(arg);
+  for (size_t e = begin; e < end; ++e) {
+    task->experts->Train(e, task->tau, task->upsilon);
+  }
+}
+
+// Trains the expert of one cell and keeps only its relevance vectors and
+// weights.
+void LocalExperts::Train(size_t index, double tau, double upsilon) {
+  Expert *expert = &experts[index];
+  size_t size = expert->rows->Size();
+  Vector *labels = new Vector(size);
+  bool single = true;
+  for (size_t n = 0; n < size; ++n) {
+    labels->Set(n, t->Get(expert->rows->Get(n)));
+    single = single && labels->Get(n) == labels->Get(0);
+  }
+  if (single) {
+    expert->label = static_cast<int>(labels->Get(0));
+    LOG(VERBOSE, "Expert %zu: %zu samples, all of class %d.\n", index, size,
+        expert->label);
+    delete labels;
+    return;
+  }
+  Matrix *cell = x->GatherRows(expert->rows);
+  Trainer *trainer = new Trainer(cell, labels, classes, kernel);
+  trainer->SetSeed(base_seed + index + 1);
+  trainer->SetCdfTable(train_cdf_table);
+  // The landmark path only reads the shared kernel through Block().
+  if (landmark_mode == LANDMARKS_NONE) {
+    trainer->SetLandmarks(LANDMARKS_STRATIFIED, size);
+  } else {
+    trainer->SetLandmarks(landmark_mode,
+        landmark_count > 0 ? landmark_count : size);
+  }
+  trainer->Process(tau, upsilon);
+  expert->relevance_vectors = trainer->GetRelevanceVectors();
+  expert->w = trainer->GetW()->Copy();
+  LOG(VERBOSE, "Expert %zu: %zu samples, %zu relevance vectors.\n", index,
+      size, expert->relevance_vectors->Height());
+  delete trainer;
+  delete cell;
+  delete labels;
+}
+
+void LocalExperts::Process(double tau, double upsilon) {
+  LOG(DEBUG, "== Beginning Local Experts. ==\n");
+  Free();
+  Partition();
+  TrainTask task = { this, tau, upsilon };
+  Scheduler::ParallelFor("experts", count, 1, TrainTile, &task);
+  LOG(DEBUG, "== End Local Experts. ==\n");
+}
+
+// Sends every row of x_predict to its `routes` nearest experts.  The
+// gates weighting their votes fall off as exp(-d^2 / 2) in the squared
+// distance d^2 beyond that of the nearest centroid, which is one unit of
+// the sphered features, and sum to one.  rows[e] and gates[e] are NULL for
+// an expert that gets no row.
+void LocalExperts::Route(Matrix *x_predict, Vector **rows, Vector **gates) {
+  size_t height = x_predict->Height();
+  size_t dims = x_predict->Width();
+  size_t nearest = routes < count ? routes : count;
+  std::pair<double, size_t> *distances =
+      new std::pair<double, size_t>[count];
+  size_t *targets = new size_t[height * nearest];
+  double *weights = new double[height * nearest];
+  size_t *sizes = new size_t[count];
+  for (size_t e = 0; e < count; ++e) {
+    sizes[e] = 0;
+  }
+  for (size_t n = 0; n < height; ++n) {
+    for (size_t e = 0; e < count; ++e) {
+      double d2 = 0;
+      for (size_t d = 0; d < dims; ++d) {
+        double diff = x_predict->Get(n, d) - centroids->Get(e, d);
+        d2 += diff * diff;
+      }
+      distances[e] = std::make_pair(d2, e);
+    }
+    std::partial_sort(distances, distances + nearest, distances + count);
+    double total = 0;
+    for (size_t i = 0; i < nearest; ++i) {
+      targets[n * nearest + i] = distances[i].second;
+      weights[n * nearest + i] =
+          exp(-0.5 * (distances[i].first - distances[0].first));
+      total += weights[n * nearest + i];
+      sizes[distances[i].second]++;
+    }
+    for (size_t i = 0; i < nearest; ++i) {
+      weights[n * nearest + i] /= total;
+    }
+  }
+  for (size_t e = 0; e < count; ++e) {
+    rows[e] = sizes[e] > 0 ? new Vector(sizes[e]) : NULL;
+    gates[e] = sizes[e] > 0 ? new Vector(sizes[e]) : NULL;
+    sizes[e] = 0;
+  }
+  for (size_t n = 0; n < height; ++n) {
+    for (size_t i = 0; i < nearest; ++i) {
+      size_t e = targets[n * nearest + i];
+      gates[e]->Set(sizes[e], weights[n * nearest + i]);
+      rows[e]->Set(sizes[e]++, n);
+    }
+  }
+  delete[] sizes;
+  delete[] weights;
+  delete[] targets;
+  delete[] distances;
+}
+
+Matrix *LocalExperts::Predict(Matrix *x_predict, Kernel *test_kernel) {
+  Vector **routed = new Vector*[count];
+  Vector **gates = new Vector*[count];
+  Route(x_predict, routed, gates);
+  Matrix *result = new Matrix(x_predict->Height(), classes);
+  result->SetAll(0.0);
+  // Each expert's predictor parallelizes its own kernel and quadrature, so
+  // the experts are predicted one after another.
+  for (size_t e = 0; e < count; ++e) {
+    Vector *rows = routed[e];
+    Vector *gate = gates[e];
+    if (rows == NULL) {
+      continue;
+    }
+    LOG(VERBOSE, "Expert %zu predicts %zu test samples.\n", e, rows->Size());
+    if (experts[e].label >= 0) {
+      for (size_t i = 0; i < rows->Size(); ++i) {
+        size_t n = rows->Get(i);
+        result->Set(n, experts[e].label,
+            result->Get(n, experts[e].label) + gate->Get(i));
+      }
+      delete gate;
+      delete rows;
+      continue;
+    }
+    Matrix *points = x_predict->GatherRows(rows);
+    Predictor *predictor = new Predictor(experts[e].w,
+        experts[e].relevance_vectors, points, test_kernel);
+    predictor->SetCdfTable(predict_cdf_table);
+    Matrix *probabilities = predictor->Predict();
+    for (size_t i = 0; i < rows->Size(); ++i) {
+      size_t n = rows->Get(i);
+      for (size_t c = 0; c < classes; ++c) {
+        result->Set(n, c,
+            result->Get(n, c) + gate->Get(i) * probabilities->Get(i, c));
+      }
+    }
+    delete probabilities;
+    delete predictor;
+    delete points;
+    delete gate;
+    delete rows;
+  }
+  delete[] gates;
+  delete[] routed;
+  return result;
+}
+}
@@ -0,0 +1,80 @@
+// Copyright 2011 Jason Marcell
+
+#ifndef SRC_LIB_LOCALEXPERTS_H_
+#define SRC_LIB_LOCALEXPERTS_H_
+
+#include "lib/Matrix.h"
+#include "lib/Vector.h"
+#include "lib/Kernel.h"
+#include "lib/Trainer.h"
+#include "lib/KMeans.h"
+#include "lib/NormalCdfTable.h"
+
+namespace jason {
+
+class Matrix;
+class Vector;
+class Kernel;
+class Trainer;
+class KMeans;
+class NormalCdfTable;
+
+// A mixture of local models.  The (sphered) samples are split into cells by
+// k-means and every cell gets its own mRVM, one Scheduler task each, so
+// training only ever holds block-diagonal pieces of the kernel.  A test
+// point is routed to the experts of its nearest cells, whose class
+// probabilities are mixed with weights falling off with the distance, so
+// its cost depends on those experts' sizes rather than on the whole
+// training set.  A cell holding a single class
+// needs no model and predicts that class.  The kernel is only used through
+// Block() and is shared by every expert.
+class LocalExperts {
+  public:
+    LocalExperts(Matrix *x, Vector *labels, size_t classes, Kernel *kernel,
+        size_t experts);
+    virtual ~LocalExperts();
+    void SetSeed(unsigned long seed);
+    void SetCdfTables(NormalCdfTable *train, NormalCdfTable *predict);
+    // Passed on to every expert; by default each starts from all the
+    // samples of its cell.
+    void SetLandmarks(LandmarkMode mode, size_t count);
+    // Experts each test point is routed to, 1 by default.
+    void SetRoutes(size_t routes);
+    void Process(double tau, double upsilon);
+    // `test_kernel` is rebound to each expert's relevance vectors in turn.
+    Matrix *Predict(Matrix *x_predict, Kernel *test_kernel);
+  private:
+    struct Expert {
+      Vector *rows;  // Sample indices into x
+      int label;     // The cell's only class, or -1
+      Matrix *relevance_vectors;
+      Matrix *w;
+    };
+    struct TrainTask {
+      LocalExperts *experts;
+      double tau;
+      double upsilon;
+    };
+    static void TrainTile(size_t begin, size_t end, void *arg);
+    void Train(size_t index, double tau, double upsilon);
+    void Partition();
+    void Route(Matrix *x_predict, Vector **rows, Vector **gates);
+    void Free();
+    Matrix *x;
+    Vector *t;
+    size_t classes;
+    Kernel *kernel;
+    size_t count;
+    size_t routes;
+    LandmarkMode landmark_mode;
+    size_t landmark_count;  // 0 for the cell size
+    unsigned long seed;
+    unsigned long base_seed;  // Nonzero; expert seeds count up from it
+    NormalCdfTable *train_cdf_table;
+    NormalCdfTable *predict_cdf_table;
+    Matrix *centroids;  // One row per expert
+    Expert *experts;
+};
+}
+
+#endif  // SRC_LIB_LOCALEXPERTS_H_
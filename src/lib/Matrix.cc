@@ -1,16 +1,203 @@
 // Copyright 2011 Jason Marcell
 
 #include <ctype.h>
+#include <math.h>
 
 #include <gsl/gsl_statistics.h>
 
 #include <cstring>
 
 #include "lib/Matrix.h"
+#include "lib/Numa.h"
+#include "lib/Reduction.h"
+#include "lib/Scheduler.h"
 #include "lib/Log.h"
 
+// Products are split into panels of this many result rows (columns for
+// triangular solves), each one BLAS call run by the Scheduler.  The panels
+// do not depend on the thread count, except under -N PARTITION (see
+// Partitioned()).
+#define BLAS_PANEL 64
+
 namespace jason {
 
+namespace {
+
+struct GemmTask {
+  CBLAS_TRANSPOSE trans_a;
+  CBLAS_TRANSPOSE trans_b;
+  size_t n;
+  size_t k;
+  const double *a;
+  size_t lda;
+  const double *b;
+  size_t ldb;
+  double *c;
+  size_t ldc;
+  double beta;  // 0 to overwrite C, 1 to add to it
+};
+
+// Rows [begin, end) of C = op(A) op(B) + beta C.
+void GemmPanel(size_t begin, size_t end, void *arg) {
+  if (begin == end) {
+    return;
+  }
+  GemmTask *task = reinterpret_cast<GemmTask*>(arg);
+  bool trans_a = task->trans_a != CblasNoTrans;
+  bool trans_b = task->trans_b != CblasNoTrans;
+  if (Reduction::Reproducible()) {
+    for (size_t i = begin; i < end; ++i) {
+      const double *a = trans_a ? task->a + i : task->a + i * task->lda;
+      for (size_t j = 0; j < task->n; ++j) {
+        const double *b = trans_b ? task->b + j * task->ldb : task->b + j;
+        double dot = Reduction::Dot(a, trans_a ? task->lda : 1, b,
+            trans_b ? 1 : task->ldb, task->k);
+        double *c = task->c + i * task->ldc + j;
+        *c = task->beta == 0 ? dot : task->beta * *c + dot;
+      }
+    }
+    return;
+  }
+  const double *a = trans_a ? task->a + begin : task->a + begin * task->lda;
+  cblas_dgemm(CblasRowMajor, task->trans_a, task->trans_b, end - begin,
+      task->n, task->k, 1.0, a, task->lda, task->b, task->ldb, task->beta,
+      task->c + begin * task->ldc, task->ldc);
+}
+
+struct GemmBlockTask {
+  GemmTask *gemm;
+  size_t m;  // Rows of C
+};
+
+// op(A) op(B) over [begin, end) of the inner dimension, into `partial`.
+void GemmBlock(size_t begin, size_t end, void *arg, double *partial) {
+  if (begin == end) {
+    return;
+  }
+  GemmBlockTask *task = reinterpret_cast<GemmBlockTask*>(arg);
+  GemmTask block = *task->gemm;
+  block.k = end - begin;
+  block.a += block.trans_a != CblasNoTrans ? begin * block.lda : begin;
+  block.b += block.trans_b != CblasNoTrans ? begin : begin * block.ldb;
+  block.c = partial;
+  block.ldc = block.n;
+  block.beta = 0.0;
+  GemmPanel(0, task->m, &block);
+}
+
+// With -N PARTITION the rows of a kernel are placed in the Scheduler's
+// thread blocks (Numa::Place), so products run over those blocks instead
+// of BLAS_PANEL panels: a product over the kernel's rows takes one block
+// per thread, and one summing over them (a kernel as the inner dimension)
+// adds up one partial product per block.  The split depends on the thread
+// count, so reproducible runs keep the panels.
+bool Partitioned() {
+  return Numa::Mode() == NUMA_PARTITION && !Reduction::Reproducible();
+}
+
+// Rows [0, m) of C = op(A) op(B) + beta C, for a C of m rows.
+void Gemm(GemmTask *task, size_t m) {
+  if (Partitioned()) {
+    Scheduler::ParallelBlocks("gemm", m, GemmPanel, task);
+  } else {
+    Scheduler::ParallelFor("gemm", m, BLAS_PANEL, GemmPanel, task);
+  }
+}
+
+// C = op(A) op(B) for a dense C of m rows, split along the inner
+// dimension when it is a placed kernel's rows.
+void GemmInner(GemmTask *task, size_t m) {
+  if (!Partitioned()) {
+    Gemm(task, m);
+    return;
+  }
+  GemmBlockTask block = { task, m };
+  Scheduler::ReduceBlocks("gemm", task->k, m * task->n, GemmBlock, &block,
+      task->c);
+}
+
+struct TrsmTask {
+  size_t m;
+  const double *a;
+  size_t lda;
+  double *b;
+  size_t ldb;
+};
+
+// Columns [begin, end) of B = L^-1 B.
+void TrsmPanel(size_t begin, size_t end, void *arg) {
+  TrsmTask *task = reinterpret_cast<TrsmTask*>(arg);
+  if (Reduction::Reproducible()) {
+    // Forward substitution, one column at a time.
+    for (size_t j = begin; j < end; ++j) {
+      double *x = task->b + j;
+      for (size_t i = 0; i < task->m; ++i) {
+        const double *l = task->a + i * task->lda;
+        x[i * task->ldb] = (x[i * task->ldb]
+            - Reduction::Dot(l, 1, x, task->ldb, i)) / l[i];
+      }
+    }
+    return;
+  }
+  cblas_dtrsm(CblasRowMajor, CblasLeft, CblasLower, CblasNoTrans,
+      CblasNonUnit, task->m, end - begin, 1.0, task->a, task->lda,
+      task->b + begin, task->ldb);
+}
+
+// Gauss-Jordan elimination with partial pivoting, in a fixed order.
+void InvertInOrder(gsl_matrix *a, gsl_matrix *inverse) {
+  size_t n = a->size1;
+  gsl_matrix_set_identity(inverse);
+  for (size_t col = 0; col < n; ++col) {
+    size_t pivot = col;
+    for (size_t row = col + 1; row < n; ++row) {
+      if (fabs(gsl_matrix_get(a, row, col))
+          > fabs(gsl_matrix_get(a, pivot, col))) {
+        pivot = row;
+      }
+    }
+    gsl_matrix_swap_rows(a, col, pivot);
+    gsl_matrix_swap_rows(inverse, col, pivot);
+    double *a_col = a->data + col * a->tda;
+    double *inverse_col = inverse->data + col * inverse->tda;
+    double scale = 1 / a_col[col];
+    for (size_t j = 0; j < n; ++j) {
+      a_col[j] *= scale;
+      inverse_col[j] *= scale;
+    }
+    for (size_t row = 0; row < n; ++row) {
+      double factor = gsl_matrix_get(a, row, col);
+      if (row == col || factor == 0) {
+        continue;
+      }
+      double *a_row = a->data + row * a->tda;
+      double *inverse_row = inverse->data + row * inverse->tda;
+      for (size_t j = 0; j < n; ++j) {
+        a_row[j] -= factor * a_col[j];
+        inverse_row[j] -= factor * inverse_col[j];
+      }
+    }
+  }
+}
+
+// Cholesky-Banachiewicz, leaving L below the diagonal and L' above it like
+// gsl_linalg_cholesky_decomp.
+void CholeskyInOrder(gsl_matrix *a) {
+  size_t n = a->size1;
+  for (size_t j = 0; j < n; ++j) {
+    double *row_j = a->data + j * a->tda;
+    double diagonal = sqrt(row_j[j] - Reduction::Dot(row_j, 1, row_j, 1, j));
+    row_j[j] = diagonal;
+    for (size_t i = j + 1; i < n; ++i) {
+      double *row_i = a->data + i * a->tda;
+      row_i[j] = (row_i[j] - Reduction::Dot(row_i, 1, row_j, 1, j))
+          / diagonal;
+      row_j[i] = row_i[j];
+    }
+  }
+}
+}  // namespace
+
 Matrix::Matrix(size_t height, size_t width) {
   LOG(DEBUG, "Matrix Constructor with height %zu and width %zu.\n",
     height, width);
@@ -41,9 +228,35 @@ Matrix::Matrix(double *data, size_t height, size_t width) {
   Init();
   this->m = gsl_matrix_alloc(height, width);
   LOG(DEBUG, "\t\t\tgsl_matrix_alloc\n");
+  memcpy(m->data, data, height * width * sizeof(*data));
+}
+
+Matrix::Matrix(double *data, size_t height, size_t width, size_t stride,
+    BufferOwnership ownership) {
+  LOG(DEBUG, "Matrix Constructor over a %zux%zu buffer, stride %zu.\n",
+    height, width, stride);
+  Init();
+  // A non-owning gsl_matrix: gsl_matrix_free only releases the struct.
+  gsl_matrix_view view = gsl_matrix_view_array_with_tda(data, height, width,
+      stride);
+  this->m = reinterpret_cast<gsl_matrix*>(malloc(sizeof(*m)));
+  *this->m = view.matrix;
+  if (ownership == BUFFER_ADOPT) {
+    this->adopted = data;
+  }
+}
+
+Matrix::Matrix(const float *data, size_t height, size_t width,
+    size_t stride) {
+  LOG(DEBUG, "Matrix Constructor with float data, stride %zu.\n", stride);
+  Init();
+  this->m = gsl_matrix_alloc(height, width);
+  LOG(DEBUG, "\t\t\tgsl_matrix_alloc\n");
   for (size_t row = 0; row < height; ++row) {
+    const float *in = data + row * stride;
+    double *out = gsl_matrix_ptr(m, row, 0);
     for (size_t col = 0; col < width; ++col) {
-      gsl_matrix_set(m, row, col, *(data + row * width + col));
+      out[col] = in[col];
     }
   }
 }
@@ -76,6 +289,7 @@ void Matrix::Init() {
   this->to_str = reinterpret_cast<char*>(malloc(256 * sizeof(*to_str)));
   means = NULL;
   stdevs = NULL;
+  adopted = NULL;
 }
 
 Matrix::~Matrix() {
@@ -83,6 +297,7 @@ Matrix::~Matrix() {
   free(this->to_str);
   gsl_matrix_free(this->m);
   LOG(DEBUG, "\t\t\tgsl_matrix_free\n");
+  free(adopted);
   if (means != NULL) {
     delete means;
     delete stdevs;
@@ -115,6 +330,8 @@ void Matrix::RemoveRows(Vector *rows) {
   }
   LOG(DEBUG, "New height = %zu.\n", new_height);
   gsl_matrix *new_m = gsl_matrix_alloc(new_height, this->Width());
+  // Keeps the row blocks of a placed kernel on their nodes.
+  Numa::Place(new_m->data, new_height, new_m->tda * sizeof(double));
   for (size_t ret_row = 0, row = 0; row < this->Height(); ++row) {
     if (rows->Get(row) == 1) {
       gsl_vector *v = gsl_vector_alloc(this->Width());
@@ -147,20 +364,130 @@ void Matrix::RemoveColumns(Vector *columns) {
   this->m = new_m;
 }
 
+void Matrix::AppendRows(Matrix *other) {
+  LOG(DEBUG, "AppendRows.\n");
+  if (this->Width() != other->Width()) {
+    fprintf(stderr, "Dimension Error.\n");
+    exit(1);
+  }
+  gsl_matrix *new_m = gsl_matrix_alloc(this->Height() + other->Height(),
+      this->Width());
+  gsl_matrix_view top = gsl_matrix_submatrix(new_m, 0, 0, this->Height(),
+      this->Width());
+  gsl_matrix_view bottom = gsl_matrix_submatrix(new_m, this->Height(), 0,
+      other->Height(), this->Width());
+  gsl_matrix_memcpy(&top.matrix, m);
+  gsl_matrix_memcpy(&bottom.matrix, other->m);
+  gsl_matrix_free(this->m);
+  this->m = new_m;
+}
+
+void Matrix::AppendColumns(Matrix *other) {
+  LOG(DEBUG, "AppendColumns.\n");
+  if (this->Height() != other->Height()) {
+    fprintf(stderr, "Dimension Error.\n");
+    exit(1);
+  }
+  gsl_matrix *new_m = gsl_matrix_alloc(this->Height(),
+      this->Width() + other->Width());
+  gsl_matrix_view left = gsl_matrix_submatrix(new_m, 0, 0, this->Height(),
+      this->Width());
+  gsl_matrix_view right = gsl_matrix_submatrix(new_m, 0, this->Width(),
+      this->Height(), other->Width());
+  gsl_matrix_memcpy(&left.matrix, m);
+  gsl_matrix_memcpy(&right.matrix, other->m);
+  gsl_matrix_free(this->m);
+  this->m = new_m;
+}
+
+Matrix *Matrix::GatherRows(Vector *rows) {
+  LOG(DEBUG, "GatherRows.\n");
+  gsl_matrix *new_m = gsl_matrix_alloc(rows->Size(), this->Width());
+  for (size_t row = 0; row < rows->Size(); ++row) {
+    gsl_vector_const_view src = gsl_matrix_const_row(m, rows->Get(row));
+    gsl_vector_view dst = gsl_matrix_row(new_m, row);
+    gsl_vector_memcpy(&dst.vector, &src.vector);
+  }
+  return new Matrix(new_m);
+}
+
+// Runs of consecutive columns are copied with one memcpy each.
+Matrix *Matrix::Gather(Vector *rows, Vector *columns) {
+  LOG(DEBUG, "Gather.\n");
+  gsl_matrix *new_m = gsl_matrix_alloc(rows->Size(), columns->Size());
+  for (size_t row = 0; row < rows->Size(); ++row) {
+    const double *src = m->data + (size_t)rows->Get(row) * m->tda;
+    double *dst = new_m->data + row * new_m->tda;
+    for (size_t col = 0; col < columns->Size(); ) {
+      size_t first = columns->Get(col);
+      size_t run = 1;
+      while (col + run < columns->Size()
+          && (size_t)columns->Get(col + run) == first + run) {
+        ++run;
+      }
+      memcpy(dst + col, src + first, run * sizeof(*dst));
+      col += run;
+    }
+  }
+  return new Matrix(new_m);
+}
+
 void Matrix::Invert() {
   int n = this->Width();
   gsl_matrix *inverse = gsl_matrix_alloc(n, n);
   LOG(DEBUG, "\t\t\tgsl_matrix_alloc\n");
-  gsl_permutation *perm = gsl_permutation_alloc(n);
-  int s = 0;
-  gsl_linalg_LU_decomp(m, perm, &s);
-  gsl_linalg_LU_invert(m, perm, inverse);
-  gsl_permutation_free(perm);
+  if (Reduction::Reproducible()) {
+    InvertInOrder(m, inverse);
+  } else {
+    gsl_permutation *perm = gsl_permutation_alloc(n);
+    int s = 0;
+    gsl_linalg_LU_decomp(m, perm, &s);
+    gsl_linalg_LU_invert(m, perm, inverse);
+    gsl_permutation_free(perm);
+  }
   gsl_matrix_free(m);
   LOG(DEBUG, "\t\t\tgsl_matrix_alloc\n");
   m = inverse;
 }
 
+Matrix *Matrix::Copy() {
+  gsl_matrix *copy = gsl_matrix_alloc(Height(), Width());
+  LOG(DEBUG, "\t\t\tgsl_matrix_alloc\n");
+  gsl_matrix_memcpy(copy, m);
+  return new Matrix(copy);
+}
+
+Matrix *Matrix::Transpose() {
+  gsl_matrix *transpose = gsl_matrix_alloc(Width(), Height());
+  gsl_matrix_transpose_memcpy(transpose, m);
+  return new Matrix(transpose);
+}
+
+void Matrix::Cholesky() {
+  if (Reduction::Reproducible()) {
+    CholeskyInOrder(m);
+  } else {
+    gsl_linalg_cholesky_decomp(m);
+  }
+}
+
+void Matrix::SolveLower(Matrix *factor) {
+  LOG(DEBUG, "Solving a %zux%zu triangular system for %zu columns.\n",
+    factor->Height(), factor->Width(), this->Width());
+  if (factor->Width() != this->Height()) {
+    fprintf(stderr, "Dimension Error.\n");
+    exit(1);
+  }
+  TrsmTask task = {
+      this->Height(),         // M
+      factor->m->data,        // A
+      factor->m->tda,         // lda
+      this->m->data,          // B
+      this->m->tda };         // ldb
+  Scheduler::ParallelFor("trsm", this->Width(), BLAS_PANEL, TrsmPanel,
+      &task);
+}
+
 double Matrix::Get(int row, int col) {
   return gsl_matrix_get(this->m, row, col);
 }
@@ -169,6 +496,10 @@ void Matrix::Set(int row, int col, double val) {
   gsl_matrix_set(this->m, row, col, val);
 }
 
+void Matrix::SetAll(double val) {
+  gsl_matrix_set_all(this->m, val);
+}
+
 void Matrix::Add(Matrix *other) {
   LOG(DEBUG, "Adding a %zux%zu to a %zux%zu.\n",
     this->Height(), this->Width(), other->Height(), other->Width());
@@ -186,6 +517,10 @@ Vector* Matrix::Row(size_t row) {
   return new Vector(v);
 }
 
+Vector* Matrix::RowView(size_t row) {
+  return new Vector(m->data + row * m->tda, this->Width(), 1, BUFFER_VIEW);
+}
+
 Vector* Matrix::Column(size_t col) {
   gsl_vector *v = gsl_vector_alloc(this->Height());
   gsl_matrix_get_col(v, m, col);
@@ -206,25 +541,26 @@ void Matrix::Sphere() {
 }
 
 void Matrix::Sphere(Matrix *other) {
+  LOG(DEBUG, "= other =\n");
+  LOG(DEBUG, "%s", other->ToString());
+  Sphere(other->GetMeans(), other->GetStdevs());
+}
+
+void Matrix::Sphere(Vector *means, Vector *stdevs) {
   size_t width = this->Width();
-  Vector *vec_other;
   Vector *vec_self;
   LOG(DEBUG, "= Start sphere =\n");
   LOG(DEBUG, "= this =\n");
   LOG(DEBUG, "%s", this->ToString());
-  LOG(DEBUG, "= other =\n");
-  LOG(DEBUG, "%s", other->ToString());
   LOG(DEBUG, "= starting loop =\n");
   for (size_t col = 0; col < width; ++col) {
-    vec_other = other->Column(col);
     vec_self = this->Column(col);
-    double mean = other->GetMeans()->Get(col);
-    double stdev = other->GetStdevs()->Get(col);
+    double mean = means->Get(col);
+    double stdev = stdevs->Get(col);
     LOG(DEBUG, "col = %zu, mean = %f, stdev = %f\n", col, mean, stdev);
     gsl_vector_add_constant(vec_self->v, -mean);
     gsl_vector_scale(vec_self->v, 1.0 / stdev);
     gsl_matrix_set_col(m, col, vec_self->v);
-    delete vec_other;
     delete vec_self;
   }
   LOG(DEBUG, "= this =\n");
@@ -232,6 +568,20 @@ void Matrix::Sphere(Matrix *other) {
   LOG(DEBUG, "= End sphere =\n");
 }
 
+Matrix *Matrix::Sphered(Vector *means, Vector *stdevs) {
+  size_t width = this->Width();
+  Matrix *ret = new Matrix(this->Height(), width);
+  for (size_t row = 0; row < this->Height(); ++row) {
+    const double *in = m->data + row * m->tda;
+    double *out = gsl_matrix_ptr(ret->m, row, 0);
+    for (size_t col = 0; col < width; ++col) {
+      // The operations of Sphere(), for the same bits.
+      out[col] = (in[col] - means->Get(col)) * (1.0 / stdevs->Get(col));
+    }
+  }
+  return ret;
+}
+
 void Matrix::NormalizeResults() {
   LOG(DEBUG, "= Start normalize results. =\n");
   for (size_t row = 0; row < this->Height(); ++row) {
@@ -274,7 +624,7 @@ Vector* Matrix::GetStdevs() {
 char* Matrix::ToString() {
   LOG(DEBUG, "Matrix ToString\n");
   #define kElementSize 12
-  this->to_str[0] = NULL;
+  this->to_str[0] = '\0';
   size_t total = 0;
   for (size_t row = 0; row < this->Height(); ++row) {
     for (size_t col = 0; col < this->Width(); ++col) {
@@ -284,9 +634,7 @@ char* Matrix::ToString() {
       total += strlen(temp);
       if (total + kElementSize + 1 > 255) break;
     }
-    char temp[1];
-    snprintf(temp, kElementSize, "\n");
-    strncat(this->to_str, temp, 1);
+    strcat(this->to_str, "\n");
     total += 1;
     if (total + kElementSize > 255) break;
   }
@@ -310,23 +658,45 @@ Matrix* Matrix::Multiply(Matrix *other) {
   }
   gsl_matrix *result = gsl_matrix_alloc(this->Height(), other->Height());
   LOG(DEBUG, "\t\t\tgsl_matrix_alloc\n");
-  cblas_dgemm(CblasRowMajor,  // const enum CBLAS_ORDER Order
-      CblasNoTrans,           // const enum CBLAS_TRANSPOSE TransA
-      CblasTrans,             // const enum CBLAS_TRANSPOSE TransB
-      this->Height(),         // const int M
-      other->Height(),        // const int N
-      other->Width(),         // const int K
-      1.0f,                   // const double alpha
-      this->m->data,          // const double * A
-      this->Width(),          // const int lda
-      other->m->data,         // const double * B
-      other->Width(),         // const int ldb
-      0.0f,                   // const double beta
-      result->data,           // double * C
-      other->Height());       // const int ldc
+  GemmTask task = {
+      CblasNoTrans,           // TransA
+      CblasTrans,             // TransB
+      other->Height(),        // N
+      other->Width(),         // K
+      this->m->data,          // A
+      this->m->tda,           // lda
+      other->m->data,         // B
+      other->m->tda,          // ldb
+      result->data,           // C
+      other->Height(),        // ldc
+      0.0 };                  // beta
+  Gemm(&task, this->Height());
   return new Matrix(result);
 }
 
+void Matrix::AddMultiply(Matrix *a, Matrix *b) {
+  LOG(DEBUG, "Adding a %zux%zu times a %zux%zu (transposed).\n",
+    a->Height(), a->Width(), b->Height(), b->Width());
+  if (a->Width() != b->Width() || this->Height() != a->Height()
+      || this->Width() != b->Height()) {
+    fprintf(stderr, "Dimension Error.\n");
+    exit(1);
+  }
+  GemmTask task = {
+      CblasNoTrans,           // TransA
+      CblasTrans,             // TransB
+      b->Height(),            // N
+      b->Width(),             // K
+      a->m->data,             // A
+      a->m->tda,              // lda
+      b->m->data,             // B
+      b->m->tda,              // ldb
+      this->m->data,          // C
+      this->m->tda,           // ldc
+      1.0 };                  // beta
+  Gemm(&task, a->Height());
+}
+
 Matrix* Matrix::MultiplyNoTrans(Matrix *other) {
   LOG(DEBUG, "Multiplying a %zux%zu by a %zux%zu.\n",
     this->Height(), this->Width(), other->Height(), other->Width());
@@ -336,20 +706,44 @@ Matrix* Matrix::MultiplyNoTrans(Matrix *other) {
   }
   gsl_matrix *result = gsl_matrix_alloc(this->Height(), other->Width());
   LOG(DEBUG, "\t\t\tgsl_matrix_alloc\n");
-  cblas_dgemm(CblasRowMajor,  // const enum CBLAS_ORDER Order
-      CblasNoTrans,           // const enum CBLAS_TRANSPOSE TransA
-      CblasNoTrans,             // const enum CBLAS_TRANSPOSE TransB
-      this->Height(),         // const int M
-      other->Width(),         // const int N
-      other->Height(),        // const int K
-      1.0f,                   // const double alpha
-      this->m->data,          // const double * A
-      this->Width(),          // const int lda
-      other->m->data,         // const double * B
-      other->Width(),         // const int ldb
-      0.0f,                   // const double beta
-      result->data,           // double * C
-      other->Width());        // const int ldc
+  GemmTask task = {
+      CblasNoTrans,           // TransA
+      CblasNoTrans,           // TransB
+      other->Width(),         // N
+      other->Height(),        // K
+      this->m->data,          // A
+      this->m->tda,           // lda
+      other->m->data,         // B
+      other->m->tda,          // ldb
+      result->data,           // C
+      other->Width(),         // ldc
+      0.0 };                  // beta
+  GemmInner(&task, this->Height());
+  return new Matrix(result);
+}
+
+Matrix* Matrix::TransposeMultiply(Matrix *other) {
+  LOG(DEBUG, "Multiplying a %zux%zu (transposed) by a %zux%zu.\n",
+    this->Height(), this->Width(), other->Height(), other->Width());
+  if (this->Height() != other->Height()) {
+    fprintf(stderr, "Dimension Error.\n");
+    exit(1);
+  }
+  gsl_matrix *result = gsl_matrix_alloc(this->Width(), other->Width());
+  LOG(DEBUG, "\t\t\tgsl_matrix_alloc\n");
+  GemmTask task = {
+      CblasTrans,             // TransA
+      CblasNoTrans,           // TransB
+      other->Width(),         // N
+      this->Height(),         // K
+      this->m->data,          // A
+      this->m->tda,           // lda
+      other->m->data,         // B
+      other->m->tda,          // ldb
+      result->data,           // C
+      other->Width(),         // ldc
+      0.0 };                  // beta
+  GemmInner(&task, this->Width());
   return new Matrix(result);
 }
 
@@ -361,15 +755,22 @@ Vector* Matrix::Multiply(Vector *vec) {
     exit(1);
   }
   gsl_vector *result = gsl_vector_alloc(this->Height());
+  if (Reduction::Reproducible()) {
+    for (size_t row = 0; row < this->Height(); ++row) {
+      result->data[row] = Reduction::Dot(this->m->data + row * this->m->tda,
+          1, vec->v->data, vec->v->stride, this->Width());
+    }
+    return new Vector(result);
+  }
   cblas_dgemv(CblasRowMajor,  // const enum CBLAS_ORDER Order
       CblasNoTrans,           // const enum CBLAS_TRANSPOSE TransA
       this->Height(),         // const int M (height of A)
       this->Width(),          // const int N (width of A)
       1.0f,                   // const double alpha
       this->m->data,          // const double * A
-      this->Width(),          // const int lda
+      this->m->tda,           // const int lda
       vec->v->data,           // const double * x
-      1,                      // const int incx
+      vec->v->stride,         // const int incx
       0.0f,                   // const double beta
       result->data,           // double * y
       1);                     // const int incy
@@ -378,7 +779,7 @@ Vector* Matrix::Multiply(Vector *vec) {
 
 size_t Matrix::NumberOfRows(FILE *f) {  // TODO(jrm): move to another class
   char lastChar = '\n';
-  char currentChar = NULL;
+  char currentChar = '\0';
   size_t count = 0;
   while ((currentChar = fgetc(f)) != EOF) {
     if (lastChar == '\n' && currentChar != '\n') {
@@ -392,7 +793,7 @@ size_t Matrix::NumberOfRows(FILE *f) {  // TODO(jrm): move to another class
 
 size_t Matrix::NumberOfColumns(FILE *f) {  // TODO(jrm): move to another class
   char lastChar = ' ';
-  char currentChar = NULL;
+  char currentChar = '\0';
   size_t count = 0;
   while ((currentChar = fgetc(f)) != '\n') {
     if (isspace(lastChar) && !isspace(currentChar)) {
@@ -9,6 +9,7 @@
 #include <gsl/gsl_linalg.h>
 #include <gsl/gsl_matrix.h>
 
+#include "lib/Buffer.h"
 #include "lib/Vector.h"
 
 namespace jason {
@@ -18,6 +19,11 @@ class Vector;
 class Matrix {
   public:
     explicit Matrix(double *data, size_t height, size_t width);
+    // Uses a row-major buffer in place, row r starting at data + r * stride.
+    Matrix(double *data, size_t height, size_t width, size_t stride,
+        BufferOwnership ownership);
+    // Converts a row-major float buffer; the library computes in double.
+    Matrix(const float *data, size_t height, size_t width, size_t stride);
     explicit Matrix(size_t height, size_t width);
     explicit Matrix(Vector *vec);
     explicit Matrix(const char* filename);
@@ -25,25 +31,47 @@ class Matrix {
     void Write(const char* filename);
     void RemoveRows(Vector *rows);
     void RemoveColumns(Vector *columns);
+    void AppendRows(Matrix *other);
+    void AppendColumns(Matrix *other);
+    Matrix *GatherRows(Vector *rows);
+    Matrix *Gather(Vector *rows, Vector *columns);
     size_t Height();
     size_t Width();
     void Invert();
+    Matrix *Copy();
+    Matrix *Transpose();
+    // Replaces the lower triangle with the Cholesky factor L of this
+    // symmetric positive definite matrix (this = L L').
+    void Cholesky();
+    // this = L^-1 this for the lower triangular L of `factor`.
+    void SolveLower(Matrix *factor);
     double Get(int row, int col);
     void Set(int row, int col, double val);
+    void SetAll(double val);
     void Add(Matrix *other);
     Vector *Row(size_t row);
+    // A Vector over the row in place, without copying; writes go to the
+    // matrix.  Valid until the matrix is resized or freed.
+    Vector *RowView(size_t row);
     Vector *Column(size_t col);
     void SetColumn(size_t col, Vector *vec);
     void SetRow(size_t row, Vector *vec);
     void Sphere();
     void Sphere(Matrix *other);
+    void Sphere(Vector *means, Vector *stdevs);
+    // Spheres into a new matrix, leaving this one, which may view a
+    // read-only buffer, as it is.
+    Matrix *Sphered(Vector *means, Vector *stdevs);
     void NormalizeResults();
     void CacheMeansAndStdevs();
     Vector* GetMeans();
     Vector* GetStdevs();
     char *ToString();
     Matrix* Multiply(Matrix *other);
+    // this += a b', without allocating the product.
+    void AddMultiply(Matrix *a, Matrix *b);
     Matrix* MultiplyNoTrans(Matrix *other);
+    Matrix* TransposeMultiply(Matrix *other);
     Vector* Multiply(Vector *vec);
     friend class Vector;
     friend class Kernel;
@@ -56,6 +84,7 @@ class Matrix {
     Vector *means;
     Vector *stdevs;
     char *to_str;
+    double *adopted;  // Buffer to free(), see BufferOwnership
 };
 }
 
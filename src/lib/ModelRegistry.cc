@@ -0,0 +1,160 @@
+// Copyright 2011 Jason Marcell
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "lib/ModelRegistry.h"
+#include "lib/Log.h"
+
+#define CONTROL_MAGIC 0x6c7274434d56526dULL  // "mRVMCtrl"
+#define SEGMENT_NAME_SIZE 256
+#define ATTACH_RETRIES 8
+
+namespace jason {
+
+ModelRegistry::ModelRegistry(const char *name) {
+  // POSIX shared memory names are a single component after the slash.
+  this->name = new char[strlen(name) + 2];
+  snprintf(this->name, strlen(name) + 2, "%s%s", name[0] == '/' ? "" : "/",
+      name);
+  this->control = NULL;
+  this->control_writable = false;
+}
+
+ModelRegistry::~ModelRegistry() {
+  if (control != NULL) {
+    munmap(control, sizeof(*control));
+  }
+  delete[] name;
+}
+
+void ModelRegistry::SegmentName(uint64_t generation, char *out,
+    size_t size) {
+  snprintf(out, size, "%s.%llu", name,
+      static_cast<unsigned long long>(generation));
+}
+
+// Maps the control segment.  A publisher maps it writable and creates it
+// if needed; a reader maps an existing one read-only, so attaching to a
+// name nothing was published under leaves no segment behind.
+bool ModelRegistry::OpenControl(bool writable) {
+  if (control != NULL && (control_writable || !writable)) {
+    return true;
+  }
+  if (control != NULL) {
+    munmap(control, sizeof(*control));
+    control = NULL;
+  }
+  int fd = writable ? shm_open(name, O_RDWR | O_CREAT, 0644)
+      : shm_open(name, O_RDONLY, 0);
+  if (fd < 0) {
+    LOG(VERBOSE, "shm_open %s: %s\n", name, strerror(errno));
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0
+      || (st.st_size < static_cast<off_t>(sizeof(*control))
+          && (!writable || ftruncate(fd, sizeof(*control)) != 0))) {
+    close(fd);
+    return false;
+  }
+  void *data = mmap(NULL, sizeof(*control),
+      writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) {
+    return false;
+  }
+  control = reinterpret_cast<Control*>(data);
+  control_writable = writable;
+  if (writable) {
+    __sync_val_compare_and_swap(&control->magic, 0, CONTROL_MAGIC);
+  }
+  return control->magic == CONTROL_MAGIC;
+}
+
+uint64_t ModelRegistry::Current() {
+  if (!OpenControl(false)) {
+    return 0;
+  }
+  return __atomic_load_n(&control->current, __ATOMIC_ACQUIRE);
+}
+
+void *ModelRegistry::Create(size_t bytes, uint64_t *generation) {
+  if (!OpenControl(true)) {
+    return NULL;
+  }
+  *generation = __atomic_add_fetch(&control->next, 1, __ATOMIC_ACQ_REL);
+  char segment[SEGMENT_NAME_SIZE];
+  SegmentName(*generation, segment, sizeof(segment));
+  int fd = shm_open(segment, O_RDWR | O_CREAT | O_EXCL, 0644);
+  if (fd < 0) {
+    LOG(VERBOSE, "shm_open %s: %s\n", segment, strerror(errno));
+    return NULL;
+  }
+  void *data = MAP_FAILED;
+  if (ftruncate(fd, bytes) == 0) {
+    data = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  }
+  close(fd);
+  if (data == MAP_FAILED) {
+    shm_unlink(segment);
+    return NULL;
+  }
+  return data;
+}
+
+bool ModelRegistry::Publish(void *data, size_t bytes, uint64_t generation) {
+  munmap(data, bytes);
+  if (!OpenControl(true)) {
+    return false;
+  }
+  uint64_t previous = __atomic_exchange_n(&control->current, generation,
+      __ATOMIC_ACQ_REL);
+  if (previous != 0) {
+    char segment[SEGMENT_NAME_SIZE];
+    SegmentName(previous, segment, sizeof(segment));
+    shm_unlink(segment);
+  }
+  LOG(VERBOSE, "Published %s generation %llu.\n", name,
+      static_cast<unsigned long long>(generation));
+  return true;
+}
+
+// A publisher may unlink the generation between reading it and opening it,
+// in which case the newer one is tried.
+const void *ModelRegistry::Attach(uint64_t *generation, size_t *bytes) {
+  for (size_t attempt = 0; attempt < ATTACH_RETRIES; ++attempt) {
+    *generation = Current();
+    if (*generation == 0) {
+      return NULL;
+    }
+    char segment[SEGMENT_NAME_SIZE];
+    SegmentName(*generation, segment, sizeof(segment));
+    int fd = shm_open(segment, O_RDONLY, 0);
+    if (fd < 0) {
+      continue;
+    }
+    struct stat st;
+    void *data = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+      *bytes = st.st_size;
+      data = mmap(NULL, *bytes, PROT_READ, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (data != MAP_FAILED) {
+      return data;
+    }
+  }
+  return NULL;
+}
+
+void ModelRegistry::Detach(const void *data, size_t bytes) {
+  munmap(const_cast<void*>(data), bytes);
+}
+}
@@ -0,0 +1,47 @@
+// Copyright 2011 Jason Marcell
+
+#ifndef SRC_LIB_MODELREGISTRY_H_
+#define SRC_LIB_MODELREGISTRY_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace jason {
+
+// Named POSIX shared memory holding successive generations of a model.
+// A small control segment, /<name>, records the current generation, and
+// generation g lives in its own segment /<name>.<g>.  A publisher fills a
+// new generation, then switches the control segment to it and unlinks the
+// previous generation's name; processes still mapping the old one keep it
+// until they detach.  Only a publisher creates or writes segments; readers
+// map the control segment and the generations read-only.
+class ModelRegistry {
+  public:
+    explicit ModelRegistry(const char *name);
+    virtual ~ModelRegistry();
+    // Creates and maps writable the segment of a new generation, or
+    // returns NULL.
+    void *Create(size_t bytes, uint64_t *generation);
+    // Makes a created generation current.  `data` is unmapped.
+    bool Publish(void *data, size_t bytes, uint64_t generation);
+    // Maps the current generation read-only, or returns NULL if there is
+    // none or it cannot be opened.
+    const void *Attach(uint64_t *generation, size_t *bytes);
+    // The current generation, 0 if nothing was published.  Read-only.
+    uint64_t Current();
+    static void Detach(const void *data, size_t bytes);
+  private:
+    struct Control {
+      uint64_t magic;
+      uint64_t current;
+      uint64_t next;
+    };
+    bool OpenControl(bool writable);
+    void SegmentName(uint64_t generation, char *out, size_t size);
+    char *name;
+    Control *control;
+    bool control_writable;  // Whether control was mapped by a publisher
+};
+}
+
+#endif  // SRC_LIB_MODELREGISTRY_H_
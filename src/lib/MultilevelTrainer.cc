@@ -0,0 +1,144 @@
+// Copyright 2011 Jason Marcell
+
+#include <math.h>
+
+#include <algorithm>
+#include <utility>
+
+#include "lib/MultilevelTrainer.h"
+#include "lib/RandomNumberGenerator.h"
+#include "lib/Log.h"
+
+#define LEVEL_ITERATIONS 10  // Update rounds after each refinement
+
+namespace jason {
+
+MultilevelTrainer::MultilevelTrainer(Matrix *x, Vector *labels,
+    size_t classes, Kernel *kernel) {
+  this->x = x;
+  this->t = labels;
+  this->classes = classes;
+  this->kernel = kernel;
+  this->coarsest = x->Height();
+  this->factor = 4;
+  this->landmark_mode = LANDMARKS_STRATIFIED;
+  this->landmark_count = 0;
+  this->seed = 0;
+  this->cdf_table = NULL;
+  this->level_x = NULL;
+  this->level_t = NULL;
+  this->trainer = NULL;
+}
+
+MultilevelTrainer::~MultilevelTrainer() {
+  delete trainer;
+  delete level_t;
+  delete level_x;
+}
+
+void MultilevelTrainer::SetLevels(size_t coarsest, double factor) {
+  this->coarsest = coarsest;
+  this->factor = factor;
+}
+
+void MultilevelTrainer::SetLandmarks(LandmarkMode mode, size_t count) {
+  this->landmark_mode = mode;
+  this->landmark_count = count;
+}
+
+void MultilevelTrainer::SetSeed(unsigned long seed) {
+  this->seed = seed;
+}
+
+void MultilevelTrainer::SetCdfTable(NormalCdfTable *table) {
+  this->cdf_table = table;
+}
+
+Trainer *MultilevelTrainer::GetTrainer() {
+  return trainer;
+}
+
+// Sorts the samples by (rank within their shuffled class + u) / class size
+// with u uniform, which interleaves the classes so that every prefix holds
+// them in about their overall proportions.
+Vector *MultilevelTrainer::StratifiedOrder() {
+  size_t samples = x->Height();
+  RandomNumberGenerator *r = seed == 0 ? new RandomNumberGenerator()
+      : new RandomNumberGenerator(seed);
+  std::pair<double, size_t> *keys = new std::pair<double, size_t>[samples];
+  size_t *members = new size_t[samples];
+  for (size_t c = 0; c < classes; ++c) {
+    size_t count = 0;
+    for (size_t n = 0; n < samples; ++n) {
+      if (t->Get(n) == c) {
+        members[count++] = n;
+      }
+    }
+    for (size_t i = 0; i < count; ++i) {
+      size_t j = i + static_cast<size_t>(r->SampleUniform(0, count - i));
+      j = j < count ? j : count - 1;
+      std::swap(members[i], members[j]);
+      keys[members[i]] = std::make_pair(
+          (i + r->SampleUniform(0, 1)) / count, members[i]);
+    }
+  }
+  std::sort(keys, keys + samples);
+  Vector *ret = new Vector(samples);
+  for (size_t n = 0; n < samples; ++n) {
+    ret->Set(n, keys[n].second);
+  }
+  delete[] members;
+  delete[] keys;
+  delete r;
+  return ret;
+}
+
+void MultilevelTrainer::Process(double tau, double upsilon) {
+  delete trainer;
+  delete level_t;
+  delete level_x;
+  size_t samples = x->Height();
+  Vector *order = StratifiedOrder();
+  size_t size = coarsest < samples ? coarsest : samples;
+  Vector *rows = new Vector(size);
+  level_t = new Vector(size);
+  for (size_t n = 0; n < size; ++n) {
+    rows->Set(n, order->Get(n));
+    level_t->Set(n, t->Get(order->Get(n)));
+  }
+  level_x = x->GatherRows(rows);
+  delete rows;
+
+  kernel->SetOperands(level_x, level_x);
+  trainer = new Trainer(level_x, level_t, classes, kernel);
+  trainer->SetSeed(seed);
+  trainer->SetCdfTable(cdf_table);
+  trainer->SetLandmarks(landmark_mode,
+      landmark_count > 0 ? landmark_count : size);
+  trainer->Process(tau, upsilon);
+  LOG(VERBOSE, "Level 0: %zu samples, %zu relevance vectors.\n", size,
+      trainer->GetActive()->Size());
+
+  for (size_t level = 1; size < samples; ++level) {
+    size_t next = static_cast<size_t>(ceil(size * factor));
+    next = next > size ? next < samples ? next : samples : size + 1;
+    Vector *new_rows = new Vector(next - size);
+    for (size_t n = size; n < next; ++n) {
+      new_rows->Set(n - size, order->Get(n));
+    }
+    Matrix *x_new = x->GatherRows(new_rows);
+    Vector *t_new = new Vector(next - size);
+    for (size_t n = 0; n < new_rows->Size(); ++n) {
+      t_new->Set(n, t->Get(new_rows->Get(n)));
+    }
+    trainer->Update(x_new, t_new, LEVEL_ITERATIONS, tau, upsilon);
+    LOG(VERBOSE, "Level %zu: %zu samples, %zu relevance vectors.\n", level,
+        next, trainer->GetActive()->Size());
+    delete t_new;
+    delete x_new;
+    delete new_rows;
+    size = next;
+  }
+  delete order;
+}
+}
@@ -0,0 +1,65 @@
+// Copyright 2011 Jason Marcell
+
+#ifndef SRC_LIB_MULTILEVELTRAINER_H_
+#define SRC_LIB_MULTILEVELTRAINER_H_
+
+#include "lib/Matrix.h"
+#include "lib/Vector.h"
+#include "lib/Kernel.h"
+#include "lib/Trainer.h"
+#include "lib/NormalCdfTable.h"
+
+namespace jason {
+
+class Matrix;
+class Vector;
+class Kernel;
+class Trainer;
+class NormalCdfTable;
+
+// Coarse-to-fine training for large sample counts.  The samples are put in
+// a random order whose every prefix is stratified by class.  A Trainer is
+// trained on the shortest prefix, then grown level by level with
+// Trainer::Update(): each level appends the next samples, computes only the
+// kernel blocks between them and the current active set, starts their y
+// from the current model and runs a few more iterations.  With landmarks
+// (the default), new samples join the active set only when the model
+// misclassifies them, so the full-scale iterations work on a small active
+// set.
+class MultilevelTrainer {
+  public:
+    // `kernel` is rebound to the coarsest level's samples.
+    MultilevelTrainer(Matrix *x, Vector *labels, size_t classes,
+        Kernel *kernel);
+    virtual ~MultilevelTrainer();
+    // The coarsest level has `coarsest` samples and each further one
+    // `factor` times as many, the last every sample.
+    void SetLevels(size_t coarsest, double factor);
+    // Passed on to the trainer; defaults to LANDMARKS_STRATIFIED with
+    // `coarsest` landmarks.
+    void SetLandmarks(LandmarkMode mode, size_t count);
+    void SetSeed(unsigned long seed);
+    void SetCdfTable(NormalCdfTable *table);
+    void Process(double tau, double upsilon);
+    // The trainer of the final level, whose training matrix holds every
+    // sample in the level order.  Owned by the multilevel trainer.
+    Trainer *GetTrainer();
+  private:
+    Vector *StratifiedOrder();
+    Matrix *x;
+    Vector *t;
+    size_t classes;
+    Kernel *kernel;
+    size_t coarsest;
+    double factor;
+    LandmarkMode landmark_mode;
+    size_t landmark_count;  // 0 for `coarsest`
+    unsigned long seed;
+    NormalCdfTable *cdf_table;
+    Matrix *level_x;  // Grown level by level by the trainer
+    Vector *level_t;
+    Trainer *trainer;
+};
+}
+
+#endif  // SRC_LIB_MULTILEVELTRAINER_H_
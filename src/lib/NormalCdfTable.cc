@@ -0,0 +1,84 @@
+// Copyright 2011 Jason Marcell
+
+#include <math.h>
+
+#include <gsl/gsl_cdf.h>
+#include <gsl/gsl_randist.h>
+
+#include "lib/NormalCdfTable.h"
+#include "lib/Simd.h"
+#include "lib/Log.h"
+
+// max |d^4 Phi / dx^4| = max |phi'''(x)|, attained near x = 0.742.
+#define MAX_FOURTH_DERIVATIVE 0.5513
+#define MIN_TOLERANCE 1e-15
+
+namespace jason {
+
+NormalCdfTable::NormalCdfTable(double tolerance) {
+  if (tolerance < MIN_TOLERANCE) {
+    tolerance = MIN_TOLERANCE;
+  }
+  this->tolerance = tolerance;
+
+  // Outside [-upper, upper] Phi is within tolerance of 0 or 1.  It is
+  // still evaluated exactly there, since the samplers divide by products
+  // of tail probabilities that must not collapse to 0.
+  upper = 1.0;
+  while (gsl_cdf_ugaussian_P(-upper) > tolerance) {
+    upper += 0.25;
+  }
+  lower = -upper;
+
+  // Cubic Hermite interpolation error is bounded by h^4 max|f''''| / 384.
+  double h = pow(384.0 * tolerance / MAX_FOURTH_DERIVATIVE, 0.25);
+  nodes = static_cast<size_t>(ceil((upper - lower) / h)) + 1;
+  step = (upper - lower) / (nodes - 1);
+  inv_step = 1.0 / step;
+
+  values = new double[nodes];
+  slopes = new double[nodes];
+  for (size_t i = 0; i < nodes; ++i) {
+    double x = lower + i * step;
+    values[i] = gsl_cdf_ugaussian_P(x);
+    slopes[i] = gsl_ran_ugaussian_pdf(x) * step;
+  }
+  LOG(DEBUG, "NormalCdfTable: tolerance %g, range +-%.2f, %zu nodes.\n",
+      tolerance, upper, nodes);
+}
+
+NormalCdfTable::~NormalCdfTable() {
+  delete[] values;
+  delete[] slopes;
+}
+
+double NormalCdfTable::P(double x) {
+  if (x <= lower || x >= upper) return gsl_cdf_ugaussian_P(x);
+  double pos = (x - lower) * inv_step;
+  size_t i = static_cast<size_t>(pos);
+  if (i >= nodes - 1) i = nodes - 2;
+  double t = pos - i;
+  double t2 = t * t;
+  double t3 = t2 * t;
+  double h00 = 2 * t3 - 3 * t2 + 1;
+  double h10 = t3 - 2 * t2 + t;
+  double h01 = -2 * t3 + 3 * t2;
+  double h11 = t3 - t2;
+  return h00 * values[i] + h10 * slopes[i]
+      + h01 * values[i + 1] + h11 * slopes[i + 1];
+}
+
+void NormalCdfTable::P(const double *x, double *out, size_t n) {
+  HermiteTable table = { lower, upper, inv_step, nodes, values, slopes,
+    gsl_cdf_ugaussian_P };
+  Simd::Interpolate(&table, x, out, n);
+}
+
+double NormalCdfTable::Tolerance() {
+  return tolerance;
+}
+
+size_t NormalCdfTable::Size() {
+  return nodes;
+}
+}
@@ -0,0 +1,43 @@
+// Copyright 2011 Jason Marcell
+
+#ifndef SRC_LIB_NORMALCDFTABLE_H_
+#define SRC_LIB_NORMALCDFTABLE_H_
+
+#include <stddef.h>
+
+namespace jason {
+
+// Which phases use the tabulated CDF instead of gsl_cdf_ugaussian_P.
+enum CdfMode { CDF_EXACT = 0, CDF_FAST_TRAIN = 1, CDF_FAST_PREDICT = 2,
+  CDF_FAST_ALL = 3 };
+
+// Fast approximation of the standard normal CDF.  Phi is tabulated on a
+// uniform grid over the range where it is not within tolerance of 0 or 1,
+// evaluated there with cubic Hermite interpolation (values plus the exact
+// derivative, the normal PDF), and computed exactly in the tails.  The
+// grid spacing is chosen so that the absolute error stays below the
+// requested tolerance everywhere, and the tails keep their relative
+// accuracy.
+class NormalCdfTable {
+  public:
+    explicit NormalCdfTable(double tolerance);
+    virtual ~NormalCdfTable();
+    double P(double x);
+    // out[i] = P(x[i]) for n points, vectorized at Simd::Level() with the
+    // same bits as P().
+    void P(const double *x, double *out, size_t n);
+    double Tolerance();
+    size_t Size();
+  private:
+    double tolerance;
+    double lower;
+    double upper;
+    double step;
+    double inv_step;
+    size_t nodes;
+    double *values;
+    double *slopes;
+};
+}
+
+#endif  // SRC_LIB_NORMALCDFTABLE_H_
@@ -0,0 +1,137 @@
+// Copyright 2011 Jason Marcell
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sched.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+#endif
+
+#include "lib/Numa.h"
+#include "lib/Scheduler.h"
+#include "lib/Log.h"
+
+#define MAX_NODES 64  // Node masks are a single unsigned long
+
+namespace jason {
+
+namespace {
+
+NumaMode numa_mode = NUMA_NONE;
+size_t numa_nodes = 1;
+#ifdef __linux__
+cpu_set_t node_cpus[MAX_NODES];
+#endif
+
+#ifdef __linux__
+// Parses a sysfs cpu list such as "0-3,8-11".
+void ParseCpuList(const char *list, cpu_set_t *cpus) {
+  CPU_ZERO(cpus);
+  const char *p = list;
+  while (*p != '\0' && *p != '\n') {
+    char *end;
+    long first = strtol(p, &end, 10);
+    long last = first;
+    if (*end == '-') {
+      last = strtol(end + 1, &end, 10);
+    }
+    if (end == p) {
+      break;
+    }
+    for (long cpu = first; cpu <= last && cpu < CPU_SETSIZE; ++cpu) {
+      CPU_SET(cpu, cpus);
+    }
+    p = *end == ',' ? end + 1 : end;
+  }
+}
+
+void Bind(void *data, size_t bytes, int policy, unsigned long mask) {
+  size_t page = sysconf(_SC_PAGESIZE);
+  uintptr_t start = reinterpret_cast<uintptr_t>(data) / page * page;
+  uintptr_t end = (reinterpret_cast<uintptr_t>(data) + bytes) / page * page;
+  if (end <= start) {
+    return;
+  }
+  if (syscall(SYS_mbind, start, end - start, policy, &mask, MAX_NODES + 1,
+      MPOL_MF_MOVE) != 0) {
+    LOG(VERBOSE, "mbind failed, keeping default placement.\n");
+  }
+}
+#endif
+}  // namespace
+
+void Numa::Configure(NumaMode mode) {
+  numa_mode = mode;
+  ReadTopology();
+  LOG(VERBOSE, "NUMA: %zu nodes.\n", numa_nodes);
+}
+
+void Numa::ReadTopology() {
+  numa_nodes = 0;
+#ifdef __linux__
+  for (size_t node = 0; node < MAX_NODES; ++node) {
+    char filename[64];
+    snprintf(filename, sizeof(filename),
+        "/sys/devices/system/node/node%zu/cpulist", node);
+    FILE *f = fopen(filename, "r");
+    if (f == NULL) {
+      break;
+    }
+    char list[4096];
+    if (fgets(list, sizeof(list), f) != NULL) {
+      ParseCpuList(list, &node_cpus[node]);
+      numa_nodes++;
+    }
+    fclose(f);
+  }
+  if (numa_nodes == 0) {
+    sched_getaffinity(0, sizeof(node_cpus[0]), &node_cpus[0]);
+  }
+#endif
+  if (numa_nodes == 0) {
+    numa_nodes = 1;
+  }
+}
+
+NumaMode Numa::Mode() {
+  return numa_mode;
+}
+
+size_t Numa::Nodes() {
+  return numa_nodes;
+}
+
+size_t Numa::NodeOf(size_t thread) {
+  return thread * numa_nodes / Scheduler::Threads();
+}
+
+void Numa::Pin(size_t thread, size_t threads) {
+#ifdef __linux__
+  pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t),
+      &node_cpus[thread * numa_nodes / threads]);
+#endif
+}
+
+void Numa::Place(void *data, size_t rows, size_t row_bytes) {
+#ifdef __linux__
+  char *base = reinterpret_cast<char*>(data);
+  if (numa_mode == NUMA_INTERLEAVE && numa_nodes > 1) {
+    unsigned long all = numa_nodes == MAX_NODES ? ~0UL
+        : (1UL << numa_nodes) - 1;
+    Bind(base, rows * row_bytes, MPOL_INTERLEAVE, all);
+  } else if (numa_mode == NUMA_PARTITION && numa_nodes > 1) {
+    for (size_t t = 0; t < Scheduler::Threads(); ++t) {
+      size_t begin = Scheduler::BlockBegin(rows, t);
+      size_t end = Scheduler::BlockBegin(rows, t + 1);
+      Bind(base + begin * row_bytes, (end - begin) * row_bytes,
+          MPOL_PREFERRED, 1UL << NodeOf(t));
+    }
+  }
+#endif
+}
+}
@@ -0,0 +1,41 @@
+// Copyright 2011 Jason Marcell
+
+#ifndef SRC_LIB_NUMA_H_
+#define SRC_LIB_NUMA_H_
+
+#include <stddef.h>
+
+namespace jason {
+
+enum NumaMode {
+  NUMA_NONE,        // Leave placement to the operating system
+  NUMA_INTERLEAVE,  // Spread large matrices page by page over all nodes
+  NUMA_PARTITION    // Put each worker's tile of rows on the worker's node
+};
+
+// Process-wide memory placement for the Scheduler's blocked loops.  The
+// scheduler's threads are spread over the NUMA nodes in contiguous runs,
+// so that thread t's block of a row-major matrix, its memory and, with
+// Pin() as the scheduler's worker init, the CPUs it runs on all belong to
+// node NodeOf(t).  Under NUMA_PARTITION, Matrix runs its products over the
+// same blocks, and RemoveRows() places the rows it keeps.  The memory
+// policies are Linux only.
+class Numa {
+  public:
+    static void Configure(NumaMode mode);
+    static NumaMode Mode();
+    static size_t Nodes();
+    static size_t NodeOf(size_t thread);
+    // Restricts the calling thread to the CPUs of thread `thread`'s node
+    // in a pool of `threads`.  A Scheduler WorkerInit.
+    static void Pin(size_t thread, size_t threads);
+    // Applies the memory policy to a row-major block of `rows` rows of
+    // `row_bytes` each, split like Scheduler::ParallelBlocks().  Pages that
+    // were already touched are migrated.
+    static void Place(void *data, size_t rows, size_t row_bytes);
+  private:
+    static void ReadTopology();
+};
+}
+
+#endif  // SRC_LIB_NUMA_H_
@@ -19,4 +19,21 @@ PolynomialKernel::~PolynomialKernel() {
 double PolynomialKernel::KernelElementFunction(Vector *vec1, Vector *vec2) {
   return pow(vec1->Multiply(vec2) + 1, n);
 }
+
+void PolynomialKernel::SetParam(int param) {
+  this->n = param;
+}
+
+KernelBaseType PolynomialKernel::BaseType() {
+  return BASE_INNER_PRODUCTS;
+}
+
+// (1 + a.b)^n / sqrt((1 + a.a)^n (1 + b.b)^n), with a single pow().
+void PolynomialKernel::TransformRow(const double *base, double norm1,
+    const double *norms2, double *out, size_t width) {
+  for (size_t col = 0; col < width; ++col) {
+    out[col] = pow((1 + base[col]) / sqrt((1 + norm1) * (1 + norms2[col])),
+        n);
+  }
+}
 }
@@ -18,6 +18,10 @@ class PolynomialKernel: public jason::Kernel {
     PolynomialKernel(Matrix *m1, Matrix *m2, int n);
     virtual ~PolynomialKernel();
     double KernelElementFunction(Vector *vec1, Vector *vec2);
+    void SetParam(int param);
+    KernelBaseType BaseType();
+    void TransformRow(const double *base, double norm1, const double *norms2,
+        double *out, size_t width);
   private:
     int n;
 };
@@ -0,0 +1,223 @@
+// Copyright 2011 Jason Marcell
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "lib/PredictionCache.h"
+
+#define INITIAL_BUCKETS 64
+
+namespace jason {
+
+PredictionCache::PredictionCache(size_t max_bytes, size_t shards) {
+  this->shard_count = shards > 0 ? shards : 1;
+  this->shard_bytes = max_bytes / shard_count;
+  this->shards = new Shard[shard_count];
+  for (size_t i = 0; i < shard_count; ++i) {
+    Shard *shard = &this->shards[i];
+    pthread_mutex_init(&shard->lock, NULL);
+    shard->bucket_count = INITIAL_BUCKETS;
+    shard->buckets = new Entry*[shard->bucket_count];
+    memset(shard->buckets, 0, shard->bucket_count * sizeof(Entry*));
+    shard->entries = 0;
+    shard->bytes = shard->bucket_count * sizeof(Entry*);
+    shard->newest = NULL;
+    shard->oldest = NULL;
+    shard->hits = 0;
+    shard->misses = 0;
+  }
+}
+
+PredictionCache::~PredictionCache() {
+  for (size_t i = 0; i < shard_count; ++i) {
+    Entry *entry = shards[i].newest;
+    while (entry != NULL) {
+      Entry *older = entry->older;
+      free(entry);
+      entry = older;
+    }
+    delete[] shards[i].buckets;
+    pthread_mutex_destroy(&shards[i].lock);
+  }
+  delete[] shards;
+}
+
+// Multiplicative mixing of the 64-bit patterns of the features.
+uint64_t PredictionCache::Hash(const double *x, size_t features,
+    uint64_t version) {
+  uint64_t hash = version * 0x9e3779b97f4a7c15ULL + features;
+  for (size_t i = 0; i < features; ++i) {
+    uint64_t bits;
+    memcpy(&bits, &x[i], sizeof(bits));
+    hash = (hash ^ (bits * 0xff51afd7ed558ccdULL)) * 0xc4ceb9fe1a85ec53ULL;
+    hash ^= hash >> 29;
+  }
+  return hash;
+}
+
+size_t PredictionCache::EntryBytes(size_t features, size_t classes) {
+  return sizeof(Entry) + (features + classes - 1) * sizeof(double);
+}
+
+PredictionCache::Shard *PredictionCache::ShardOf(uint64_t hash) {
+  return &shards[(hash >> 48) % shard_count];
+}
+
+// The link pointing at the matching entry, or at the end of its chain.
+PredictionCache::Entry **PredictionCache::Find(Shard *shard, uint64_t hash,
+    const double *x, size_t features, uint64_t version) {
+  Entry **link = &shard->buckets[hash & (shard->bucket_count - 1)];
+  while (*link != NULL) {
+    Entry *entry = *link;
+    if (entry->hash == hash && entry->version == version
+        && entry->features == features
+        && memcmp(entry->values, x, features * sizeof(*x)) == 0) {
+      break;
+    }
+    link = &entry->chain;
+  }
+  return link;
+}
+
+void PredictionCache::Unlink(Shard *shard, Entry *entry) {
+  if (entry->newer != NULL) {
+    entry->newer->older = entry->older;
+  } else {
+    shard->newest = entry->older;
+  }
+  if (entry->older != NULL) {
+    entry->older->newer = entry->newer;
+  } else {
+    shard->oldest = entry->newer;
+  }
+}
+
+void PredictionCache::PushNewest(Shard *shard, Entry *entry) {
+  entry->newer = NULL;
+  entry->older = shard->newest;
+  if (shard->newest != NULL) {
+    shard->newest->newer = entry;
+  } else {
+    shard->oldest = entry;
+  }
+  shard->newest = entry;
+}
+
+void PredictionCache::Evict(Shard *shard) {
+  Entry *entry = shard->oldest;
+  Entry **link = &shard->buckets[entry->hash & (shard->bucket_count - 1)];
+  while (*link != entry) {
+    link = &(*link)->chain;
+  }
+  *link = entry->chain;
+  Unlink(shard, entry);
+  shard->entries--;
+  shard->bytes -= EntryBytes(entry->features, entry->classes);
+  free(entry);
+}
+
+// Doubles the bucket array once the chains would average over one entry.
+void PredictionCache::Grow(Shard *shard) {
+  size_t bucket_count = 2 * shard->bucket_count;
+  Entry **buckets = new Entry*[bucket_count];
+  memset(buckets, 0, bucket_count * sizeof(Entry*));
+  for (Entry *entry = shard->newest; entry != NULL; entry = entry->older) {
+    Entry **bucket = &buckets[entry->hash & (bucket_count - 1)];
+    entry->chain = *bucket;
+    *bucket = entry;
+  }
+  shard->bytes += (bucket_count - shard->bucket_count) * sizeof(Entry*);
+  delete[] shard->buckets;
+  shard->buckets = buckets;
+  shard->bucket_count = bucket_count;
+}
+
+bool PredictionCache::Lookup(const double *x, size_t features,
+    uint64_t version, double *out, size_t classes) {
+  uint64_t hash = Hash(x, features, version);
+  Shard *shard = ShardOf(hash);
+  pthread_mutex_lock(&shard->lock);
+  Entry *entry = *Find(shard, hash, x, features, version);
+  bool hit = entry != NULL && entry->classes == classes;
+  if (hit) {
+    memcpy(out, entry->values + features, classes * sizeof(*out));
+    Unlink(shard, entry);
+    PushNewest(shard, entry);
+    shard->hits++;
+  } else {
+    shard->misses++;
+  }
+  pthread_mutex_unlock(&shard->lock);
+  return hit;
+}
+
+void PredictionCache::Insert(const double *x, size_t features,
+    uint64_t version, const double *probabilities, size_t classes) {
+  size_t bytes = EntryBytes(features, classes);
+  if (bytes > shard_bytes) {
+    return;
+  }
+  uint64_t hash = Hash(x, features, version);
+  Shard *shard = ShardOf(hash);
+  pthread_mutex_lock(&shard->lock);
+  Entry **link = Find(shard, hash, x, features, version);
+  // The bucket array counts against the cap too: it only grows while the
+  // doubled array and the new entry fit, and an entry that does not fit
+  // next to the array is not stored.
+  if (*link == NULL && shard->entries >= shard->bucket_count
+      && 2 * shard->bucket_count * sizeof(Entry*) + bytes <= shard_bytes) {
+    Grow(shard);
+    link = Find(shard, hash, x, features, version);
+  }
+  if (*link == NULL
+      && shard->bucket_count * sizeof(Entry*) + bytes <= shard_bytes) {
+    Entry *entry = reinterpret_cast<Entry*>(malloc(bytes));
+    entry->hash = hash;
+    entry->version = version;
+    entry->features = features;
+    entry->classes = classes;
+    entry->chain = NULL;
+    memcpy(entry->values, x, features * sizeof(*x));
+    memcpy(entry->values + features, probabilities,
+        classes * sizeof(*probabilities));
+    *link = entry;
+    PushNewest(shard, entry);
+    shard->entries++;
+    shard->bytes += bytes;
+    while (shard->bytes > shard_bytes && shard->oldest != entry) {
+      Evict(shard);
+    }
+  }
+  pthread_mutex_unlock(&shard->lock);
+}
+
+size_t PredictionCache::Hits() {
+  size_t hits = 0;
+  for (size_t i = 0; i < shard_count; ++i) {
+    pthread_mutex_lock(&shards[i].lock);
+    hits += shards[i].hits;
+    pthread_mutex_unlock(&shards[i].lock);
+  }
+  return hits;
+}
+
+size_t PredictionCache::Misses() {
+  size_t misses = 0;
+  for (size_t i = 0; i < shard_count; ++i) {
+    pthread_mutex_lock(&shards[i].lock);
+    misses += shards[i].misses;
+    pthread_mutex_unlock(&shards[i].lock);
+  }
+  return misses;
+}
+
+size_t PredictionCache::Bytes() {
+  size_t bytes = 0;
+  for (size_t i = 0; i < shard_count; ++i) {
+    pthread_mutex_lock(&shards[i].lock);
+    bytes += shards[i].bytes;
+    pthread_mutex_unlock(&shards[i].lock);
+  }
+  return bytes;
+}
+}
@@ -0,0 +1,68 @@
+// Copyright 2011 Jason Marcell
+
+#ifndef SRC_LIB_PREDICTIONCACHE_H_
+#define SRC_LIB_PREDICTIONCACHE_H_
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+namespace jason {
+
+// Bounded cache of class probabilities keyed by the raw feature vector and
+// a model version.  Entries are spread over independently locked shards by
+// hash, and each shard evicts its least recently used entries to keep
+// them and its hash buckets under its share of the memory cap.  Keys are
+// compared exactly, so a hit always returns what was stored for the same
+// bits.
+class PredictionCache {
+  public:
+    PredictionCache(size_t max_bytes, size_t shards);
+    virtual ~PredictionCache();
+    // Copies the probabilities stored for x into out and returns true, or
+    // returns false if there are none.
+    bool Lookup(const double *x, size_t features, uint64_t version,
+        double *out, size_t classes);
+    void Insert(const double *x, size_t features, uint64_t version,
+        const double *probabilities, size_t classes);
+    size_t Hits();
+    size_t Misses();
+    size_t Bytes();
+    static uint64_t Hash(const double *x, size_t features, uint64_t version);
+  private:
+    struct Entry {
+      uint64_t hash;
+      uint64_t version;
+      size_t features;
+      size_t classes;
+      Entry *chain;     // Next entry in the same bucket
+      Entry *newer;
+      Entry *older;
+      double values[1];  // features, then classes
+    };
+    struct Shard {
+      pthread_mutex_t lock;
+      Entry **buckets;
+      size_t bucket_count;  // Power of two
+      size_t entries;
+      size_t bytes;
+      Entry *newest;
+      Entry *oldest;
+      size_t hits;
+      size_t misses;
+    };
+    Shard *ShardOf(uint64_t hash);
+    Entry **Find(Shard *shard, uint64_t hash, const double *x,
+        size_t features, uint64_t version);
+    void Unlink(Shard *shard, Entry *entry);
+    void PushNewest(Shard *shard, Entry *entry);
+    void Evict(Shard *shard);
+    void Grow(Shard *shard);
+    static size_t EntryBytes(size_t features, size_t classes);
+    Shard *shards;
+    size_t shard_count;
+    size_t shard_bytes;   // Memory cap of each shard
+};
+}
+
+#endif  // SRC_LIB_PREDICTIONCACHE_H_
@@ -1,76 +1,306 @@
 // Copyright 2011 Jason Marcell
 
+#include <math.h>
+
+#include <gsl/gsl_cdf.h>
+
+#include <algorithm>
+
 #include "lib/Predictor.h"
 #include "lib/Kernel.h"
 #include "lib/LinearKernel.h"
+#include "lib/GaussianKernel.h"
+#include "lib/FastGaussTransform.h"
 #include "lib/GaussHermiteQuadrature.h"
-#include "lib/RandomNumberGenerator.h"
+#include "lib/Scheduler.h"
 #include "lib/Log.h"
 
+#define QUADRATURE_GRAIN 64  // Test samples per quadrature task
+#define VARIANCE_PANEL 256   // Test samples per variance solve
+
 namespace jason {
 
 Predictor::Predictor(Matrix *w, Matrix *x_train, Matrix *x_predict,
     Kernel *kernel) {
   this->k = kernel;
   this->w = w;
+  this->x_train = x_train;
+  this->x_predict = x_predict;
+  this->threshold = 0;
+  this->kernel_tolerance = 0;
+  this->fgt_tolerance = 0;
+  this->index = NULL;
+  this->weights = w;
+  this->relevance_vectors = NULL;
+  this->cdf_table = NULL;
+  this->factors = NULL;
 }
 
 Predictor::~Predictor() {
+  if (weights != w) {
+    delete weights;
+  }
+  delete relevance_vectors;
+  delete index;
+}
+
+void Predictor::SetWeightThreshold(double threshold) {
+  this->threshold = threshold;
+}
+
+void Predictor::SetKernelTolerance(double tolerance) {
+  this->kernel_tolerance = tolerance;
+}
+
+void Predictor::SetFastGaussTolerance(double tolerance) {
+  this->fgt_tolerance = tolerance;
+}
+
+// Keeps only the training rows whose weight row has a norm above the
+// threshold and rebinds the kernel to them, so the test kernel has one row
+// per relevance vector rather than one per training sample.
+void Predictor::SelectRelevanceVectors() {
+  bool *keep = new bool[w->Height()];
+  size_t count = 0;
+  for (size_t row = 0; row < w->Height(); ++row) {
+    Vector *w_row = w->Row(row);
+    keep[row] = sqrt(w_row->Multiply(w_row)) > threshold;
+    count += keep[row];
+    delete w_row;
+  }
+  LOG(VERBOSE, "Predicting with %zu of %zu relevance vectors.\n", count,
+      w->Height());
+  Vector *rows = new Vector(count);
+  for (size_t row = 0, ret_row = 0; row < w->Height(); ++row) {
+    if (keep[row]) {
+      rows->Set(ret_row++, row);
+    }
+  }
+  if (weights != w) {
+    delete weights;
+  }
+  delete relevance_vectors;
+  delete index;
+  index = NULL;
+  weights = w->GatherRows(rows);
+  relevance_vectors = x_train->GatherRows(rows);
+  k->SetOperands(relevance_vectors, x_predict);
+  delete rows;
+  delete[] keep;
+}
+
+void Predictor::SetPosteriorFactors(Matrix **factors) {
+  this->factors = factors;
+}
+
+void Predictor::SetCdfTable(NormalCdfTable *table) {
+  this->cdf_table = table;
 }
 
 Matrix* Predictor::Predict() {
   LOG(VERBOSE, "= Initializing Predictor Kernel. =\n");
 
-  k->Init();
+  if (factors != NULL && threshold > 0) {
+    LOG(VERBOSE, "Posterior variances use every relevance vector.\n");
+    threshold = 0;
+  }
+  if (x_train != NULL && x_predict != NULL) {
+    SelectRelevanceVectors();
+  }
+  Matrix *scores = factors == NULL ? FastGaussScores() : NULL;
+  if (scores == NULL) {
+    double radius = k->CutoffRadius(kernel_tolerance);
+    if (radius >= 0 && relevance_vectors != NULL) {
+      if (index == NULL) {
+        index = new KdTree(relevance_vectors);
+      }
+      k->InitWithIndex(index, radius);
+    } else {
+      k->Init();
+    }
 
-  LOG(VERBOSE, "= Printing Predictor Kernel: =\n");
-  LOG(VERBOSE, "%s\n", k->ToString());
+    LOG(VERBOSE, "= Printing Predictor Kernel: =\n");
+    LOG(VERBOSE, "%s\n", k->ToString());
 
-  Matrix *predictions = QuadratureApproximation();
+    scores = Scores();
+  }
+  Matrix *variances = factors != NULL ? Variances() : NULL;
+  Matrix *predictions = QuadratureApproximation(scores, variances);
   predictions->NormalizeResults();
+  delete variances;
+  delete scores;
   return predictions;
 }
 
-Matrix* Predictor::QuadratureApproximation() {
+// Scores of a Gaussian model through the fast Gauss transform, or NULL if
+// it is not enabled or does not apply.
+Matrix* Predictor::FastGaussScores() {
+  GaussianKernel *gaussian = dynamic_cast<GaussianKernel*>(k);
+  if (fgt_tolerance <= 0 || gaussian == NULL || relevance_vectors == NULL) {
+    return NULL;
+  }
+  Vector *theta = gaussian->GetTheta();
+  FastGaussTransform *fgt = new FastGaussTransform(relevance_vectors,
+      weights, theta, fgt_tolerance);
+  Matrix *scores = fgt->Evaluate(x_predict);
+  delete fgt;
+  delete theta;
+  return scores;
+}
+
+// The class scores w_i' k_n of every test sample, as one GEMM.
+Matrix* Predictor::Scores() {
+  LOG(DEBUG, "k is %zux%zu\n", k->Height(), k->Width());
+  LOG(DEBUG, "w is %zux%zu\n", weights->Height(), weights->Width());
+  return k->TransposeMultiply(weights);
+}
+
+struct VarianceTask {
+  Predictor *predictor;
+  Matrix *variances;
+  Vector *rows;   // Every relevance vector
+  size_t panels;  // VARIANCE_PANEL test samples each
+};
+
+// Var(w_c' k_n) = k_n' L_c'^-1 L_c^-1 k_n = |L_c^-1 k_n|^2: a triangular
+// solve per class over the test kernel, M^2 T C flops for M relevance
+// vectors and T test samples, against the M T C of the scores.  Each task
+// solves one class over one panel of test samples in its own M x
+// VARIANCE_PANEL buffer, so the test kernel is never copied whole.
+Matrix* Predictor::Variances() {
+  size_t classes = weights->Width();
+  Matrix *variances = new Matrix(k->Width(), classes);
+  if (k->Height() == 0) {
+    variances->SetAll(0.0);
+    return variances;
+  }
+  Vector *rows = new Vector(k->Height());
+  for (size_t m = 0; m < k->Height(); ++m) {
+    rows->Set(m, m);
+  }
+  size_t panels = (k->Width() + VARIANCE_PANEL - 1) / VARIANCE_PANEL;
+  VarianceTask task = { this, variances, rows, panels };
+  Scheduler::ParallelFor("variances", classes * panels, 1, VarianceTile,
+      &task);
+  delete rows;
+  return variances;
+}
+
+void Predictor::VarianceTile(size_t begin, size_t end, void *arg) {
+  VarianceTask *task = reinterpret_cast<VarianceTask*>(arg);
+  Predictor *predictor = task->predictor;
+  size_t samples = predictor->k->Width();
+  for (size_t i = begin; i < end; ++i) {
+    size_t c = i / task->panels;
+    size_t first = (i % task->panels) * VARIANCE_PANEL;
+    size_t last = std::min(first + VARIANCE_PANEL, samples);
+    Vector *columns = new Vector(last - first);
+    for (size_t n = first; n < last; ++n) {
+      columns->Set(n - first, n);
+    }
+    Matrix *z = predictor->k->Gather(task->rows, columns);
+    z->SolveLower(predictor->factors[c]);
+    for (size_t n = first; n < last; ++n) {
+      double sum = 0;
+      for (size_t m = 0; m < z->Height(); ++m) {
+        sum += z->Get(m, n - first) * z->Get(m, n - first);
+      }
+      task->variances->Set(n, c, sum);
+    }
+    delete z;
+    delete columns;
+  }
+}
+
+Matrix* Predictor::QuadratureApproximation(Matrix *scores) {
+  return QuadratureApproximation(scores, NULL);
+}
+
+struct QuadratureTask {
+  Predictor *predictor;
+  Matrix *scores;
+  Matrix *variances;
+  double *points;
+  double *weights;
+  Matrix *result;
+};
+
+Matrix* Predictor::QuadratureApproximation(Matrix *scores,
+    Matrix *variances) {
   LOG(DEBUG, "QuadratureApproximation\n");
-  RandomNumberGenerator *r = new RandomNumberGenerator();
   GaussHermiteQuadrature *g = new GaussHermiteQuadrature();
   double *points;
   double *weights;
   g->Process(3, &points, &weights);
   delete g;
 
-  LOG(DEBUG, "k is %zux%zu\n", k->Height(), k->Width());
-  LOG(DEBUG, "w is %zux%zu\n", w->Height(), w->Width());
-
-  Matrix *result = new Matrix(k->Width(), w->Width());
-  for (size_t n = 0; n < k->Width(); ++n) {
-    for (size_t i = 0; i < w->Width(); ++i) {
-      Vector *kn = k->Column(n);
-      Vector *wi = w->Column(i);
-      double wikn = wi->Multiply(kn);
+  Matrix *result = new Matrix(scores->Height(), scores->Width());
+  QuadratureTask task = { this, scores, variances, points, weights, result };
+  Scheduler::ParallelFor("quadrature", scores->Height(), QUADRATURE_GRAIN,
+      QuadratureTile, &task);
+  delete[] points;
+  delete[] weights;
+  return result;
+}
+
+void Predictor::QuadratureTile(size_t begin, size_t end, void *arg) {
+  QuadratureTask *task = reinterpret_cast<QuadratureTask*>(arg);
+  task->predictor->QuadratureRows(begin, end, task->scores, task->variances,
+      task->points, task->weights, task->result);
+}
+
+void Predictor::QuadratureRows(size_t begin, size_t end, Matrix *scores,
+    Matrix *variances, double *points, double *weights, Matrix *result) {
+  size_t classes = scores->Width();
+  size_t terms = 3 * classes * classes;  // (i, k, j), j == i unused
+  double *stdev = new double[classes];
+  double *args = new double[terms];
+  double *cdfs = new double[terms];
+  for (size_t j = 0; j < classes; ++j) {
+    stdev[j] = 1;
+  }
+  for (size_t n = begin; n < end; ++n) {
+    if (variances != NULL) {
+      for (size_t j = 0; j < classes; ++j) {
+        stdev[j] = sqrt(1 + variances->Get(n, j));
+      }
+    }
+    // Every CDF argument of the sample first, so that the tabulated CDF
+    // evaluates them as one vectorized batch.
+    for (size_t i = 0; i < classes; ++i) {
+      double wikn = scores->Get(n, i);
+      for (size_t k = 0; k < 3; ++k) {
+        for (size_t j = 0; j < classes; ++j) {
+          args[(i * 3 + k) * classes + j] = (points[k] * stdev[i] + wikn
+              - scores->Get(n, j)) / stdev[j];
+        }
+      }
+    }
+    if (cdf_table) {
+      cdf_table->P(args, cdfs, terms);
+    } else {
+      for (size_t term = 0; term < terms; ++term) {
+        bool own = term % classes == term / (3 * classes);  // j == i
+        cdfs[term] = own ? 1.0 : gsl_cdf_ugaussian_P(args[term]);
+      }
+    }
+    for (size_t i = 0; i < classes; ++i) {
       double sum = 0;
       for (size_t k = 0; k < 3; ++k) {
         double prod = 1;
-        for (size_t j = 0; j < w->Width(); ++j) {
+        for (size_t j = 0; j < classes; ++j) {
           if (j != i) {
-            Vector *wj = w->Column(j);
-            double wjkn = wj->Multiply(kn);
-            delete wj;
-            prod *= r->GaussianCDF(points[k] + wikn - wjkn);
+            prod *= cdfs[(i * 3 + k) * classes + j];
           }  // if
         }  // for j
         sum += weights[k]*prod;
       }  // for k
-      delete wi;
-      delete kn;
       LOG(DEBUG, "sample n=%zu, class i=%zu, value=%f\n", n, i, sum);
       result->Set(n, i, sum);
     }  // for i
   }  // for n
-  delete r;
-  delete[] points;
-  delete[] weights;
-  return result;
+  delete[] cdfs;
+  delete[] args;
+  delete[] stdev;
 }
 }
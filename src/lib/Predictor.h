@@ -5,21 +5,60 @@
 
 #include "lib/Matrix.h"
 #include "lib/Kernel.h"
+#include "lib/KdTree.h"
+#include "lib/NormalCdfTable.h"
 
 namespace jason {
 
 class Matrix;
 class Kernel;
+class KdTree;
+class NormalCdfTable;
 
 class Predictor {
   public:
     Predictor(Matrix *w, Matrix *x_train, Matrix* x_predict, Kernel *kernel);
     virtual ~Predictor();
     Matrix* Predict();
+    Matrix* Scores();
+    Matrix* QuadratureApproximation(Matrix *scores);
+    // With `variances` (N x C, may be NULL), class i's score of sample n
+    // is treated as N(scores_ni, 1 + variances_ni) rather than N(scores_ni,
+    // 1), integrating over the posterior of w as well as the probit noise.
+    Matrix* QuadratureApproximation(Matrix *scores, Matrix *variances);
+    void SetCdfTable(NormalCdfTable *table);
+    void SetWeightThreshold(double threshold);
+    // Skip test kernel entries below `tolerance` using a spatial index over
+    // the relevance vectors, for kernels that support a distance cutoff.
+    void SetKernelTolerance(double tolerance);
+    // Score Gaussian models with the fast Gauss transform, to the given
+    // absolute tolerance, instead of building the test kernel.
+    void SetFastGaussTolerance(double tolerance);
+    // Include the posterior uncertainty of w, from the per-class Cholesky
+    // factors of Trainer::GetPosteriorFactors(), in the probabilities.
+    // Every relevance vector is then used and the test kernel is built.
+    void SetPosteriorFactors(Matrix **factors);
   private:
-    Matrix *QuadratureApproximation();
+    friend class PredictorPeer;  // Reads the posterior variances in tests
+    void SelectRelevanceVectors();
+    Matrix *FastGaussScores();
+    Matrix *Variances();
+    static void VarianceTile(size_t begin, size_t end, void *arg);
+    static void QuadratureTile(size_t begin, size_t end, void *arg);
+    void QuadratureRows(size_t begin, size_t end, Matrix *scores,
+        Matrix *variances, double *points, double *weights, Matrix *result);
     Kernel *k;
     Matrix *w;
+    Matrix *x_train;
+    Matrix *x_predict;
+    double threshold;
+    double kernel_tolerance;
+    double fgt_tolerance;
+    KdTree *index;  // Over relevance_vectors, built on first use
+    Matrix *weights;            // Rows of w kept for prediction
+    Matrix *relevance_vectors;  // Rows of x_train kept for prediction
+    NormalCdfTable *cdf_table;  // NULL selects the exact gsl CDF
+    Matrix **factors;           // Per class, NULL to ignore w's posterior
 };
 }
 
@@ -0,0 +1,235 @@
+// Copyright 2011 Jason Marcell
+
+#include <math.h>
+#include <string.h>
+
+#include "lib/QuantizedModel.h"
+#include "lib/Scheduler.h"
+#include "lib/Simd.h"
+#include "lib/Log.h"
+
+// Rows are padded to the multiples Simd::DotInt8() and Simd::DotHalf()
+// take: 16 int8s, or 8 halves.
+#define INT8_BLOCK 16
+#define FP16_BLOCK 8
+#define INT8_LEVELS 127
+#define SCORE_GRAIN 64  // Test samples per scoring task
+
+namespace jason {
+
+namespace {
+
+uint16_t FloatToHalf(float value) {
+  uint32_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  uint16_t sign = (bits >> 16) & 0x8000;
+  float magnitude = fabsf(value);
+  if (magnitude >= 65520.0f) {
+    return sign | 0x7c00;
+  }
+  if (magnitude < 6.103515625e-05f) {
+    // Subnormal halves are multiples of 2^-24.
+    return sign | static_cast<uint16_t>(lrintf(magnitude * 16777216.0f));
+  }
+  memcpy(&bits, &magnitude, sizeof(bits));
+  bits += 0xfff + ((bits >> 13) & 1);  // Round to nearest even
+  return sign | static_cast<uint16_t>((bits >> 13) - (112 << 10));
+}
+}  // namespace
+
+QuantizedModel::QuantizedModel(Matrix *relevance_vectors, Matrix *w,
+    KernelType kernel, int kernel_param, Quantization quantization) {
+  this->kernel = kernel;
+  this->kernel_param = kernel_param;
+  this->feature_scale = kernel == GAUSSIAN ? sqrt(kernel_param) : 1.0;
+  this->quantization = quantization;
+  this->rows = relevance_vectors->Height();
+  this->dims = relevance_vectors->Width();
+  size_t block = quantization == QUANTIZE_INT8 ? INT8_BLOCK : FP16_BLOCK;
+  this->stride = (dims + block - 1) / block * block;
+  this->classes = w->Width();
+  this->element = quantization == QUANTIZE_INT8 ? 1 : 2;
+  this->rv_data = new uint8_t[rows * stride * element];
+  this->rv_scales = new float[rows];
+  this->rv_self = new double[rows];
+  this->w_data = new uint8_t[rows * classes * element];
+  this->w_scales = new float[rows];
+
+  double *row = new double[stride];
+  float *values = new float[stride];
+  for (size_t m = 0; m < rows; ++m) {
+    PrepareRow(relevance_vectors, m, row);
+    uint8_t *rv = rv_data + m * stride * element;
+    QuantizeRow(row, stride, rv, &rv_scales[m]);
+    // The self-similarity comes from the stored values, so Gaussian
+    // distances computed from them do not go negative.
+    for (size_t d = 0; d < stride; ++d) {
+      values[d] = quantization == QUANTIZE_INT8
+          ? reinterpret_cast<int8_t*>(rv)[d] * rv_scales[m]
+          : Simd::HalfToFloat(reinterpret_cast<uint16_t*>(rv)[d])
+              * rv_scales[m];
+    }
+    rv_self[m] = 0;
+    for (size_t d = 0; d < stride; ++d) {
+      rv_self[m] += static_cast<double>(values[d]) * values[d];
+    }
+    for (size_t c = 0; c < classes; ++c) {
+      row[c] = w->Get(m, c);
+    }
+    QuantizeRow(row, classes, w_data + m * classes * element, &w_scales[m]);
+  }
+  delete[] values;
+  delete[] row;
+  LOG(VERBOSE, "Quantized %zu relevance vectors to %s: %zu bytes, "
+      "%zu in double precision.\n", rows,
+      quantization == QUANTIZE_INT8 ? "int8" : "fp16", Bytes(), DoubleBytes());
+}
+
+QuantizedModel::~QuantizedModel() {
+  delete[] rv_data;
+  delete[] rv_scales;
+  delete[] rv_self;
+  delete[] w_data;
+  delete[] w_scales;
+}
+
+size_t QuantizedModel::Bytes() {
+  return rows * (stride + classes) * element
+      + rows * (2 * sizeof(float) + sizeof(double));
+}
+
+size_t QuantizedModel::DoubleBytes() {
+  return rows * (dims + classes) * sizeof(double);
+}
+
+// Row `row` of m in the kernel's feature scaling, zero padded to stride.
+void QuantizedModel::PrepareRow(Matrix *m, size_t row, double *out) {
+  for (size_t d = 0; d < dims; ++d) {
+    out[d] = m->Get(row, d) * feature_scale;
+  }
+  for (size_t d = dims; d < stride; ++d) {
+    out[d] = 0;
+  }
+}
+
+// Stores in[] so that value = stored * scale, with the largest magnitude
+// mapped to the edge of the representable range.
+void QuantizedModel::QuantizeRow(const double *in, size_t size, void *out,
+    float *scale) {
+  double max = 0;
+  for (size_t i = 0; i < size; ++i) {
+    max = fmax(max, fabs(in[i]));
+  }
+  if (quantization == QUANTIZE_INT8) {
+    *scale = max / INT8_LEVELS;
+    int8_t *q = reinterpret_cast<int8_t*>(out);
+    for (size_t i = 0; i < size; ++i) {
+      q[i] = max > 0 ? static_cast<int8_t>(lrint(in[i] / *scale)) : 0;
+    }
+  } else {
+    *scale = max;
+    uint16_t *q = reinterpret_cast<uint16_t*>(out);
+    for (size_t i = 0; i < size; ++i) {
+      q[i] = FloatToHalf(max > 0 ? in[i] / max : 0);
+    }
+  }
+}
+
+double QuantizedModel::Dot(const void *rv, float rv_scale,
+    const void *sample, float sample_scale) {
+  if (quantization == QUANTIZE_INT8) {
+    return static_cast<double>(rv_scale) * sample_scale
+        * Simd::DotInt8(reinterpret_cast<const int8_t*>(rv),
+            reinterpret_cast<const int8_t*>(sample), stride);
+  }
+  return static_cast<double>(rv_scale) * sample_scale
+      * Simd::DotHalf(reinterpret_cast<const uint16_t*>(rv),
+          reinterpret_cast<const float*>(sample), stride);
+}
+
+double QuantizedModel::KernelValue(double dot, double self1, double self2) {
+  switch (kernel) {
+  case POLYNOMIAL:
+    return pow(dot + 1, kernel_param)
+        / sqrt(pow(self1 + 1, kernel_param) * pow(self2 + 1, kernel_param));
+  case GAUSSIAN:
+    return exp(-0.5 * fmax(0.0, self1 + self2 - 2 * dot));
+  default:
+    return dot / sqrt(self1 * self2);
+  }
+}
+
+double QuantizedModel::Weight(size_t row, size_t c) {
+  const uint8_t *q = w_data + (row * classes + c) * element;
+  if (quantization == QUANTIZE_INT8) {
+    return *reinterpret_cast<const int8_t*>(q) * w_scales[row];
+  }
+  return Simd::HalfToFloat(*reinterpret_cast<const uint16_t*>(q))
+      * w_scales[row];
+}
+
+struct QuantizedScoreTask {
+  QuantizedModel *model;
+  Matrix *x_predict;
+  Matrix *scores;
+};
+
+Matrix* QuantizedModel::Scores(Matrix *x_predict) {
+  Matrix *scores = new Matrix(x_predict->Height(), classes);
+  QuantizedScoreTask task = { this, x_predict, scores };
+  Scheduler::ParallelFor("quantized_scores", x_predict->Height(),
+      SCORE_GRAIN, ScoreTile, &task);
+  return scores;
+}
+
+void QuantizedModel::ScoreTile(size_t begin, size_t end, void *arg) {
+  QuantizedScoreTask *task = reinterpret_cast<QuantizedScoreTask*>(arg);
+  task->model->ScoreRows(begin, end, task->x_predict, task->scores);
+}
+
+void QuantizedModel::ScoreRows(size_t begin, size_t end, Matrix *x_predict,
+    Matrix *scores) {
+  double *row = new double[stride];
+  double *sums = new double[classes];
+  // The test sample is quantized to int8 like the relevance vectors, or
+  // kept in float against fp16 relevance vectors.
+  int8_t *sample_int8 = new int8_t[stride];
+  float *sample_float = new float[stride];
+  float sample_scale = 1;
+  for (size_t n = begin; n < end; ++n) {
+    PrepareRow(x_predict, n, row);
+    const void *sample;
+    double sample_self = 0;
+    if (quantization == QUANTIZE_INT8) {
+      QuantizeRow(row, stride, sample_int8, &sample_scale);
+      sample = sample_int8;
+      sample_self = Dot(sample_int8, sample_scale, sample_int8,
+          sample_scale);
+    } else {
+      for (size_t d = 0; d < stride; ++d) {
+        sample_float[d] = row[d];
+        sample_self += static_cast<double>(sample_float[d]) * sample_float[d];
+      }
+      sample = sample_float;
+    }
+    for (size_t c = 0; c < classes; ++c) {
+      sums[c] = 0;
+    }
+    for (size_t m = 0; m < rows; ++m) {
+      double dot = Dot(rv_data + m * stride * element, rv_scales[m], sample,
+          sample_scale);
+      double k = KernelValue(dot, rv_self[m], sample_self);
+      for (size_t c = 0; c < classes; ++c) {
+        sums[c] += k * Weight(m, c);
+      }
+    }
+    for (size_t c = 0; c < classes; ++c) {
+      scores->Set(n, c, sums[c]);
+    }
+  }
+  delete[] sample_float;
+  delete[] sample_int8;
+  delete[] sums;
+  delete[] row;
+}
+}
@@ -0,0 +1,63 @@
+// Copyright 2011 Jason Marcell
+
+#ifndef SRC_LIB_QUANTIZEDMODEL_H_
+#define SRC_LIB_QUANTIZEDMODEL_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "lib/Matrix.h"
+#include "lib/Kernel.h"
+
+namespace jason {
+
+class Matrix;
+
+enum Quantization { QUANTIZE_NONE, QUANTIZE_INT8, QUANTIZE_FP16 };
+
+// A trained model stored for inference only: the relevance vectors and the
+// rows of w are kept in int8 or fp16, each row with its own scale.  Kernel
+// values are recovered from low precision dot products against the test
+// samples (quantized the same way for int8, kept in float for fp16), so
+// every kernel is reduced to dot products and self-similarities:
+//
+//   LINEAR      x'y / sqrt(x'x y'y)
+//   POLYNOMIAL  (x'y + 1)^p / sqrt((x'x + 1)^p (y'y + 1)^p)
+//   GAUSSIAN    exp(-0.5 (x'x + y'y - 2 x'y)), features scaled by sqrt(p)
+class QuantizedModel {
+  public:
+    QuantizedModel(Matrix *relevance_vectors, Matrix *w, KernelType kernel,
+        int kernel_param, Quantization quantization);
+    virtual ~QuantizedModel();
+    // Class scores w_i' k_n of every row of x_predict, like
+    // Predictor::Scores().
+    Matrix *Scores(Matrix *x_predict);
+    // Memory held by the quantized relevance vectors and weights, and by
+    // the double precision model they replace.
+    size_t Bytes();
+    size_t DoubleBytes();
+  private:
+    static void ScoreTile(size_t begin, size_t end, void *arg);
+    void ScoreRows(size_t begin, size_t end, Matrix *x_predict,
+        Matrix *scores);
+    void PrepareRow(Matrix *m, size_t row, double *out);
+    void QuantizeRow(const double *in, size_t size, void *out, float *scale);
+    double Dot(const void *rv, float rv_scale, const void *sample,
+        float sample_scale);
+    double KernelValue(double dot, double self1, double self2);
+    double Weight(size_t row, size_t c);
+    KernelType kernel;
+    int kernel_param;
+    double feature_scale;  // sqrt(param) for the Gaussian kernel, else 1
+    Quantization quantization;
+    size_t rows, dims, stride, classes;
+    size_t element;       // Bytes per stored value
+    uint8_t *rv_data;     // rows x stride, zero padded
+    float *rv_scales;
+    double *rv_self;      // Self dot products of the stored rows
+    uint8_t *w_data;      // rows x classes
+    float *w_scales;
+};
+}
+
+#endif  // SRC_LIB_QUANTIZEDMODEL_H_
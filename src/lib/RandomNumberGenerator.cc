@@ -15,6 +15,14 @@ RandomNumberGenerator::RandomNumberGenerator() {
   LOG(DEBUG, "\t\t\tgsl_rng_alloc\n");
 }
 
+// Does not consult GSL_RNG_TYPE/GSL_RNG_SEED, so it is safe to construct
+// from several threads at once.
+RandomNumberGenerator::RandomNumberGenerator(unsigned long seed) {
+  r = gsl_rng_alloc(gsl_rng_mt19937);
+  gsl_rng_set(r, seed);
+  LOG(DEBUG, "\t\t\tgsl_rng_alloc\n");
+}
+
 RandomNumberGenerator::~RandomNumberGenerator() {
   gsl_rng_free(r);
   LOG(DEBUG, "\t\t\tgsl_rng_free\n");
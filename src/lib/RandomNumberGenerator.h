@@ -11,6 +11,7 @@ namespace jason {
 class RandomNumberGenerator {
   public:
     RandomNumberGenerator();
+    explicit RandomNumberGenerator(unsigned long seed);
     virtual ~RandomNumberGenerator();
     double SampleGaussian(double sigma);
     double GaussianPDF(double val);
@@ -0,0 +1,43 @@
+// Copyright 2011 Jason Marcell
+
+#include <math.h>
+
+#include "lib/Reduction.h"
+
+namespace jason {
+
+namespace {
+ReductionMode reduction_mode = REDUCTION_FAST;
+}  // namespace
+
+void Reduction::SetMode(ReductionMode mode) {
+  reduction_mode = mode;
+}
+
+ReductionMode Reduction::Mode() {
+  return reduction_mode;
+}
+
+bool Reduction::Reproducible() {
+  return reduction_mode == REDUCTION_REPRODUCIBLE;
+}
+
+// The running error term recovers the low-order bits lost by each
+// addition, so the result is also accurate to about one rounding.
+double Reduction::Dot(const double *x, size_t incx, const double *y,
+    size_t incy, size_t n) {
+  double sum = 0;
+  double compensation = 0;
+  for (size_t i = 0; i < n; ++i) {
+    double term = x[i * incx] * y[i * incy];
+    double total = sum + term;
+    if (fabs(sum) >= fabs(term)) {
+      compensation += (sum - total) + term;
+    } else {
+      compensation += (term - total) + sum;
+    }
+    sum = total;
+  }
+  return sum + compensation;
+}
+}
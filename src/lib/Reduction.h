@@ -0,0 +1,34 @@
+// Copyright 2011 Jason Marcell
+
+#ifndef SRC_LIB_REDUCTION_H_
+#define SRC_LIB_REDUCTION_H_
+
+#include <stddef.h>
+
+namespace jason {
+
+enum ReductionMode {
+  REDUCTION_FAST,          // BLAS and LAPACK-style library routines
+  REDUCTION_REPRODUCIBLE   // Fixed-order compensated sums, no BLAS
+};
+
+// How the library's dot products, matrix products, triangular solves and
+// factorizations accumulate.  The parallel loops already split work into
+// chunks that do not depend on the thread count, but BLAS kernels vary
+// with the library, its threading and the CPU it dispatches on.  In the
+// reproducible mode every such reduction instead runs through Dot(), whose
+// summation order is fixed, so results are bitwise identical for any
+// thread count and BLAS build.  Set the mode before training.
+class Reduction {
+  public:
+    static void SetMode(ReductionMode mode);
+    static ReductionMode Mode();
+    static bool Reproducible();
+    // sum_i x[i * incx] * y[i * incy], added in index order with
+    // Neumaier's compensation.
+    static double Dot(const double *x, size_t incx, const double *y,
+        size_t incy, size_t n);
+};
+}
+
+#endif  // SRC_LIB_REDUCTION_H_
@@ -0,0 +1,377 @@
+// Copyright 2011 Jason Marcell
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "lib/Scheduler.h"
+#include "lib/Log.h"
+
+#define DEQUE_INITIAL_CAPACITY 64
+
+// Thread controls of the threaded BLAS libraries, when one is linked in.
+extern "C" {
+void openblas_set_num_threads(int threads) __attribute__((weak));
+void MKL_Set_Num_Threads(int threads) __attribute__((weak));
+}
+
+namespace jason {
+
+namespace {
+
+struct Job {
+  const char *label;
+  RangeFunction range;
+  ReduceFunction reduce;  // Used instead of range when not NULL
+  void *arg;
+  size_t width;
+  double *partials;       // `width` per chunk, for reductions
+  size_t remaining;       // Chunks not finished yet
+};
+
+struct Task {
+  Job *job;
+  size_t chunk;
+  size_t begin;
+  size_t end;
+};
+
+// A ring buffer of tasks that grows when full.  The owner works at the
+// back, thieves at the front.
+struct WorkDeque {
+  pthread_mutex_t lock;
+  Task *tasks;
+  size_t capacity;
+  size_t head;
+  size_t count;
+};
+
+bool started = false;
+bool stopping = false;
+size_t pool_threads = 1;
+pthread_t *workers = NULL;
+WorkDeque *deques = NULL;
+size_t queued = 0;  // Tasks in all deques, to let idle workers sleep
+WorkerInit worker_init = NULL;
+TraceHook trace_hook = NULL;
+pthread_mutex_t start_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_mutex_t sleep_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t wake = PTHREAD_COND_INITIALIZER;
+__thread size_t current_worker = 0;  // Threads outside the pool share 0
+
+void PushBack(WorkDeque *deque, const Task &task) {
+  pthread_mutex_lock(&deque->lock);
+  if (deque->count == deque->capacity) {
+    size_t capacity = deque->capacity == 0 ? DEQUE_INITIAL_CAPACITY
+        : 2 * deque->capacity;
+    Task *tasks = new Task[capacity];
+    for (size_t i = 0; i < deque->count; ++i) {
+      tasks[i] = deque->tasks[(deque->head + i) % deque->capacity];
+    }
+    delete[] deque->tasks;
+    deque->tasks = tasks;
+    deque->capacity = capacity;
+    deque->head = 0;
+  }
+  deque->tasks[(deque->head + deque->count) % deque->capacity] = task;
+  deque->count++;
+  __sync_add_and_fetch(&queued, 1);
+  pthread_mutex_unlock(&deque->lock);
+}
+
+bool Pop(WorkDeque *deque, bool back, Task *task) {
+  if (__atomic_load_n(&deque->count, __ATOMIC_RELAXED) == 0) {
+    return false;
+  }
+  pthread_mutex_lock(&deque->lock);
+  bool found = deque->count > 0;
+  if (found) {
+    deque->count--;
+    if (back) {
+      *task = deque->tasks[(deque->head + deque->count) % deque->capacity];
+    } else {
+      *task = deque->tasks[deque->head];
+      deque->head = (deque->head + 1) % deque->capacity;
+    }
+    __sync_sub_and_fetch(&queued, 1);
+  }
+  pthread_mutex_unlock(&deque->lock);
+  return found;
+}
+
+bool FindTask(size_t worker, Task *task) {
+  if (Pop(&deques[worker], true, task)) {
+    return true;
+  }
+  for (size_t i = 1; i < pool_threads; ++i) {
+    if (Pop(&deques[(worker + i) % pool_threads], false, task)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+double Now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+void RunTask(const Task &task) {
+  Job *job = task.job;
+  TraceHook hook = trace_hook;
+  double start = hook != NULL ? Now() : 0;
+  if (job->reduce != NULL) {
+    job->reduce(task.begin, task.end, job->arg,
+        job->partials + task.chunk * job->width);
+  } else {
+    job->range(task.begin, task.end, job->arg);
+  }
+  if (hook != NULL) {
+    TraceEvent event = { job->label, current_worker, task.begin, task.end,
+        start, Now() };
+    hook(&event);
+  }
+  __sync_sub_and_fetch(&job->remaining, 1);
+}
+
+void *WorkerMain(void *arg) {
+  current_worker = reinterpret_cast<size_t>(arg);
+  if (worker_init != NULL) {
+    worker_init(current_worker, pool_threads);
+  }
+  Task task;
+  while (true) {
+    if (FindTask(current_worker, &task)) {
+      RunTask(task);
+      continue;
+    }
+    pthread_mutex_lock(&sleep_lock);
+    while (__atomic_load_n(&queued, __ATOMIC_ACQUIRE) == 0 && !stopping) {
+      pthread_cond_wait(&wake, &sleep_lock);
+    }
+    bool stop = stopping;
+    pthread_mutex_unlock(&sleep_lock);
+    if (stop) {
+      break;
+    }
+  }
+  return NULL;
+}
+
+// Queues the tasks, last first so that their owner runs them in order, then
+// helps with any queued work until the job is done.
+void Dispatch(Job *job, Task *tasks, size_t count, bool blocked) {
+  job->remaining = count;
+  if (pool_threads <= 1 || count <= 1) {
+    for (size_t i = 0; i < count; ++i) {
+      RunTask(tasks[i]);
+    }
+    return;
+  }
+  size_t self = current_worker;
+  for (size_t i = count; i-- > 0;) {
+    PushBack(&deques[blocked ? i : self], tasks[i]);
+  }
+  pthread_mutex_lock(&sleep_lock);
+  pthread_cond_broadcast(&wake);
+  pthread_mutex_unlock(&sleep_lock);
+  Task task;
+  while (__atomic_load_n(&job->remaining, __ATOMIC_ACQUIRE) > 0) {
+    if (FindTask(self, &task)) {
+      RunTask(task);
+    } else {
+      sched_yield();
+    }
+  }
+}
+
+size_t Chunks(size_t count, size_t grain) {
+  return (count + grain - 1) / grain;
+}
+
+Task *ChunkTasks(Job *job, size_t count, size_t grain) {
+  size_t chunks = Chunks(count, grain);
+  Task *tasks = new Task[chunks];
+  for (size_t c = 0; c < chunks; ++c) {
+    tasks[c].job = job;
+    tasks[c].chunk = c;
+    tasks[c].begin = c * grain;
+    tasks[c].end = c * grain + grain < count ? c * grain + grain : count;
+  }
+  return tasks;
+}
+
+Task *BlockTasks(Job *job, size_t count, size_t threads) {
+  Task *tasks = new Task[threads];
+  for (size_t t = 0; t < threads; ++t) {
+    tasks[t].job = job;
+    tasks[t].chunk = t;
+    tasks[t].begin = Scheduler::BlockBegin(count, t);
+    tasks[t].end = Scheduler::BlockBegin(count, t + 1);
+  }
+  return tasks;
+}
+}  // namespace
+
+void Scheduler::Configure(size_t threads, WorkerInit init) {
+  pthread_mutex_lock(&start_lock);
+  if (started) {
+    Stop();
+  }
+  Start(threads > 0 ? threads : OnlineCpus(), init);
+  pthread_mutex_unlock(&start_lock);
+}
+
+void Scheduler::EnsureStarted() {
+  if (__atomic_load_n(&started, __ATOMIC_ACQUIRE)) {
+    return;
+  }
+  pthread_mutex_lock(&start_lock);
+  if (!started) {
+    Start(OnlineCpus(), NULL);
+  }
+  pthread_mutex_unlock(&start_lock);
+}
+
+void Scheduler::Start(size_t threads, WorkerInit init) {
+  pool_threads = threads;
+  worker_init = init;
+  stopping = false;
+  deques = new WorkDeque[threads];
+  for (size_t t = 0; t < threads; ++t) {
+    pthread_mutex_init(&deques[t].lock, NULL);
+    deques[t].tasks = NULL;
+    deques[t].capacity = 0;
+    deques[t].head = 0;
+    deques[t].count = 0;
+  }
+  // The pool is the only source of parallelism, so a threaded BLAS must
+  // not start threads of its own inside the pool's tasks.
+  if (openblas_set_num_threads != NULL) {
+    openblas_set_num_threads(1);
+  }
+  if (MKL_Set_Num_Threads != NULL) {
+    MKL_Set_Num_Threads(1);
+  }
+  current_worker = 0;
+  if (init != NULL) {
+    init(0, threads);
+  }
+  workers = new pthread_t[threads];
+  for (size_t t = 1; t < threads; ++t) {
+    pthread_create(&workers[t], NULL, WorkerMain, reinterpret_cast<void*>(t));
+  }
+  __atomic_store_n(&started, true, __ATOMIC_RELEASE);
+  LOG(VERBOSE, "Scheduler: %zu threads.\n", threads);
+}
+
+void Scheduler::Stop() {
+  pthread_mutex_lock(&sleep_lock);
+  stopping = true;
+  pthread_cond_broadcast(&wake);
+  pthread_mutex_unlock(&sleep_lock);
+  for (size_t t = 1; t < pool_threads; ++t) {
+    pthread_join(workers[t], NULL);
+  }
+  for (size_t t = 0; t < pool_threads; ++t) {
+    pthread_mutex_destroy(&deques[t].lock);
+    delete[] deques[t].tasks;
+  }
+  delete[] deques;
+  delete[] workers;
+  deques = NULL;
+  workers = NULL;
+  __atomic_store_n(&started, false, __ATOMIC_RELEASE);
+}
+
+size_t Scheduler::Threads() {
+  EnsureStarted();
+  return pool_threads;
+}
+
+size_t Scheduler::OnlineCpus() {
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  return cpus > 0 ? cpus : 1;
+}
+
+size_t Scheduler::BlockBegin(size_t count, size_t block) {
+  return count * block / Threads();
+}
+
+void Scheduler::SetTraceHook(TraceHook hook) {
+  trace_hook = hook;
+}
+
+void Scheduler::ParallelFor(const char *label, size_t count, size_t grain,
+    RangeFunction function, void *arg) {
+  if (count == 0) {
+    return;
+  }
+  EnsureStarted();
+  grain = grain > 0 ? grain : 1;
+  Job job = { label, function, NULL, arg, 0, NULL, 0 };
+  Task *tasks = ChunkTasks(&job, count, grain);
+  Dispatch(&job, tasks, Chunks(count, grain), false);
+  delete[] tasks;
+}
+
+void Scheduler::ParallelBlocks(const char *label, size_t count,
+    RangeFunction function, void *arg) {
+  if (count == 0) {
+    return;
+  }
+  size_t threads = Threads();
+  Job job = { label, function, NULL, arg, 0, NULL, 0 };
+  Task *tasks = BlockTasks(&job, count, threads);
+  Dispatch(&job, tasks, threads, true);
+  delete[] tasks;
+}
+
+void Scheduler::ParallelReduce(const char *label, size_t count, size_t grain,
+    size_t width, ReduceFunction function, void *arg, double *result) {
+  memset(result, 0, width * sizeof(double));
+  if (count == 0) {
+    return;
+  }
+  EnsureStarted();
+  grain = grain > 0 ? grain : 1;
+  size_t chunks = Chunks(count, grain);
+  double *partials = new double[chunks * width];
+  memset(partials, 0, chunks * width * sizeof(double));
+  Job job = { label, NULL, function, arg, width, partials, 0 };
+  Task *tasks = ChunkTasks(&job, count, grain);
+  Dispatch(&job, tasks, chunks, false);
+  for (size_t c = 0; c < chunks; ++c) {
+    for (size_t i = 0; i < width; ++i) {
+      result[i] += partials[c * width + i];
+    }
+  }
+  delete[] tasks;
+  delete[] partials;
+}
+
+void Scheduler::ReduceBlocks(const char *label, size_t count, size_t width,
+    ReduceFunction function, void *arg, double *result) {
+  memset(result, 0, width * sizeof(double));
+  if (count == 0) {
+    return;
+  }
+  size_t threads = Threads();
+  double *partials = new double[threads * width];
+  memset(partials, 0, threads * width * sizeof(double));
+  Job job = { label, NULL, function, arg, width, partials, 0 };
+  Task *tasks = BlockTasks(&job, count, threads);
+  Dispatch(&job, tasks, threads, true);
+  for (size_t t = 0; t < threads; ++t) {
+    for (size_t i = 0; i < width; ++i) {
+      result[i] += partials[t * width + i];
+    }
+  }
+  delete[] tasks;
+  delete[] partials;
+}
+}
@@ -0,0 +1,74 @@
+// Copyright 2011 Jason Marcell
+
+#ifndef SRC_LIB_SCHEDULER_H_
+#define SRC_LIB_SCHEDULER_H_
+
+#include <stddef.h>
+
+namespace jason {
+
+typedef void (*RangeFunction)(size_t begin, size_t end, void *arg);
+// Accumulates [begin, end) into `partial`, which starts zeroed.
+typedef void (*ReduceFunction)(size_t begin, size_t end, void *arg,
+    double *partial);
+typedef void (*WorkerInit)(size_t worker, size_t threads);
+
+struct TraceEvent {
+  const char *label;  // Name of the parallel loop
+  size_t worker;      // 0 for the calling thread
+  size_t begin;
+  size_t end;
+  double start;       // Seconds, CLOCK_MONOTONIC
+  double finish;
+};
+
+typedef void (*TraceHook)(const TraceEvent *event);
+
+// The process-wide work-stealing pool behind every parallel loop in the
+// library.  Each worker owns a deque of chunks: it takes its own newest
+// chunk first and steals the oldest chunk of another worker when it runs
+// out.  The thread that starts a loop works on it too, so loops may nest
+// (an ensemble model's UpdateW inside the ensemble loop) without blocking
+// a worker or exceeding the thread budget.  BLAS is limited to one thread
+// because the pool is the only source of parallelism; Matrix splits large
+// products into row panels instead.
+class Scheduler {
+  public:
+    // Restarts the pool with `threads` threads, counting the caller; 0
+    // uses every online CPU.  `init`, if not NULL, runs first on each
+    // worker and on the calling thread as worker 0, and must not use the
+    // scheduler.  No loop may be
+    // running.  Without a call the pool starts on first use with every
+    // online CPU.
+    static void Configure(size_t threads, WorkerInit init);
+    static size_t Threads();
+    static size_t OnlineCpus();
+    // Calls function(begin, end, arg) on chunks of at most `grain`
+    // elements covering [0, count), and returns when all are done.
+    static void ParallelFor(const char *label, size_t count, size_t grain,
+        RangeFunction function, void *arg);
+    // One chunk per thread, [BlockBegin(count, t), BlockBegin(count, t + 1))
+    // queued on thread t, for loops whose rows were placed with Numa.
+    // Idle threads still steal blocks.
+    static void ParallelBlocks(const char *label, size_t count,
+        RangeFunction function, void *arg);
+    // Sums the `width` partials of each `grain` chunk into result, adding
+    // them in chunk order, so the result depends on `grain` but not on the
+    // number of threads or the schedule.
+    static void ParallelReduce(const char *label, size_t count, size_t grain,
+        size_t width, ReduceFunction function, void *arg, double *result);
+    // ParallelReduce over the blocks of ParallelBlocks(), so the result
+    // depends on the number of threads.
+    static void ReduceBlocks(const char *label, size_t count, size_t width,
+        ReduceFunction function, void *arg, double *result);
+    static size_t BlockBegin(size_t count, size_t block);
+    // Called after every chunk from the thread that ran it, or NULL.
+    static void SetTraceHook(TraceHook hook);
+  private:
+    static void EnsureStarted();
+    static void Start(size_t threads, WorkerInit init);
+    static void Stop();
+};
+}
+
+#endif  // SRC_LIB_SCHEDULER_H_
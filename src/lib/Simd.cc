@@ -0,0 +1,605 @@
+// Copyright 2011 Jason Marcell
+
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SIMD_X86
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+#include "lib/Simd.h"
+#include "lib/Reduction.h"
+
+#ifdef SIMD_X86
+#define TARGET_SSE42 __attribute__((target("sse4.2")))
+#define TARGET_AVX2 __attribute__((target("avx2,fma")))
+#define TARGET_AVX512 __attribute__((target("avx512f")))
+// The interpolation keeps every multiply and add separate, as the scalar
+// code does, so that all levels give the same bits: no FMA for AVX2, and
+// no contraction of AVX-512F's multiplies and adds into its FMAs.
+#define TARGET_AVX2_NO_FMA __attribute__((target("avx2")))
+#define TARGET_AVX512_NO_FMA __attribute__((target("avx512f"), \
+    optimize("fp-contract=off")))
+// GCC 12 reports the deliberately undefined vectors inside its own
+// intrinsic headers as uninitialized once they are inlined.
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+
+namespace jason {
+
+namespace {
+
+struct Kernels {
+  double (*dot)(const double *x, const double *y, size_t n);
+  double (*squared_distance)(const double *x, const double *y, size_t n);
+  void (*interpolate)(const HermiteTable *table, const double *x,
+      double *out, size_t n);
+  int32_t (*dot_int8)(const int8_t *a, const int8_t *b, size_t n);
+  float (*dot_half)(const uint16_t *a, const float *b, size_t n);
+};
+
+double DotScalar(const double *x, const double *y, size_t n) {
+  double sum = 0;
+  for (size_t i = 0; i < n; ++i) {
+    sum += x[i] * y[i];
+  }
+  return sum;
+}
+
+double SquaredDistanceScalar(const double *x, const double *y, size_t n) {
+  double sum = 0;
+  for (size_t i = 0; i < n; ++i) {
+    double diff = x[i] - y[i];
+    sum += diff * diff;
+  }
+  return sum;
+}
+
+// Moves the half's exponent and mantissa into float position and rebiases
+// the exponent with one multiply, which also covers subnormals.  The
+// vector versions do the same per lane.
+float HalfToFloatScalar(uint16_t half) {
+  uint32_t bits = static_cast<uint32_t>(half & 0x7fff) << 13;
+  float magnitude;
+  memcpy(&magnitude, &bits, sizeof(bits));
+  magnitude *= 5.192296858534828e+33f;  // 2^112
+  return (half & 0x8000) ? -magnitude : magnitude;
+}
+
+int32_t DotInt8Scalar(const int8_t *a, const int8_t *b, size_t n) {
+  int32_t sum = 0;
+  for (size_t i = 0; i < n; ++i) {
+    sum += static_cast<int32_t>(a[i]) * b[i];
+  }
+  return sum;
+}
+
+float DotHalfScalar(const uint16_t *a, const float *b, size_t n) {
+  float sum = 0;
+  for (size_t i = 0; i < n; ++i) {
+    sum += HalfToFloatScalar(a[i]) * b[i];
+  }
+  return sum;
+}
+
+// The same operations in the same order as NormalCdfTable::P().
+void InterpolateRange(const HermiteTable *table, const double *x,
+    double *out, size_t begin, size_t end) {
+  for (size_t k = begin; k < end; ++k) {
+    if (x[k] <= table->lower || x[k] >= table->upper) {
+      out[k] = table->tail(x[k]);
+      continue;
+    }
+    double pos = (x[k] - table->lower) * table->inv_step;
+    size_t i = static_cast<size_t>(pos);
+    if (i >= table->nodes - 1) i = table->nodes - 2;
+    double t = pos - i;
+    double t2 = t * t;
+    double t3 = t2 * t;
+    double h00 = 2 * t3 - 3 * t2 + 1;
+    double h10 = t3 - 2 * t2 + t;
+    double h01 = -2 * t3 + 3 * t2;
+    double h11 = t3 - t2;
+    out[k] = h00 * table->values[i] + h10 * table->slopes[i]
+        + h01 * table->values[i + 1] + h11 * table->slopes[i + 1];
+  }
+}
+
+void InterpolateScalar(const HermiteTable *table, const double *x,
+    double *out, size_t n) {
+  InterpolateRange(table, x, out, 0, n);
+}
+
+// Replaces the first n outputs whose points lie outside the table.
+void InterpolateTails(const HermiteTable *table, const double *x,
+    double *out, size_t n) {
+  for (size_t k = 0; k < n; ++k) {
+    if (x[k] <= table->lower || x[k] >= table->upper) {
+      out[k] = table->tail(x[k]);
+    }
+  }
+}
+
+const Kernels kScalar = { DotScalar, SquaredDistanceScalar,
+  InterpolateScalar, DotInt8Scalar, DotHalfScalar };
+
+#ifdef SIMD_X86
+// Unoptimized builds get no automatic VZEROUPPER, and the legacy SSE code
+// the default build runs elsewhere stalls on dirty upper halves of the
+// AVX registers, so the AVX functions clear them before they return or
+// call scalar code.
+//
+// The vector interpolations clamp the grid position to the last interval
+// before converting it, which picks the same interval as the scalar code
+// for every x inside the range and keeps the gathers in bounds outside it.
+// Whether any lane fell outside is tracked, and only then does a scalar
+// pass replace those lanes with the table's tail function.
+
+TARGET_SSE42 double DotSse42(const double *x, const double *y, size_t n) {
+  __m128d acc = _mm_setzero_pd();
+  size_t i = 0;
+  for (; i + 2 <= n; i += 2) {
+    acc = _mm_add_pd(acc, _mm_mul_pd(_mm_loadu_pd(x + i),
+        _mm_loadu_pd(y + i)));
+  }
+  double lanes[2];
+  _mm_storeu_pd(lanes, acc);
+  double sum = lanes[0] + lanes[1];
+  if (i < n) {
+    sum += x[i] * y[i];
+  }
+  return sum;
+}
+
+TARGET_SSE42 double SquaredDistanceSse42(const double *x, const double *y,
+    size_t n) {
+  __m128d acc = _mm_setzero_pd();
+  size_t i = 0;
+  for (; i + 2 <= n; i += 2) {
+    __m128d diff = _mm_sub_pd(_mm_loadu_pd(x + i), _mm_loadu_pd(y + i));
+    acc = _mm_add_pd(acc, _mm_mul_pd(diff, diff));
+  }
+  double lanes[2];
+  _mm_storeu_pd(lanes, acc);
+  double sum = lanes[0] + lanes[1];
+  if (i < n) {
+    double diff = x[i] - y[i];
+    sum += diff * diff;
+  }
+  return sum;
+}
+
+TARGET_AVX2 double DotAvx2(const double *x, const double *y, size_t n) {
+  __m256d acc = _mm256_setzero_pd();
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    acc = _mm256_fmadd_pd(_mm256_loadu_pd(x + i), _mm256_loadu_pd(y + i),
+        acc);
+  }
+  double lanes[4];
+  _mm256_storeu_pd(lanes, acc);
+  _mm256_zeroupper();
+  double sum = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+  for (; i < n; ++i) {
+    sum += x[i] * y[i];
+  }
+  return sum;
+}
+
+TARGET_AVX2 double SquaredDistanceAvx2(const double *x, const double *y,
+    size_t n) {
+  __m256d acc = _mm256_setzero_pd();
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m256d diff = _mm256_sub_pd(_mm256_loadu_pd(x + i),
+        _mm256_loadu_pd(y + i));
+    acc = _mm256_fmadd_pd(diff, diff, acc);
+  }
+  double lanes[4];
+  _mm256_storeu_pd(lanes, acc);
+  _mm256_zeroupper();
+  double sum = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+  for (; i < n; ++i) {
+    double diff = x[i] - y[i];
+    sum += diff * diff;
+  }
+  return sum;
+}
+
+TARGET_AVX2_NO_FMA void InterpolateAvx2(const HermiteTable *table,
+    const double *x, double *out, size_t n) {
+  const __m256d lower = _mm256_set1_pd(table->lower);
+  const __m256d upper = _mm256_set1_pd(table->upper);
+  const __m256d inv_step = _mm256_set1_pd(table->inv_step);
+  const __m256d last = _mm256_set1_pd(static_cast<double>(table->nodes - 2));
+  const __m256d zero = _mm256_setzero_pd();
+  const __m256d one = _mm256_set1_pd(1.0);
+  const __m256d two = _mm256_set1_pd(2.0);
+  const __m256d three = _mm256_set1_pd(3.0);
+  const __m256d minus_two = _mm256_set1_pd(-2.0);
+  __m256d outside = zero;
+  size_t k = 0;
+  for (; k + 4 <= n; k += 4) {
+    __m256d xv = _mm256_loadu_pd(x + k);
+    __m256d pos = _mm256_mul_pd(_mm256_sub_pd(xv, lower), inv_step);
+    __m128i index = _mm256_cvttpd_epi32(_mm256_min_pd(
+        _mm256_max_pd(pos, zero), last));
+    __m256d t = _mm256_sub_pd(pos, _mm256_cvtepi32_pd(index));
+    __m256d t2 = _mm256_mul_pd(t, t);
+    __m256d t3 = _mm256_mul_pd(t2, t);
+    __m256d h00 = _mm256_add_pd(_mm256_sub_pd(_mm256_mul_pd(two, t3),
+        _mm256_mul_pd(three, t2)), one);
+    __m256d h10 = _mm256_add_pd(_mm256_sub_pd(t3, _mm256_mul_pd(two, t2)),
+        t);
+    __m256d h01 = _mm256_add_pd(_mm256_mul_pd(minus_two, t3),
+        _mm256_mul_pd(three, t2));
+    __m256d h11 = _mm256_sub_pd(t3, t2);
+    __m256d v0 = _mm256_i32gather_pd(table->values, index, 8);
+    __m256d s0 = _mm256_i32gather_pd(table->slopes, index, 8);
+    __m256d v1 = _mm256_i32gather_pd(table->values + 1, index, 8);
+    __m256d s1 = _mm256_i32gather_pd(table->slopes + 1, index, 8);
+    __m256d result = _mm256_add_pd(_mm256_add_pd(_mm256_add_pd(
+        _mm256_mul_pd(h00, v0), _mm256_mul_pd(h10, s0)),
+        _mm256_mul_pd(h01, v1)), _mm256_mul_pd(h11, s1));
+    outside = _mm256_or_pd(outside, _mm256_or_pd(
+        _mm256_cmp_pd(xv, lower, _CMP_LE_OQ),
+        _mm256_cmp_pd(xv, upper, _CMP_GE_OQ)));
+    _mm256_storeu_pd(out + k, result);
+  }
+  bool tails = _mm256_movemask_pd(outside) != 0;
+  _mm256_zeroupper();
+  if (tails) {
+    InterpolateTails(table, x, out, k);
+  }
+  InterpolateRange(table, x, out, k, n);
+}
+
+// The last partial vector is loaded under a mask, so even a handful of
+// features takes a single pass.
+TARGET_AVX512 double DotAvx512(const double *x, const double *y,
+    size_t n) {
+  __m512d acc = _mm512_setzero_pd();
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    acc = _mm512_fmadd_pd(_mm512_loadu_pd(x + i), _mm512_loadu_pd(y + i),
+        acc);
+  }
+  if (i < n) {
+    __mmask8 mask = static_cast<__mmask8>((1u << (n - i)) - 1);
+    acc = _mm512_fmadd_pd(_mm512_maskz_loadu_pd(mask, x + i),
+        _mm512_maskz_loadu_pd(mask, y + i), acc);
+  }
+  double sum = _mm512_reduce_add_pd(acc);
+  _mm256_zeroupper();
+  return sum;
+}
+
+TARGET_AVX512 double SquaredDistanceAvx512(const double *x,
+    const double *y, size_t n) {
+  __m512d acc = _mm512_setzero_pd();
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m512d diff = _mm512_sub_pd(_mm512_loadu_pd(x + i),
+        _mm512_loadu_pd(y + i));
+    acc = _mm512_fmadd_pd(diff, diff, acc);
+  }
+  if (i < n) {
+    __mmask8 mask = static_cast<__mmask8>((1u << (n - i)) - 1);
+    __m512d diff = _mm512_sub_pd(_mm512_maskz_loadu_pd(mask, x + i),
+        _mm512_maskz_loadu_pd(mask, y + i));
+    acc = _mm512_fmadd_pd(diff, diff, acc);
+  }
+  double sum = _mm512_reduce_add_pd(acc);
+  _mm256_zeroupper();
+  return sum;
+}
+
+TARGET_AVX512_NO_FMA void InterpolateAvx512(const HermiteTable *table,
+    const double *x, double *out, size_t n) {
+  const __m512d lower = _mm512_set1_pd(table->lower);
+  const __m512d upper = _mm512_set1_pd(table->upper);
+  const __m512d inv_step = _mm512_set1_pd(table->inv_step);
+  const __m512d last = _mm512_set1_pd(static_cast<double>(table->nodes - 2));
+  const __m512d zero = _mm512_setzero_pd();
+  const __m512d one = _mm512_set1_pd(1.0);
+  const __m512d two = _mm512_set1_pd(2.0);
+  const __m512d three = _mm512_set1_pd(3.0);
+  const __m512d minus_two = _mm512_set1_pd(-2.0);
+  __mmask8 outside = 0;
+  size_t k = 0;
+  for (; k + 8 <= n; k += 8) {
+    __m512d xv = _mm512_loadu_pd(x + k);
+    __m512d pos = _mm512_mul_pd(_mm512_sub_pd(xv, lower), inv_step);
+    __m256i index = _mm512_cvttpd_epi32(_mm512_min_pd(
+        _mm512_max_pd(pos, zero), last));
+    __m512d t = _mm512_sub_pd(pos, _mm512_cvtepi32_pd(index));
+    __m512d t2 = _mm512_mul_pd(t, t);
+    __m512d t3 = _mm512_mul_pd(t2, t);
+    __m512d h00 = _mm512_add_pd(_mm512_sub_pd(_mm512_mul_pd(two, t3),
+        _mm512_mul_pd(three, t2)), one);
+    __m512d h10 = _mm512_add_pd(_mm512_sub_pd(t3, _mm512_mul_pd(two, t2)),
+        t);
+    __m512d h01 = _mm512_add_pd(_mm512_mul_pd(minus_two, t3),
+        _mm512_mul_pd(three, t2));
+    __m512d h11 = _mm512_sub_pd(t3, t2);
+    __m512d v0 = _mm512_i32gather_pd(index, table->values, 8);
+    __m512d s0 = _mm512_i32gather_pd(index, table->slopes, 8);
+    __m512d v1 = _mm512_i32gather_pd(index, table->values + 1, 8);
+    __m512d s1 = _mm512_i32gather_pd(index, table->slopes + 1, 8);
+    __m512d result = _mm512_add_pd(_mm512_add_pd(_mm512_add_pd(
+        _mm512_mul_pd(h00, v0), _mm512_mul_pd(h10, s0)),
+        _mm512_mul_pd(h01, v1)), _mm512_mul_pd(h11, s1));
+    outside |= _mm512_cmp_pd_mask(xv, lower, _CMP_LE_OQ)
+        | _mm512_cmp_pd_mask(xv, upper, _CMP_GE_OQ);
+    _mm512_storeu_pd(out + k, result);
+  }
+  _mm256_zeroupper();
+  if (outside) {
+    InterpolateTails(table, x, out, k);
+  }
+  InterpolateRange(table, x, out, k, n);
+}
+
+// The quantized dot products widen int8s to 16 bits and multiply-add pairs
+// of them into 32-bit sums, or convert halves to floats per lane.  Rows
+// are padded to 16 int8s or 8 halves, so only AVX-512's halves, 16 per
+// step, can leave a remainder, of 8.
+
+TARGET_SSE42 int32_t DotInt8Sse42(const int8_t *a, const int8_t *b,
+    size_t n) {
+  __m128i zero = _mm_setzero_si128();
+  __m128i sum = zero;
+  for (size_t i = 0; i < n; i += 16) {
+    __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i));
+    __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i));
+    __m128i sa = _mm_cmpgt_epi8(zero, va);
+    __m128i sb = _mm_cmpgt_epi8(zero, vb);
+    sum = _mm_add_epi32(sum, _mm_madd_epi16(_mm_unpacklo_epi8(va, sa),
+        _mm_unpacklo_epi8(vb, sb)));
+    sum = _mm_add_epi32(sum, _mm_madd_epi16(_mm_unpackhi_epi8(va, sa),
+        _mm_unpackhi_epi8(vb, sb)));
+  }
+  sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(1, 0, 3, 2)));
+  sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(2, 3, 0, 1)));
+  return _mm_cvtsi128_si32(sum);
+}
+
+TARGET_SSE42 inline __m128 HalfToFloat4(__m128i halves) {
+  __m128i sign = _mm_slli_epi32(
+      _mm_and_si128(halves, _mm_set1_epi32(0x8000)), 16);
+  __m128i bits = _mm_slli_epi32(
+      _mm_and_si128(halves, _mm_set1_epi32(0x7fff)), 13);
+  __m128 magnitude = _mm_mul_ps(_mm_castsi128_ps(bits),
+      _mm_castsi128_ps(_mm_set1_epi32(0x77800000)));  // 2^112
+  return _mm_or_ps(magnitude, _mm_castsi128_ps(sign));
+}
+
+TARGET_SSE42 float DotHalfSse42(const uint16_t *a, const float *b,
+    size_t n) {
+  __m128i zero = _mm_setzero_si128();
+  __m128 sum = _mm_setzero_ps();
+  for (size_t i = 0; i < n; i += 8) {
+    __m128i halves = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i));
+    sum = _mm_add_ps(sum, _mm_mul_ps(
+        HalfToFloat4(_mm_unpacklo_epi16(halves, zero)), _mm_loadu_ps(b + i)));
+    sum = _mm_add_ps(sum, _mm_mul_ps(
+        HalfToFloat4(_mm_unpackhi_epi16(halves, zero)),
+        _mm_loadu_ps(b + i + 4)));
+  }
+  float lanes[4];
+  _mm_storeu_ps(lanes, sum);
+  return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+}
+
+TARGET_AVX2 int32_t DotInt8Avx2(const int8_t *a, const int8_t *b,
+    size_t n) {
+  __m256i sum = _mm256_setzero_si256();
+  for (size_t i = 0; i < n; i += 16) {
+    __m256i va = _mm256_cvtepi8_epi16(
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i)));
+    __m256i vb = _mm256_cvtepi8_epi16(
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i)));
+    sum = _mm256_add_epi32(sum, _mm256_madd_epi16(va, vb));
+  }
+  __m128i half = _mm_add_epi32(_mm256_castsi256_si128(sum),
+      _mm256_extracti128_si256(sum, 1));
+  half = _mm_add_epi32(half, _mm_shuffle_epi32(half, _MM_SHUFFLE(1, 0, 3, 2)));
+  half = _mm_add_epi32(half, _mm_shuffle_epi32(half, _MM_SHUFFLE(2, 3, 0, 1)));
+  int32_t result = _mm_cvtsi128_si32(half);
+  _mm256_zeroupper();
+  return result;
+}
+
+TARGET_AVX2_NO_FMA inline __m256 HalfToFloat8(__m128i halves) {
+  __m256i wide = _mm256_cvtepu16_epi32(halves);
+  __m256i sign = _mm256_slli_epi32(
+      _mm256_and_si256(wide, _mm256_set1_epi32(0x8000)), 16);
+  __m256i bits = _mm256_slli_epi32(
+      _mm256_and_si256(wide, _mm256_set1_epi32(0x7fff)), 13);
+  __m256 magnitude = _mm256_mul_ps(_mm256_castsi256_ps(bits),
+      _mm256_castsi256_ps(_mm256_set1_epi32(0x77800000)));  // 2^112
+  return _mm256_or_ps(magnitude, _mm256_castsi256_ps(sign));
+}
+
+TARGET_AVX2 float DotHalfAvx2(const uint16_t *a, const float *b, size_t n) {
+  __m256 sum = _mm256_setzero_ps();
+  for (size_t i = 0; i < n; i += 8) {
+    sum = _mm256_fmadd_ps(HalfToFloat8(
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i))),
+        _mm256_loadu_ps(b + i), sum);
+  }
+  float lanes[8];
+  _mm256_storeu_ps(lanes, sum);
+  _mm256_zeroupper();
+  return ((lanes[0] + lanes[1]) + (lanes[2] + lanes[3]))
+      + ((lanes[4] + lanes[5]) + (lanes[6] + lanes[7]));
+}
+
+TARGET_AVX512 int32_t DotInt8Avx512(const int8_t *a, const int8_t *b,
+    size_t n) {
+  __m512i sum = _mm512_setzero_si512();
+  for (size_t i = 0; i < n; i += 16) {
+    __m512i va = _mm512_cvtepi8_epi32(
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i)));
+    __m512i vb = _mm512_cvtepi8_epi32(
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i)));
+    sum = _mm512_add_epi32(sum, _mm512_mullo_epi32(va, vb));
+  }
+  int32_t result = _mm512_reduce_add_epi32(sum);
+  _mm256_zeroupper();
+  return result;
+}
+
+TARGET_AVX512 inline __m512 HalfToFloat16(__m256i halves) {
+  __m512i wide = _mm512_cvtepu16_epi32(halves);
+  __m512i sign = _mm512_slli_epi32(
+      _mm512_and_si512(wide, _mm512_set1_epi32(0x8000)), 16);
+  __m512i bits = _mm512_slli_epi32(
+      _mm512_and_si512(wide, _mm512_set1_epi32(0x7fff)), 13);
+  __m512 magnitude = _mm512_mul_ps(_mm512_castsi512_ps(bits),
+      _mm512_castsi512_ps(_mm512_set1_epi32(0x77800000)));  // 2^112
+  return _mm512_castsi512_ps(_mm512_or_si512(_mm512_castps_si512(magnitude),
+      sign));
+}
+
+TARGET_AVX512 float DotHalfAvx512(const uint16_t *a, const float *b,
+    size_t n) {
+  __m512 sum = _mm512_setzero_ps();
+  size_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    sum = _mm512_fmadd_ps(HalfToFloat16(
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i))),
+        _mm512_loadu_ps(b + i), sum);
+  }
+  if (i < n) {
+    __m256i halves = _mm256_inserti128_si256(_mm256_setzero_si256(),
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i)), 0);
+    sum = _mm512_fmadd_ps(HalfToFloat16(halves),
+        _mm512_maskz_loadu_ps(0xff, b + i), sum);
+  }
+  float result = _mm512_reduce_add_ps(sum);
+  _mm256_zeroupper();
+  return result;
+}
+
+// Without gathers, two lanes of interpolation do not beat the scalar code.
+const Kernels kSse42 = { DotSse42, SquaredDistanceSse42, InterpolateScalar,
+  DotInt8Sse42, DotHalfSse42 };
+const Kernels kAvx2 = { DotAvx2, SquaredDistanceAvx2, InterpolateAvx2,
+  DotInt8Avx2, DotHalfAvx2 };
+const Kernels kAvx512 = { DotAvx512, SquaredDistanceAvx512,
+  InterpolateAvx512, DotInt8Avx512, DotHalfAvx512 };
+
+// XCR0, the register states the operating system saves on a context
+// switch.  Needs OSXSAVE.
+uint64_t ReadXcr0() {
+  uint32_t eax, edx;
+  __asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+  return (static_cast<uint64_t>(edx) << 32) | eax;
+}
+#endif
+
+const Kernels *KernelsFor(SimdLevel level) {
+#ifdef SIMD_X86
+  switch (level) {
+    case SIMD_SSE42:
+      return &kSse42;
+    case SIMD_AVX2:
+      return &kAvx2;
+    case SIMD_AVX512:
+      return &kAvx512;
+    default:
+      break;
+  }
+#endif
+  return &kScalar;
+}
+
+SimdLevel simd_level = Simd::Detect();
+const Kernels *simd_kernels = KernelsFor(simd_level);
+
+// The kernels to run: the scalar ones in the reproducible mode.
+inline const Kernels *Active() {
+  return Reduction::Reproducible() ? &kScalar : simd_kernels;
+}
+}  // namespace
+
+// AVX and AVX-512 also need the operating system to save the wider
+// registers, which XCR0 reports.
+SimdLevel Simd::Detect() {
+#ifdef SIMD_X86
+  unsigned int eax, ebx, ecx, edx;
+  if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+    return SIMD_SCALAR;
+  }
+  bool sse42 = (ecx & bit_SSE4_2) != 0;
+  bool fma = (ecx & bit_FMA) != 0;
+  uint64_t xcr0 = (ecx & bit_OSXSAVE) != 0 ? ReadXcr0() : 0;
+  bool ymm = (xcr0 & 0x6) == 0x6;     // SSE and AVX state
+  bool zmm = (xcr0 & 0xe6) == 0xe6;   // Plus the opmask and upper ZMM state
+  bool avx2 = false, avx512 = false;
+  if (__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx)) {
+    avx2 = (ebx & bit_AVX2) != 0;
+    avx512 = (ebx & bit_AVX512F) != 0;
+  }
+  if (avx512 && zmm) {
+    return SIMD_AVX512;
+  } else if (avx2 && fma && ymm) {
+    return SIMD_AVX2;
+  } else if (sse42) {
+    return SIMD_SSE42;
+  }
+#endif
+  return SIMD_SCALAR;
+}
+
+void Simd::Select(SimdLevel level) {
+  simd_level = level;
+  simd_kernels = KernelsFor(level);
+}
+
+SimdLevel Simd::Level() {
+  return Reduction::Reproducible() ? SIMD_SCALAR : simd_level;
+}
+
+const char *Simd::Name(SimdLevel level) {
+  switch (level) {
+    case SIMD_SSE42:
+      return "SSE4.2";
+    case SIMD_AVX2:
+      return "AVX2";
+    case SIMD_AVX512:
+      return "AVX512";
+    default:
+      return "SCALAR";
+  }
+}
+
+double Simd::Dot(const double *x, const double *y, size_t n) {
+  return Active()->dot(x, y, n);
+}
+
+double Simd::SquaredDistance(const double *x, const double *y, size_t n) {
+  return Active()->squared_distance(x, y, n);
+}
+
+void Simd::Interpolate(const HermiteTable *table, const double *x,
+    double *out, size_t n) {
+  Active()->interpolate(table, x, out, n);
+}
+
+int32_t Simd::DotInt8(const int8_t *a, const int8_t *b, size_t n) {
+  return Active()->dot_int8(a, b, n);
+}
+
+float Simd::DotHalf(const uint16_t *a, const float *b, size_t n) {
+  return Active()->dot_half(a, b, n);
+}
+
+float Simd::HalfToFloat(uint16_t half) {
+  return HalfToFloatScalar(half);
+}
+}
@@ -0,0 +1,63 @@
+// Copyright 2011 Jason Marcell
+
+#ifndef SRC_LIB_SIMD_H_
+#define SRC_LIB_SIMD_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace jason {
+
+enum SimdLevel {
+  SIMD_SCALAR,  // Plain C++, the only level off x86
+  SIMD_SSE42,   // Two doubles per instruction
+  SIMD_AVX2,    // Four, with FMA and gathers
+  SIMD_AVX512   // Eight (AVX-512F)
+};
+
+// A uniform-grid cubic Hermite table, as NormalCdfTable keeps it.
+struct HermiteTable {
+  double lower;
+  double upper;
+  double inv_step;
+  size_t nodes;
+  const double *values;
+  const double *slopes;  // Derivatives times the grid step
+  double (*tail)(double x);  // The function itself outside [lower, upper]
+};
+
+// Hot inner loops compiled once per x86 ISA level, so the default build
+// (no -march) still uses the vector units of whatever CPU it runs on.  The
+// best level the CPU and operating system support is found through CPUID
+// at startup; Select() overrides it, e.g. to compare levels.  In the
+// reproducible reduction mode every kernel runs at SIMD_SCALAR, so its
+// results do not depend on the CPU either.
+class Simd {
+  public:
+    static SimdLevel Detect();
+    // Must not exceed Detect().  Call before any parallel loop starts.
+    static void Select(SimdLevel level);
+    // The level the kernels run at.
+    static SimdLevel Level();
+    static const char *Name(SimdLevel level);
+    // sum_i x[i] y[i].  The summation order depends on the level.
+    static double Dot(const double *x, const double *y, size_t n);
+    // sum_i (x[i] - y[i])^2.  The summation order depends on the level.
+    static double SquaredDistance(const double *x, const double *y,
+        size_t n);
+    // sum_i a[i] b[i] for n a multiple of 16.  Exact at every level.
+    static int32_t DotInt8(const int8_t *a, const int8_t *b, size_t n);
+    // sum_i HalfToFloat(a[i]) b[i] for n a multiple of 8, with the halves
+    // finite.  The summation order depends on the level.
+    static float DotHalf(const uint16_t *a, const float *b, size_t n);
+    // An IEEE half, finite, as a float.
+    static float HalfToFloat(uint16_t half);
+    // out[i] = the table's interpolant at x[i], or table->tail(x[i])
+    // outside its range.  Bitwise identical to the scalar evaluation at
+    // every level.
+    static void Interpolate(const HermiteTable *table, const double *x,
+        double *out, size_t n);
+};
+}
+
+#endif  // SRC_LIB_SIMD_H_
@@ -2,13 +2,23 @@
 
 #include <math.h>
 
+#include <algorithm>
+#include <utility>
+
 #include "lib/RandomNumberGenerator.h"
 #include "lib/Trainer.h"
 #include "lib/LinearKernel.h"
+#include "lib/KMeans.h"
 #include "lib/Log.h"
+#include "lib/Scheduler.h"
 
 #define EPSILON 0.001
 #define MAX_ITER 100
+#define MONTE_CARLO_SAMPLES 1000
+#define UPDATE_Y_GRAIN 32  // Samples per UpdateY task, each with its own draws
+#define READMIT_INTERVAL 5  // Iterations between landmark re-admissions
+#define KMEANS_ITERATIONS 20
+#define SHARED_PANEL 256  // Shared kernel columns gathered at a time
 namespace jason {
 
 Trainer::Trainer(Matrix *matrix, Vector *labels, size_t classes,
@@ -18,50 +28,393 @@ Trainer::Trainer(Matrix *matrix, Vector *labels, size_t classes,
   this->samples = matrix->Height();
   this->features = matrix->Width();
   this->classes = classes;
+  this->kernel = kernel;
   this->k = kernel;
+  this->rows = NULL;
+  this->columns = NULL;
+  this->counts = NULL;
+  this->slots = NULL;
+  this->active = NULL;
+  this->seed = 0;
+  this->iterations = MAX_ITER;
   this->converged = false;
+  this->cdf_table = NULL;
+  this->y = NULL;
+  this->a = NULL;
+  this->w = NULL;
+  this->w_samples = NULL;
+  this->factors = NULL;
+  this->landmark_mode = LANDMARKS_NONE;
+  this->landmark_count = 0;
+  this->landmark_rows = NULL;
+  this->admitted = NULL;
+}
+
+Trainer::Trainer(Kernel *kernel, Vector *labels, size_t classes,
+    Vector *rows) {
+  this->x = NULL;
+  this->samples = rows->Size();
+  this->features = 0;
+  this->classes = classes;
+  this->kernel = kernel;
+  this->k = NULL;
+  this->rows = rows;
+  this->columns = NULL;
+  this->counts = NULL;
+  this->slots = NULL;
+  this->active = NULL;
+  this->seed = 0;
+  this->iterations = MAX_ITER;
+  this->converged = false;
+  this->cdf_table = NULL;
+  this->y = NULL;
+  this->a = NULL;
+  this->w = NULL;
+  this->w_samples = NULL;
+  this->factors = NULL;
+  this->landmark_mode = LANDMARKS_NONE;
+  this->landmark_count = 0;
+  this->landmark_rows = NULL;
+  this->admitted = NULL;
+  this->t = new Vector(samples);
+  for (size_t n = 0; n < samples; ++n) {
+    t->Set(n, labels->Get(rows->Get(n)));
+  }
 }
 
 Trainer::~Trainer() {
+  ClearPosteriorFactors();
+  delete w_samples;
   delete y;
   delete a;
   delete w;
+  delete active;
+  delete[] admitted;
+  delete landmark_rows;
+  delete slots;
+  delete counts;
+  delete columns;
+  if (k != kernel) {
+    delete k;
+  }
+  if (rows != NULL) {
+    delete t;
+  }
 }
 
 void Trainer::Process(double tau, double upsilon) {
   LOG(DEBUG, "== Beginning Trainer. ==\n\n");
-  LOG(DEBUG, "= Initializing Train Kernel. =\n")
-
-  k->Init();
+  ClearPosteriorFactors();
+  delete w_samples;
+  w_samples = NULL;
+  if (rows == NULL && (landmark_mode != LANDMARKS_NONE
+      || landmark_rows != NULL)) {
+    delete[] admitted;
+    admitted = new bool[samples];
+    for (size_t n = 0; n < samples; ++n) {
+      admitted[n] = false;
+    }
+    active = SelectLandmarks();
+    for (size_t i = 0; i < active->Size(); ++i) {
+      admitted[(size_t)active->Get(i)] = true;
+    }
+    Matrix *points = x->GatherRows(active);
+    if (k != kernel) {
+      delete k;
+    }
+    k = kernel->Block(points, x);
+    samples = k->Height();
+    delete points;
+    LOG(VERBOSE, "Starting from %zu landmarks of %zu samples.\n",
+        k->Height(), k->Width());
+  } else if (rows == NULL) {
+    active = new Vector(samples);
+    LOG(DEBUG, "= Initializing Train Kernel. =\n")
+    kernel->Init();
+    for (size_t n = 0; n < samples; ++n) {
+      active->Set(n, n);
+    }
+  } else {
+    active = new Vector(samples);
+    for (size_t n = 0; n < samples; ++n) {
+      active->Set(n, rows->Get(n));
+    }
+    ShareColumns();
+  }
 
-  LOG(DEBUG, "= Printing Train Kernel: =\n");
-  LOG(DEBUG, "%s\n", k->ToString());
+  if (k != NULL) {
+    LOG(DEBUG, "= Printing Train Kernel: =\n");
+    LOG(DEBUG, "%s\n", k->ToString());
+  }
 
   InitializeYAW();
-  for (size_t i = 0; i < MAX_ITER && !converged; ++i) {
+  Iterate(iterations, tau, upsilon);
+
+  LOG(DEBUG, "= Printing w: =\n");
+  LOG(DEBUG, "%s\n", w->ToString());
+
+  LOG(DEBUG, "== End Trainer. ==\n");
+}
+
+void Trainer::Iterate(size_t iterations, double tau, double upsilon) {
+  for (size_t i = 0; i < iterations && !converged; ++i) {
     LOG(DEBUG, "Iteration: %zu\n", i);
     UpdateW();
     UpdateA(tau, upsilon);
     UpdateY();
+    if (admitted != NULL && (converged || (i + 1) % READMIT_INTERVAL == 0)
+        && Readmit() > 0) {
+      converged = false;
+    }
   }
+}
 
-  LOG(DEBUG, "= Printing w: =\n");
-  LOG(DEBUG, "%s\n", w->ToString());
+bool Trainer::Update(Matrix *x_new, Vector *labels_new, size_t iterations,
+    double tau, double upsilon) {
+  LOG(DEBUG, "== Beginning Trainer Update. ==\n");
+  if (x == NULL || w == NULL) {
+    LOG(VERBOSE, "Update needs a trained model over its own data.\n");
+    return false;
+  }
+  ClearPosteriorFactors();
+  delete w_samples;
+  w_samples = NULL;
+  size_t old_samples = x->Height();
+  size_t added = x_new->Height();
 
-  LOG(DEBUG, "== End Trainer. ==\n");
+  // New columns: the current relevance vectors against the new samples.
+  Matrix *relevance_vectors = GetRelevanceVectors();
+  Matrix *columns = kernel->Block(relevance_vectors, x_new);
+  k->AppendColumns(columns);
+  x->AppendRows(x_new);
+  t->Append(labels_new);
+
+  // Start the new y columns from the current model's scores.
+  Matrix *scores = w->MultiplyNoTrans(columns);
+  y->AppendColumns(scores);
+  if (admitted == NULL) {
+    // New rows: the new samples join the active set as candidates.
+    Vector *active_new = new Vector(added);
+    for (size_t n = 0; n < added; ++n) {
+      active_new->Set(n, old_samples + n);
+    }
+    AdmitRows(active_new);
+    delete active_new;
+  } else {
+    // With landmarks only the new samples the model gets wrong join.
+    bool *grown = new bool[x->Height()];
+    for (size_t n = 0; n < x->Height(); ++n) {
+      grown[n] = n < old_samples && admitted[n];
+    }
+    delete[] admitted;
+    admitted = grown;
+    Readmit();
+  }
+  LOG(VERBOSE, "Update: %zu new samples, %zu active rows.\n", added,
+      samples);
+
+  converged = false;
+  Iterate(iterations, tau, upsilon);
+
+  delete scores;
+  delete columns;
+  delete relevance_vectors;
+  LOG(DEBUG, "== End Trainer Update. ==\n");
+  return true;
 }
 
 Matrix *Trainer::GetW() {
-  return this->w;
+  if (w_samples == NULL && w != NULL) {
+    w_samples = w->Transpose();
+  }
+  return w_samples;
+}
+
+Vector *Trainer::GetActive() {
+  return this->active;
+}
+
+Matrix *Trainer::GetRelevanceVectors() {
+  if (x == NULL) {
+    return NULL;
+  }
+  return x->GatherRows(active);
+}
+
+void Trainer::SetSeed(unsigned long seed) {
+  this->seed = seed;
+}
+
+RandomNumberGenerator *Trainer::NewRandomNumberGenerator() {
+  if (seed == 0) {
+    return new RandomNumberGenerator();
+  }
+  return new RandomNumberGenerator(seed);
+}
+
+void Trainer::SetCdfTable(NormalCdfTable *table) {
+  this->cdf_table = table;
+}
+
+void Trainer::SetIterations(size_t iterations) {
+  this->iterations = iterations;
+}
+
+void Trainer::SetLandmarks(LandmarkMode mode, size_t count) {
+  this->landmark_mode = mode;
+  this->landmark_count = count;
+}
+
+void Trainer::SetLandmarkRows(Vector *rows, size_t count) {
+  delete this->landmark_rows;
+  this->landmark_rows = new Vector(rows->Size());
+  for (size_t i = 0; i < rows->Size(); ++i) {
+    this->landmark_rows->Set(i, rows->Get(i));
+  }
+  this->landmark_count = count;
+}
+
+// Each class gets its share of the landmarks, at least one.
+Vector *Trainer::SelectLandmarks() {
+  if (landmark_rows != NULL) {
+    Vector *ret = new Vector(landmark_rows->Size());
+    for (size_t i = 0; i < landmark_rows->Size(); ++i) {
+      ret->Set(i, landmark_rows->Get(i));
+    }
+    return ret;
+  }
+  if (landmark_count >= samples) {
+    Vector *ret = new Vector(samples);
+    for (size_t n = 0; n < samples; ++n) {
+      ret->Set(n, n);
+    }
+    return ret;
+  }
+  RandomNumberGenerator *r = NewRandomNumberGenerator();
+  size_t *members = new size_t[samples];
+  size_t *chosen = new size_t[samples];
+  size_t landmarks = 0;
+  for (size_t c = 0; c < classes; ++c) {
+    size_t count = 0;
+    for (size_t n = 0; n < samples; ++n) {
+      if (t->Get(n) == c) {
+        members[count++] = n;
+      }
+    }
+    if (count == 0) {
+      continue;
+    }
+    size_t share = (landmark_count * count + samples / 2) / samples;
+    share = share < 1 ? 1 : share > count ? count : share;
+    if (landmark_mode == LANDMARKS_KMEANS) {
+      Vector *member_rows = new Vector(count);
+      for (size_t i = 0; i < count; ++i) {
+        member_rows->Set(i, members[i]);
+      }
+      Matrix *points = x->GatherRows(member_rows);
+      KMeans *kmeans = new KMeans(points, share);
+      kmeans->Process(r, KMEANS_ITERATIONS);
+      Vector *exemplars = kmeans->GetExemplars();
+      for (size_t i = 0; i < exemplars->Size(); ++i) {
+        if (exemplars->Get(i) >= 0) {
+          chosen[landmarks++] = members[(size_t)exemplars->Get(i)];
+        }
+      }
+      delete exemplars;
+      delete kmeans;
+      delete points;
+      delete member_rows;
+    } else {
+      // A partial Fisher-Yates shuffle of the class's samples.
+      for (size_t i = 0; i < share; ++i) {
+        size_t j = i + static_cast<size_t>(r->SampleUniform(0, count - i));
+        j = j < count ? j : count - 1;
+        std::swap(members[i], members[j]);
+        chosen[landmarks++] = members[i];
+      }
+    }
+  }
+  Vector *ret = new Vector(landmarks);
+  for (size_t i = 0; i < landmarks; ++i) {
+    ret->Set(i, chosen[i]);
+  }
+  delete[] chosen;
+  delete[] members;
+  delete r;
+  return ret;
+}
+
+// Appends the kernel rows of the given samples to k, with the prior
+// a = 1 and w = 0, and marks them admitted when landmarks are in use.
+void Trainer::AdmitRows(Vector *new_rows) {
+  Matrix *points = x->GatherRows(new_rows);
+  Matrix *block = kernel->Block(points, x);
+  k->AppendRows(block);
+  Matrix *w_new = new Matrix(classes, new_rows->Size());
+  w_new->SetAll(0.0);
+  w->AppendColumns(w_new);
+  Matrix *a_new = new Matrix(classes, new_rows->Size());
+  a_new->SetAll(1.0);
+  a->AppendColumns(a_new);
+  active->Append(new_rows);
+  for (size_t i = 0; admitted != NULL && i < new_rows->Size(); ++i) {
+    admitted[(size_t)new_rows->Get(i)] = true;
+  }
+  samples = k->Height();
+  delete a_new;
+  delete w_new;
+  delete block;
+  delete points;
+}
+
+// Scores every training sample with the current model and admits the
+// misclassified ones that were never in the active set.
+size_t Trainer::Readmit() {
+  Matrix *scores = w->MultiplyNoTrans(k);
+  std::pair<double, size_t> *candidates =
+      new std::pair<double, size_t>[scores->Width()];
+  size_t count = 0;
+  for (size_t n = 0; n < scores->Width(); ++n) {
+    if (admitted[n]) {
+      continue;
+    }
+    size_t label = t->Get(n);
+    double margin = HUGE_VAL;
+    for (size_t c = 0; c < classes; ++c) {
+      if (c != label) {
+        margin = fmin(margin, scores->Get(label, n) - scores->Get(c, n));
+      }
+    }
+    if (margin < 0) {
+      candidates[count++] = std::make_pair(margin, n);
+    }
+  }
+  size_t admit = count < landmark_count ? count : landmark_count;
+  std::partial_sort(candidates, candidates + admit, candidates + count);
+  if (admit > 0) {
+    Vector *new_rows = new Vector(admit);
+    for (size_t i = 0; i < admit; ++i) {
+      new_rows->Set(i, candidates[i].second);
+    }
+    AdmitRows(new_rows);
+    LOG(VERBOSE, "Readmitted %zu of %zu misclassified samples, %zu "
+        "active.\n", admit, count, samples);
+    delete new_rows;
+  }
+  delete[] candidates;
+  delete scores;
+  return admit;
 }
 
 void Trainer::InitializeYAW() {
   LOG(DEBUG, "= InitializeYAW. =\n");
-  y = new Matrix(samples, classes);
-  a = new Matrix(samples, classes);
-  w = new Matrix(samples, classes);
-  RandomNumberGenerator *r = new RandomNumberGenerator();
-  for (size_t row = 0; row < samples; ++row) {
+  // y covers every sample, w and a the active set, which starts as every
+  // sample unless landmarks were chosen.  All three are class-major.
+  y = new Matrix(classes, t->Size());
+  a = new Matrix(classes, active->Size());
+  w = new Matrix(classes, active->Size());
+  RandomNumberGenerator *r = NewRandomNumberGenerator();
+  for (size_t row = 0; row < t->Size(); ++row) {
     for (size_t col = 0; col < classes; ++col) {
       double y_val, a_val, w_val;
       if (t->Get(row) == col)
@@ -70,9 +423,11 @@ void Trainer::InitializeYAW() {
         y_val = r->SampleUniform(0, 1);
       a_val = 1;
       w_val = r->SampleGaussian(sqrt(1/a_val));
-      y->Set(row, col, y_val);
-      a->Set(row, col, a_val);
-      w->Set(row, col, w_val);
+      y->Set(col, row, y_val);
+      if (row < active->Size()) {
+        a->Set(col, row, a_val);
+        w->Set(col, row, w_val);
+      }
     }
   }
   delete r;
@@ -81,51 +436,283 @@ void Trainer::InitializeYAW() {
 void Trainer::UpdateA(double tau, double upsilon) {
   LOG(DEBUG, "= UpdateA. =\n");
   this->converged = true;
-  Vector *removal_vector = new Vector(a->Height());
+  // Class by class, streaming each class's row of w and a; a sample is
+  // purged when no class keeps it.
+  bool *keep = new bool[samples];
   for (size_t row = 0; row < samples; ++row) {
-    bool purge = true;
-    for (size_t col = 0; col < classes; ++col) {
-      double wval = w->Get(row, col);
-      double oldval = a->Get(row, col);
+    keep[row] = false;
+  }
+  for (size_t col = 0; col < classes; ++col) {
+    Vector *w_c = w->RowView(col);
+    Vector *a_c = a->RowView(col);
+    for (size_t row = 0; row < samples; ++row) {
+      double wval = w_c->Get(row);
+      double oldval = a_c->Get(row);
       double newval = (2*tau + 1)/(wval*wval + 2*upsilon);
-      a->Set(row, col, newval);
+      a_c->Set(row, newval);
       LOG(DEBUG, "UpdateA: %.3f\t%.3f\t%.3f\n",
         oldval, newval, fabs(oldval - newval));
       if (fabs(oldval - newval) > EPSILON) {
         this->converged = false;
       }
       if (newval < 1000) {
-        purge = false;
+        keep[row] = true;
       }
     }
-    LOG(DEBUG, "%s.\n", purge ? "purge" : "no purge");
-    removal_vector->Set(row, purge ? 0.0 : 1.0);
+    delete a_c;
+    delete w_c;
   }
-  x->RemoveRows(removal_vector);
-  k->RemoveRows(removal_vector);
-  a->RemoveRows(removal_vector);
-  w->RemoveRows(removal_vector);
-  samples = k->Height();
+  Vector *removal_vector = new Vector(samples);
+  size_t count = 0;
+  for (size_t row = 0; row < samples; ++row) {
+    LOG(DEBUG, "%s.\n", keep[row] ? "no purge" : "purge");
+    removal_vector->Set(row, keep[row] ? 1.0 : 0.0);
+    count += keep[row];
+  }
+  delete[] keep;
+  if (k != NULL) {
+    k->RemoveRows(removal_vector);
+  }
+  a->RemoveColumns(removal_vector);
+  w->RemoveColumns(removal_vector);
+  Vector *kept = new Vector(count);
+  for (size_t row = 0, ret_row = 0; row < active->Size(); ++row) {
+    if (removal_vector->Get(row) == 1) {
+      kept->Set(ret_row++, active->Get(row));
+    }
+  }
+  delete active;
+  active = kept;
+  samples = count;
   delete removal_vector;
 }
 
+// Counts the samples on every kernel column, so that products over the
+// samples become products over the distinct columns they use, weighted by
+// their counts.
+void Trainer::ShareColumns() {
+  delete slots;
+  delete counts;
+  delete columns;
+  size_t width = kernel->Width();
+  size_t *used = new size_t[width];
+  for (size_t col = 0; col < width; ++col) {
+    used[col] = 0;
+  }
+  for (size_t n = 0; n < samples; ++n) {
+    ++used[(size_t)rows->Get(n)];
+  }
+  size_t distinct = 0;
+  for (size_t col = 0; col < width; ++col) {
+    distinct += used[col] > 0;
+  }
+  columns = new Vector(distinct);
+  counts = new Vector(distinct);
+  size_t *slot = new size_t[width];
+  for (size_t col = 0, j = 0; col < width; ++col) {
+    if (used[col] > 0) {
+      columns->Set(j, col);
+      counts->Set(j, used[col]);
+      slot[col] = j++;
+    }
+  }
+  slots = new Vector(samples);
+  for (size_t n = 0; n < samples; ++n) {
+    slots->Set(n, slot[(size_t)rows->Get(n)]);
+  }
+  delete[] slot;
+  delete[] used;
+}
+
+// The active rows of the shared kernel over distinct columns [begin, end).
+Matrix *Trainer::SharedPanel(size_t begin, size_t end) {
+  Vector *panel_columns = new Vector(end - begin);
+  for (size_t j = begin; j < end; ++j) {
+    panel_columns->Set(j - begin, columns->Get(j));
+  }
+  Matrix *panel = kernel->Gather(active, panel_columns);
+  delete panel_columns;
+  return panel;
+}
+
+// K K' over the active rows, the sum over the samples' columns, and with
+// `ky` not NULL also K y' into it, active rows by classes.
+Matrix *Trainer::SharedGram(Matrix *ky) {
+  Matrix *kk = new Matrix(active->Size(), active->Size());
+  kk->SetAll(0.0);
+  Matrix *y_columns = NULL;
+  Vector *all_classes = NULL;
+  if (ky != NULL) {
+    ky->SetAll(0.0);
+    // y summed over the samples on each distinct column.
+    y_columns = new Matrix(classes, columns->Size());
+    y_columns->SetAll(0.0);
+    for (size_t c = 0; c < classes; ++c) {
+      for (size_t n = 0; n < y->Width(); ++n) {
+        size_t j = slots->Get(n);
+        y_columns->Set(c, j, y_columns->Get(c, j) + y->Get(c, n));
+      }
+    }
+    all_classes = new Vector(classes);
+    for (size_t c = 0; c < classes; ++c) {
+      all_classes->Set(c, c);
+    }
+  }
+  for (size_t begin = 0; begin < columns->Size(); begin += SHARED_PANEL) {
+    size_t end = std::min(begin + SHARED_PANEL, columns->Size());
+    Matrix *panel = SharedPanel(begin, end);
+    Matrix *weighted = panel;
+    for (size_t j = begin; j < end && weighted == panel; ++j) {
+      if (counts->Get(j) != 1) {
+        weighted = panel->Copy();
+      }
+    }
+    if (weighted != panel) {
+      for (size_t m = 0; m < weighted->Height(); ++m) {
+        for (size_t j = begin; j < end; ++j) {
+          weighted->Set(m, j - begin,
+              weighted->Get(m, j - begin) * counts->Get(j));
+        }
+      }
+    }
+    kk->AddMultiply(panel, weighted);
+    if (ky != NULL) {
+      Vector *panel_columns = new Vector(end - begin);
+      for (size_t j = begin; j < end; ++j) {
+        panel_columns->Set(j - begin, j);
+      }
+      Matrix *y_panel = y_columns->Gather(all_classes, panel_columns);
+      ky->AddMultiply(panel, y_panel);
+      delete y_panel;
+      delete panel_columns;
+    }
+    if (weighted != panel) {
+      delete weighted;
+    }
+    delete panel;
+  }
+  delete all_classes;
+  delete y_columns;
+  return kk;
+}
+
+// w K, class-major like y, one panel of distinct columns at a time.
+Matrix *Trainer::SharedScores() {
+  Matrix *column_scores = new Matrix(classes, columns->Size());
+  for (size_t begin = 0; begin < columns->Size(); begin += SHARED_PANEL) {
+    size_t end = std::min(begin + SHARED_PANEL, columns->Size());
+    Matrix *panel = SharedPanel(begin, end);
+    Matrix *panel_scores = w->MultiplyNoTrans(panel);
+    for (size_t c = 0; c < classes; ++c) {
+      for (size_t j = begin; j < end; ++j) {
+        column_scores->Set(c, j, panel_scores->Get(c, j - begin));
+      }
+    }
+    delete panel_scores;
+    delete panel;
+  }
+  Matrix *scores = new Matrix(classes, y->Width());
+  for (size_t c = 0; c < classes; ++c) {
+    for (size_t n = 0; n < y->Width(); ++n) {
+      scores->Set(c, n, column_scores->Get(c, slots->Get(n)));
+    }
+  }
+  delete column_scores;
+  return scores;
+}
+
+// Shared by the UpdateW and posterior factor tasks.
+struct UpdateWTask {
+  Trainer *trainer;
+  Matrix *kk;
+  Matrix *ky;  // K y', over a shared kernel only
+};
+
+Matrix **Trainer::GetPosteriorFactors() {
+  if (factors == NULL) {
+    LOG(DEBUG, "= Posterior factors. =\n");
+    // K K' is shared by every class; only the diagonal differs.
+    Matrix *kk = k != NULL ? k->Multiply(k) : SharedGram(NULL);
+    factors = new Matrix*[classes];
+    UpdateWTask task = { this, kk, NULL };
+    Scheduler::ParallelFor("posterior_factors", classes, 1, FactorTile,
+        &task);
+    delete kk;
+  }
+  return factors;
+}
+
+void Trainer::FactorTile(size_t begin, size_t end, void *arg) {
+  UpdateWTask *task = reinterpret_cast<UpdateWTask*>(arg);
+  Trainer *trainer = task->trainer;
+  Matrix *kk = task->kk;
+  for (size_t c = begin; c < end; ++c) {
+    Matrix *factor = kk->Copy();
+    for (size_t m = 0; m < kk->Height(); ++m) {
+      factor->Set(m, m, kk->Get(m, m) + trainer->a->Get(c, m));
+    }
+    factor->Cholesky();
+    trainer->factors[c] = factor;
+  }
+}
+
+void Trainer::ClearPosteriorFactors() {
+  if (factors != NULL) {
+    for (size_t c = 0; c < classes; ++c) {
+      delete factors[c];
+    }
+    delete[] factors;
+    factors = NULL;
+  }
+}
+
 void Trainer::UpdateW() {
   LOG(DEBUG, "= UpdateW. =\n");
-  LOG(DEBUG, "k is %zux%zu\n", k->Height(), k->Width());
+  LOG(DEBUG, "k is %zux%zu\n", active->Size(), y->Width());
   LOG(DEBUG, "y is %zux%zu\n", y->Height(), y->Width());
   LOG(DEBUG, "a is %zux%zu\n", a->Height(), a->Width());
   LOG(DEBUG, "w is %zux%zu\n", w->Height(), w->Width());
-  for (size_t col = 0; col < classes; ++col) {
-    Vector *A_c = a->Column(col);
+  // KK' is shared by every class; each class's solve is a separate task.
+  // Over a shared kernel K y' comes from the same panels, so no task needs
+  // the kernel itself.
+  Matrix *kk, *ky = NULL;
+  if (k != NULL) {
+    kk = k->Multiply(k);
+  } else {
+    ky = new Matrix(active->Size(), classes);
+    kk = SharedGram(ky);
+  }
+  UpdateWTask task = { this, kk, ky };
+  Scheduler::ParallelFor("update_w", classes, 1, UpdateWTile, &task);
+  delete ky;
+  delete kk;
+}
+
+void Trainer::UpdateWTile(size_t begin, size_t end, void *arg) {
+  UpdateWTask *task = reinterpret_cast<UpdateWTask*>(arg);
+  task->trainer->UpdateWClasses(begin, end, task->kk, task->ky);
+}
+
+void Trainer::UpdateWClasses(size_t begin, size_t end, Matrix *kk,
+    Matrix *ky) {
+  for (size_t col = begin; col < end; ++col) {
+    Vector *A_c = a->RowView(col);
     Matrix *A = new Matrix(A_c);
-    Vector *Y_c = y->Column(col);
-    Matrix *w_temp1 = k->Multiply(k);
+    Vector *Y_c = y->RowView(col);
+    Matrix *w_temp1 = kk->Copy();
     w_temp1->Add(A);
     w_temp1->Invert();
-    Matrix *w_temp2 = w_temp1->MultiplyNoTrans(k);
-    Vector *W_c = w_temp2->Multiply(Y_c);
-    w->SetColumn(col, W_c);
-    delete w_temp2;
+    Vector *W_c;
+    if (ky == NULL) {
+      Matrix *w_temp2 = w_temp1->MultiplyNoTrans(k);
+      W_c = w_temp2->Multiply(Y_c);
+      delete w_temp2;
+    } else {
+      Vector *ky_c = ky->Column(col);
+      W_c = w_temp1->Multiply(ky_c);
+      delete ky_c;
+    }
+    w->SetRow(col, W_c);
     delete w_temp1;
     delete W_c;
     delete Y_c;
@@ -134,67 +721,128 @@ void Trainer::UpdateW() {
   }
 }
 
+struct UpdateYTask {
+  Trainer *trainer;
+  Matrix *scores;  // w K, class-major like y
+  unsigned long *seeds;  // One per UPDATE_Y_GRAIN block of samples
+};
+
 void Trainer::UpdateY() {
   LOG(DEBUG, "= UpdateY. =\n");
-  LOG(DEBUG, "k is %zux%zu\n", k->Height(), k->Width());
+  LOG(DEBUG, "k is %zux%zu\n", active->Size(), y->Width());
   LOG(DEBUG, "y is %zux%zu\n", y->Height(), y->Width());
   LOG(DEBUG, "a is %zux%zu\n", a->Height(), a->Width());
   LOG(DEBUG, "w is %zux%zu\n", w->Height(), w->Width());
-  RandomNumberGenerator *r = new RandomNumberGenerator();
-  for (size_t n = 0; n < samples; ++n) {
+  // Each block of samples draws from its own generator, seeded in block
+  // order from the trainer's, so the draws do not depend on the schedule.
+  RandomNumberGenerator *r = NewRandomNumberGenerator();
+  size_t blocks = (y->Width() + UPDATE_Y_GRAIN - 1) / UPDATE_Y_GRAIN;
+  unsigned long *seeds = new unsigned long[blocks];
+  for (size_t b = 0; b < blocks; ++b) {
+    seeds[b] = static_cast<unsigned long>(r->SampleUniform(1, 4294967295.0));
+  }
+  delete r;
+  // Every sample's class scores from one GEMM instead of a dot product
+  // per sample and class over a gathered kernel column.
+  Matrix *scores = k != NULL ? w->MultiplyNoTrans(k) : SharedScores();
+  UpdateYTask task = { this, scores, seeds };
+  Scheduler::ParallelFor("update_y", y->Width(), UPDATE_Y_GRAIN, UpdateYTile,
+      &task);
+  delete scores;
+  delete[] seeds;
+}
+
+void Trainer::UpdateYTile(size_t begin, size_t end, void *arg) {
+  UpdateYTask *task = reinterpret_cast<UpdateYTask*>(arg);
+  task->trainer->UpdateYSamples(begin, end, task->scores,
+      task->seeds[begin / UPDATE_Y_GRAIN]);
+}
+
+void Trainer::UpdateYSamples(size_t begin, size_t end, Matrix *scores,
+    unsigned long seed) {
+  RandomNumberGenerator *r = new RandomNumberGenerator(seed);
+  double *wkn = new double[classes];
+  double *draws = new double[MONTE_CARLO_SAMPLES];
+  double *args = new double[MONTE_CARLO_SAMPLES];
+  double *cdfs = new double[classes * MONTE_CARLO_SAMPLES];
+  double *prefix = new double[classes + 1];
+  double *suffix = new double[classes + 1];
+  double *numerator = new double[classes];
+  double *denominator = new double[classes];
+  for (size_t n = begin; n < end; ++n) {
     LOG(DEBUG, "n = %zu.\n", n);
     size_t i = (size_t)t->Get(n);
-    Vector *k_n = k->Column(n);
     for (size_t c = 0; c < classes; ++c) {
-      LOG(DEBUG, "c = %zu.\n", c);
-      Vector *w_c = w->Column(c);
-      Vector *w_i = w->Column(i);
-      double wckn = w_c->Multiply(k_n);
-      double wikn = w_i->Multiply(k_n);
-      delete w_c;
-      delete w_i;
-      if (c != i) {
-        double numerator = 0;
-        double denominator = 0;
-        for (int monte = 0; monte < 1000; ++monte) {
-          double u = r->SampleGaussian(1.0);
-          double num = r->GaussianPDF(wckn - wikn);
-          double den = r->GaussianCDF(u + wikn - wckn);
-          for (size_t j = 0; j < classes; ++j) {
-            if (j != i && j != c) {
-              LOG(DEBUG, "j = %zu.\n", j);
-              Vector *w_j = w->Column(j);
-              double wjkn = w_j->Multiply(k_n);
-              num *= r->GaussianCDF(u + wikn - wjkn);
-              den *= r->GaussianCDF(u + wikn - wjkn);
-              delete w_j;
-            }  // if
-          }  // for j
-          numerator   += num;
-          denominator += den;
-        }  // for monte
-        if (denominator != 0) {
-          double val = wckn - numerator / denominator;
-          y->Set(n, c, val);
-        } else {
-          perror("Error! denominator equal to zero");
+      wkn[c] = scores->Get(c, n);
+      numerator[c] = 0;
+      denominator[c] = 0;
+    }
+    double wikn = wkn[i];
+
+    // One set of draws is shared by every wrong class c.  The CDF terms
+    // are computed once per class j and draw, a class at a time so that
+    // the tabulated CDF takes them as one vectorized batch, and the
+    // product over j != i, c is formed from prefix/suffix products, so a
+    // sample costs O(S C) rather than O(S C^2).
+    for (int monte = 0; monte < MONTE_CARLO_SAMPLES; ++monte) {
+      draws[monte] = r->SampleGaussian(1.0);
+    }
+    for (size_t j = 0; j < classes; ++j) {
+      double *cdf = cdfs + j * MONTE_CARLO_SAMPLES;
+      for (int monte = 0; monte < MONTE_CARLO_SAMPLES; ++monte) {
+        args[monte] = draws[monte] + wikn - wkn[j];
+      }
+      if (j == i) {
+        for (int monte = 0; monte < MONTE_CARLO_SAMPLES; ++monte) {
+          cdf[monte] = 1.0;
+        }
+      } else if (cdf_table) {
+        cdf_table->P(args, cdf, MONTE_CARLO_SAMPLES);
+      } else {
+        for (int monte = 0; monte < MONTE_CARLO_SAMPLES; ++monte) {
+          cdf[monte] = r->GaussianCDF(args[monte]);
+        }
+      }
+    }
+    for (int monte = 0; monte < MONTE_CARLO_SAMPLES; ++monte) {
+      prefix[0] = 1.0;
+      suffix[classes] = 1.0;
+      for (size_t j = 0; j < classes; ++j) {
+        prefix[j + 1] = prefix[j] * cdfs[j * MONTE_CARLO_SAMPLES + monte];
+        suffix[classes - j - 1] = suffix[classes - j]
+            * cdfs[(classes - j - 1) * MONTE_CARLO_SAMPLES + monte];
+      }
+      for (size_t c = 0; c < classes; ++c) {
+        if (c != i) {
+          double others = prefix[c] * suffix[c + 1];
+          numerator[c]   += others;
+          denominator[c] += cdfs[c * MONTE_CARLO_SAMPLES + monte] * others;
         }  // if
+      }  // for c
+    }  // for monte
+
+    double y_ni = wikn;
+    for (size_t c = 0; c < classes; ++c) {
+      LOG(DEBUG, "c = %zu.\n", c);
+      if (c == i) continue;
+      if (denominator[c] != 0) {
+        double pdf = r->GaussianPDF(wkn[c] - wikn);
+        y->Set(c, n, wkn[c] - pdf * numerator[c] / denominator[c]);
       } else {
-        double val = wckn;
-        for (size_t j = 0; j < classes; ++j) {
-          if (j != i) {
-            Vector *w_j = w->Column(j);
-            double wjkn = w_j->Multiply(k_n);
-            double y_nj = y->Get(n, j);
-            val = val - (y_nj - wjkn);
-            delete w_j;
-          }  // if
-        }  // for j
-        y->Set(n, c, val);
+        perror("Error! denominator equal to zero");
       }  // if
+      y_ni -= y->Get(c, n) - wkn[c];
     }  // for c
-    delete k_n;
+    y->Set(i, n, y_ni);
   }  // for n
+  delete[] denominator;
+  delete[] numerator;
+  delete[] suffix;
+  delete[] prefix;
+  delete[] cdfs;
+  delete[] args;
+  delete[] draws;
+  delete[] wkn;
   delete r;
 }
 }
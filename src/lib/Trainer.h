@@ -5,35 +5,123 @@
 
 #include "lib/Matrix.h"
 #include "lib/Kernel.h"
+#include "lib/NormalCdfTable.h"
+#include "lib/RandomNumberGenerator.h"
 
 namespace jason {
 
 class Matrix;
 class Kernel;
+class NormalCdfTable;
+class RandomNumberGenerator;
+
+enum LandmarkMode {
+  LANDMARKS_NONE,        // Start from every sample
+  LANDMARKS_STRATIFIED,  // Random samples of each class
+  LANDMARKS_KMEANS       // Samples nearest the k-means centroids of each class
+};
 
 class Trainer {
   public:
     explicit Trainer(Matrix *matrix, Vector *labels, size_t classes,
         Kernel *kernel);
+    // Trains on the samples at the given row indices of a kernel that has
+    // already been initialized.  The kernel is only read, never copied, so
+    // several trainers may share it; indices may repeat (bootstrap
+    // samples).
+    Trainer(Kernel *kernel, Vector *labels, size_t classes, Vector *rows);
     virtual ~Trainer();
     void Process(double tau, double upsilon);
+    // Incremental refresh of a trained model with newly labeled samples.
+    // Only the kernel blocks involving the new samples are computed; w, a
+    // and y are extended and at most `iterations` update rounds are run
+    // over the current relevance vectors plus the new samples.  Appends to
+    // the training matrix and labels the trainer was constructed with.
+    // Returns false, changing nothing, unless the trainer holds a model
+    // trained over its own data.
+    bool Update(Matrix *x_new, Vector *labels_new, size_t iterations,
+        double tau, double upsilon);
+    // w with one row per relevance vector and one column per class.  A copy
+    // owned by the trainer, valid until the next Process() or Update().
     Matrix *GetW();
+    Vector *GetActive();
+    Matrix *GetRelevanceVectors();
+    // Cholesky factors L_c of K K' + diag(a_c), one per class, over the
+    // relevance vectors: the posterior covariance of w_c is L_c'^-1 L_c^-1.
+    // Computed on first use and owned by the trainer.
+    Matrix **GetPosteriorFactors();
+    void SetSeed(unsigned long seed);
+    void SetCdfTable(NormalCdfTable *table);
+    // Most update rounds Process() runs, MAX_ITER by default.
+    void SetIterations(size_t iterations);
+    // Starts the top-down iterations from `count` landmark samples, split
+    // over the classes in proportion to their sizes, instead of from every
+    // sample, and computes only the kernel rows of samples in the active
+    // set.  Every READMIT_INTERVAL iterations, and at convergence, up to
+    // `count` samples never admitted before that the current model
+    // misclassifies rejoin the active set, lowest margin first; Update()
+    // adds its new samples the same way.  Only for trainers over their own
+    // data.
+    void SetLandmarks(LandmarkMode mode, size_t count);
+    // Like SetLandmarks(), but starting from the given sample indices;
+    // `count` still bounds each re-admission.
+    void SetLandmarkRows(Vector *rows, size_t count);
 
   private:
+    friend class TrainerPeer;  // Steps the updates one at a time in tests
     Matrix *x;  // Data Points
     Vector *t;  // Labels
     size_t samples, features, classes;
 
     bool converged;
 
+    // w, a and y are class-major, C x N: row c holds class c for every
+    // active row (w, a) or sample (y), so per-class work streams memory.
     Matrix *w;
-    Kernel *k;
+    Matrix *w_samples;  // w transposed for GetW(), NULL until asked for
+    Kernel *kernel;
+    Matrix *k;       // Rows of the kernel still in the active set, or NULL
+                     // over a shared kernel
+    Vector *rows;    // Sample indices into kernel, NULL to use all of it
+    // Over a shared kernel: the distinct kernel columns the samples use,
+    // ascending, how many samples use each, and each sample's index into
+    // them.  Products with the kernel are formed from panels of these
+    // columns over the active rows.
+    Vector *columns;
+    Vector *counts;
+    Vector *slots;
+    Vector *active;  // Kernel row index of every row of k, w and a
+    unsigned long seed;
+    size_t iterations;
     Matrix *a;
     Matrix *y;
+    NormalCdfTable *cdf_table;  // NULL selects the exact gsl CDF
+    Matrix **factors;
+    LandmarkMode landmark_mode;
+    size_t landmark_count;
+    Vector *landmark_rows;  // Chosen by the caller, or NULL
+    bool *admitted;  // Per sample, whether it ever joined the active set
+
+    void ClearPosteriorFactors();
+    void ShareColumns();
+    Matrix *SharedPanel(size_t begin, size_t end);
+    Matrix *SharedGram(Matrix *ky);
+    Matrix *SharedScores();
 
+    RandomNumberGenerator *NewRandomNumberGenerator();
+    Vector *SelectLandmarks();
+    void AdmitRows(Vector *new_rows);
+    size_t Readmit();
     void InitializeYAW();
+    void Iterate(size_t iterations, double tau, double upsilon);
     void UpdateA(double tau, double upsilon);
     void UpdateW();
+    static void UpdateWTile(size_t begin, size_t end, void *arg);
+    void UpdateWClasses(size_t begin, size_t end, Matrix *kk, Matrix *ky);
+    static void FactorTile(size_t begin, size_t end, void *arg);
+    static void UpdateYTile(size_t begin, size_t end, void *arg);
+    void UpdateYSamples(size_t begin, size_t end, Matrix *scores,
+        unsigned long seed);
     void UpdateY();
 };
 }
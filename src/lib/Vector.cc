@@ -3,30 +3,54 @@
 #include <cstring>
 
 #include "lib/Vector.h"
+#include "lib/Reduction.h"
+#include "lib/Simd.h"
 #include "lib/Log.h"
 
 namespace jason {
 
 Vector::Vector(size_t size) {
   to_str = reinterpret_cast<char*> (malloc(256 * sizeof(*to_str)));
+  adopted = NULL;
   this->v = gsl_vector_alloc(size);
 }
 
 Vector::Vector(gsl_vector *vec) {
   to_str = reinterpret_cast<char*> (malloc(256 * sizeof(*to_str)));
+  adopted = NULL;
   this->v = vec;
 }
 
 Vector::Vector(double *data, size_t size) {
   to_str = reinterpret_cast<char*> (malloc(256 * sizeof(*to_str)));
+  adopted = NULL;
+  this->v = gsl_vector_alloc(size);
+  memcpy(this->v->data, data, size * sizeof(*data));
+}
+
+Vector::Vector(double *data, size_t size, size_t stride,
+    BufferOwnership ownership) {
+  to_str = reinterpret_cast<char*> (malloc(256 * sizeof(*to_str)));
+  adopted = ownership == BUFFER_ADOPT ? data : NULL;
+  // A non-owning gsl_vector: gsl_vector_free only releases the struct.
+  gsl_vector_view view = gsl_vector_view_array_with_stride(data, stride,
+      size);
+  this->v = reinterpret_cast<gsl_vector*>(malloc(sizeof(*v)));
+  *this->v = view.vector;
+}
+
+Vector::Vector(const float *data, size_t size, size_t stride) {
+  to_str = reinterpret_cast<char*> (malloc(256 * sizeof(*to_str)));
+  adopted = NULL;
   this->v = gsl_vector_alloc(size);
   for (size_t i = 0; i < size; ++i) {
-    gsl_vector_set(this->v, i, data[i]);
+    this->v->data[i] = data[i * stride];
   }
 }
 
 Vector::Vector(const char* filename) {
   to_str = reinterpret_cast<char*> (malloc(256 * sizeof(*to_str)));
+  adopted = NULL;
   size_t rows;
   FILE *f;
   f = fopen(filename, "r");
@@ -44,7 +68,7 @@ Vector::Vector(const char* filename) {
 char* Vector::ToString() {
   LOG(DEBUG, "Vector ToString\n");
   #define kElementSize 12
-  this->to_str[0] = NULL;
+  this->to_str[0] = '\0';
   size_t total = 0;
   for (size_t j = 0; j < v->size; j++) {
     char temp[kElementSize];
@@ -53,15 +77,14 @@ char* Vector::ToString() {
     total += strlen(temp);
     if (total + kElementSize + 1 > 255) break;
   }
-  char temp[1];
-  snprintf(temp, kElementSize, "\n");
-  strncat(this->to_str, temp, 1);
+  strcat(this->to_str, "\n");
   return this->to_str;
 }
 
 Vector::~Vector() {
   free(to_str);
   gsl_vector_free(this->v);
+  free(adopted);
 }
 
 size_t Vector::Size() {
@@ -76,6 +99,16 @@ void Vector::Set(size_t elem, double value) {
   gsl_vector_set(this->v, elem, value);
 }
 
+void Vector::Append(Vector *other) {
+  gsl_vector *new_v = gsl_vector_alloc(v->size + other->v->size);
+  gsl_vector_view head = gsl_vector_subvector(new_v, 0, v->size);
+  gsl_vector_view tail = gsl_vector_subvector(new_v, v->size, other->v->size);
+  gsl_vector_memcpy(&head.vector, v);
+  gsl_vector_memcpy(&tail.vector, other->v);
+  gsl_vector_free(v);
+  v = new_v;
+}
+
 Matrix *Vector::RepmatVert(size_t k) {
   gsl_matrix *mat = gsl_matrix_alloc(v->size, k);
   LOG(DEBUG, "\t\t\tgsl_matrix_alloc\n");
@@ -101,6 +134,14 @@ double Vector::Multiply(Vector *other) {
     fprintf(stderr, "Dimension Error.\n");
     exit(1);
   }
+  if (Reduction::Reproducible()) {
+    return Reduction::Dot(this->v->data, this->v->stride, other->v->data,
+        other->v->stride, this->Size());
+  }
+  if (Simd::Level() != SIMD_SCALAR && this->v->stride == 1
+      && other->v->stride == 1) {
+    return Simd::Dot(this->v->data, other->v->data, this->Size());
+  }
   double result;
   gsl_blas_ddot(this->v, other->v, &result);
   return result;
@@ -114,32 +155,39 @@ Vector *Vector::Multiply(Matrix *m) {
     exit(1);
   }
   gsl_vector *result = gsl_vector_alloc(m->Width());
-  cblas_dgemm(CblasRowMajor,  // const enum CBLAS_ORDER Order
-      CblasNoTrans,           // const enum CBLAS_TRANSPOSE TransA
-      CblasNoTrans,           // const enum CBLAS_TRANSPOSE TransB
-      1,                      // const int M
-      m->Width(),             // const int N
-      this->Size(),           // const int K
+  if (Reduction::Reproducible()) {
+    for (size_t col = 0; col < m->Width(); ++col) {
+      result->data[col] = Reduction::Dot(this->v->data, this->v->stride,
+          m->m->data + col, m->m->tda, this->Size());
+    }
+    return new Vector(result);
+  }
+  cblas_dgemv(CblasRowMajor,  // const enum CBLAS_ORDER Order
+      CblasTrans,             // const enum CBLAS_TRANSPOSE TransA
+      m->Height(),            // const int M (height of A)
+      m->Width(),             // const int N (width of A)
       1.0f,                   // const double alpha
-      this->v->data,          // const double * A
-      this->Size(),           // const int lda
-      m->m->data,             // const double * B
-      m->Width(),             // const int ldb
+      m->m->data,             // const double * A
+      m->m->tda,              // const int lda
+      this->v->data,          // const double * x
+      this->v->stride,        // const int incx
       0.0f,                   // const double beta
-      result->data,           // double * C
-      result->size);          // const int ldc
+      result->data,           // double * y
+      1);                     // const int incy
   return new Vector(result);
   // TODO(jrm) warning! newing up
 }
 
 Vector *Vector::Subtract(Vector *other) {
-  Vector *ret = new Vector(v->data, v->size);  // TODO(jrm) warning! newing up
+  Vector *ret = new Vector(v->size);  // TODO(jrm) warning! newing up
+  gsl_vector_memcpy(ret->v, v);
   gsl_vector_sub(ret->v, other->v);
   return ret;
 }
 
 Vector *Vector::Add(Vector *other) {
-  Vector *ret = new Vector(v->data, v->size);  // TODO(jrm) warning! newing up
+  Vector *ret = new Vector(v->size);  // TODO(jrm) warning! newing up
+  gsl_vector_memcpy(ret->v, v);
   gsl_vector_add(ret->v, other->v);
   return ret;
 }
@@ -157,7 +205,7 @@ size_t Vector::GetNumberOfClasses() {
 
 size_t Vector::NumberOfElements(FILE *f) {  // TODO(jrm): move to another class
   char lastChar = '\n';
-  char currentChar = NULL;
+  char currentChar = '\0';
   size_t count = 0;
   while ((currentChar = fgetc(f)) != EOF) {
     if (lastChar == '\n' && currentChar != '\n') {
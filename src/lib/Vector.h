@@ -5,6 +5,7 @@
 
 #include <gsl/gsl_matrix.h>
 
+#include "lib/Buffer.h"
 #include "lib/Matrix.h"
 
 namespace jason {
@@ -15,11 +16,16 @@ class Vector {
   public:
     explicit Vector(size_t size);
     explicit Vector(double *data, size_t size);
+    // Uses a buffer in place, element i at data[i * stride].
+    Vector(double *data, size_t size, size_t stride,
+        BufferOwnership ownership);
+    Vector(const float *data, size_t size, size_t stride);
     explicit Vector(const char* filename);
     virtual ~Vector();
     size_t Size();
     double Get(size_t elem);
     void Set(size_t elem, double value);
+    void Append(Vector *other);
     Matrix *RepmatVert(size_t k);
     Matrix *RepmatHoriz(size_t k);
     double Multiply(Vector *other);
@@ -34,6 +40,7 @@ class Vector {
     size_t NumberOfElements(FILE *f);
     gsl_vector *v;
     char *to_str;
+    double *adopted;  // Buffer to free(), see BufferOwnership
 };
 }
 
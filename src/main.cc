@@ -4,6 +4,8 @@
 #include <getopt.h>
 #include <ctype.h>
 #include <string.h>
+#include <math.h>
+#include <pthread.h>
 
 #include "lib/Matrix.h"
 #include "lib/Vector.h"
@@ -13,30 +15,80 @@
 #include "lib/GaussianKernel.h"
 #include "lib/Trainer.h"
 #include "lib/Predictor.h"
+#include "lib/Ensemble.h"
+#include "lib/MultilevelTrainer.h"
+#include "lib/CascadeTrainer.h"
+#include "lib/LocalExperts.h"
+#include "lib/KernelCache.h"
 #include "lib/GaussHermiteQuadrature.h"
+#include "lib/NormalCdfTable.h"
+#include "lib/QuantizedModel.h"
+#include "lib/Numa.h"
+#include "lib/Scheduler.h"
+#include "lib/Reduction.h"
+#include "lib/Simd.h"
 #include "lib/Log.h"
 #include "./main.h"
 
+#define SWEEP_HOLDOUT 5  // Every 5th sample of a class validates a sweep
+
 int main(int argc, char **argv) {
   jason::main(argc, argv);
 }
 
 namespace jason {
 
+static FILE *trace_file = NULL;
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+
 int main(int argc, char **argv) {
   int opt = 0;
   int long_opt_index = 0;
 
-  char *train_filename = NULL;
-  char *labels_filename = NULL;
-  char *test_filename = NULL;
-  char *answers_filename = NULL;
-  char *out_filename = NULL;
-  KernelType kernel = LINEAR;
+  Options options;
+  options.train_filename = NULL;
+  options.labels_filename = NULL;
+  options.test_filename = NULL;
+  options.answers_filename = NULL;
+  options.out_filename = NULL;
+  options.kernel = LINEAR;
+  options.kernel_param = -1;
+  options.tau = 0;
+  options.upsilon = 0;
+  options.cdf_mode = CDF_EXACT;
+  options.cdf_tolerance = 1e-7;
+  options.models = 1;
+  options.bootstrap = false;
+  options.seed = 0;
+  options.refresh_filename = NULL;
+  options.refresh_labels_filename = NULL;
+  options.refresh_iterations = 10;
+  options.weight_threshold = 0;
+  options.kernel_tolerance = 0;
+  options.fgt_tolerance = 0;
+  options.quantization = QUANTIZE_NONE;
+  options.posterior_variance = false;
+  options.numa_mode = NUMA_NONE;
+  options.pin = false;
+  options.threads = 0;
+  options.trace_filename = NULL;
+  options.reproducible = false;
+  options.feature_threshold = 0;
+  options.landmark_mode = LANDMARKS_NONE;
+  options.landmark_count = 100;
+  options.multilevel = 0;
+  options.level_factor = 4;
+  options.cascade = 0;
+  options.experts = 0;
+  options.routes = 1;
+  options.sweep = NULL;
+  options.simd_level = Simd::Detect();
   char *str_kernel = NULL;
-  int kernel_param = -1;
-  double tau = 0;
-  double upsilon = 0;
+  char *str_cdf_mode = NULL;
+  char *str_quantization = NULL;
+  char *str_numa_mode = NULL;
+  char *str_landmark_mode = NULL;
+  const char *str_simd_level = "AUTO";
 
   // no arguments given
   if (argc == 1) {
@@ -56,10 +108,39 @@ int main(int argc, char **argv) {
       { "param",    1, NULL,      'p' },
       { "tau",      1, NULL,      'T' },
       { "upsilon",  1, NULL,      'u' },
+      { "fast-cdf", 1, NULL,      'f' },
+      { "cdf-tol",  1, NULL,      'e' },
+      { "models",   1, NULL,      'm' },
+      { "bootstrap", 0, NULL,     'b' },
+      { "seed",     1, NULL,      's' },
+      { "refresh",  1, NULL,      'R' },
+      { "refresh-labels", 1, NULL, 'L' },
+      { "refresh-iter", 1, NULL,  'I' },
+      { "rv-threshold", 1, NULL,  'W' },
+      { "kernel-tol", 1, NULL,    'K' },
+      { "fgt-tol",  1, NULL,      'G' },
+      { "quantize", 1, NULL,      'q' },
+      { "posterior-variance", 0, NULL, 'P' },
+      { "numa",     1, NULL,      'N' },
+      { "pin",      0, NULL,      'A' },
+      { "threads",  1, NULL,      'j' },
+      { "trace",    1, NULL,      'X' },
+      { "reproducible", 0, NULL,  'Z' },
+      { "feature-threshold", 1, NULL, 'F' },
+      { "landmarks", 1, NULL,     'Y' },
+      { "landmark-count", 1, NULL, 'M' },
+      { "multilevel", 1, NULL,    'O' },
+      { "level-factor", 1, NULL,  'g' },
+      { "cascade",  1, NULL,      'C' },
+      { "experts",  1, NULL,      'E' },
+      { "routes",   1, NULL,      'U' },
+      { "sweep",    1, NULL,      'S' },
+      { "isa",      1, NULL,      'i' },
       { 0,          0, 0,         0  }
   };
 
-  while ((opt = getopt_long(argc, argv, "hVv:r:l:t:a:k:p:T:u:",
+  while ((opt = getopt_long(argc, argv, "hVv:r:l:t:a:k:p:T:u:"
+      "f:e:m:bs:R:L:I:W:K:G:q:PN:Aj:X:ZF:Y:M:O:g:C:E:U:S:i:",
       long_options, &long_opt_index)) != -1) {
     switch (opt) {
     case 'h':
@@ -73,31 +154,115 @@ int main(int argc, char **argv) {
       verbosity = atoi(optarg);
       break;
     case 'r':
-      train_filename = optarg;
+      options.train_filename = optarg;
       break;
     case 'l':
-      labels_filename = optarg;
+      options.labels_filename = optarg;
       break;
     case 't':
-      test_filename = optarg;
+      options.test_filename = optarg;
       break;
     case 'a':
-      answers_filename = optarg;
+      options.answers_filename = optarg;
       break;
     case 'o':
-      out_filename = optarg;
+      options.out_filename = optarg;
       break;
     case 'k':
-      handleKernelOption(&kernel, &str_kernel);
+      handleKernelOption(&options.kernel, &str_kernel);
       break;
     case 'p':
-      kernel_param = atoi(optarg);
+      options.kernel_param = atoi(optarg);
       break;
     case 'T':
-      tau = atof(optarg);
+      options.tau = atof(optarg);
       break;
     case 'u':
-      upsilon = atof(optarg);
+      options.upsilon = atof(optarg);
+      break;
+    case 'f':
+      handleCdfOption(&options.cdf_mode, &str_cdf_mode);
+      break;
+    case 'e':
+      options.cdf_tolerance = atof(optarg);
+      break;
+    case 'm':
+      options.models = atoi(optarg);
+      break;
+    case 'b':
+      options.bootstrap = true;
+      break;
+    case 's':
+      options.seed = strtoul(optarg, NULL, 10);
+      break;
+    case 'R':
+      options.refresh_filename = optarg;
+      break;
+    case 'L':
+      options.refresh_labels_filename = optarg;
+      break;
+    case 'I':
+      options.refresh_iterations = atoi(optarg);
+      break;
+    case 'W':
+      options.weight_threshold = atof(optarg);
+      break;
+    case 'K':
+      options.kernel_tolerance = atof(optarg);
+      break;
+    case 'G':
+      options.fgt_tolerance = atof(optarg);
+      break;
+    case 'q':
+      handleQuantizeOption(&options.quantization, &str_quantization);
+      break;
+    case 'P':
+      options.posterior_variance = true;
+      break;
+    case 'N':
+      handleNumaOption(&options.numa_mode, &str_numa_mode);
+      break;
+    case 'A':
+      options.pin = true;
+      break;
+    case 'j':
+      options.threads = atoi(optarg);
+      break;
+    case 'X':
+      options.trace_filename = optarg;
+      break;
+    case 'Z':
+      options.reproducible = true;
+      break;
+    case 'F':
+      options.feature_threshold = atof(optarg);
+      break;
+    case 'Y':
+      handleLandmarkOption(&options.landmark_mode, &str_landmark_mode);
+      break;
+    case 'M':
+      options.landmark_count = atoi(optarg);
+      break;
+    case 'O':
+      options.multilevel = atoi(optarg);
+      break;
+    case 'g':
+      options.level_factor = atof(optarg);
+      break;
+    case 'C':
+      options.cascade = atoi(optarg);
+      break;
+    case 'E':
+      options.experts = atoi(optarg);
+      break;
+    case 'U':
+      options.routes = atoi(optarg);
+      break;
+    case 'S':
+      options.sweep = optarg;
+      break;
+    case 'i':
+      handleSimdOption(&options.simd_level, &str_simd_level);
       break;
     case ':':
       fprintf(stderr, "%s: Error - Option `%c' needs a value\n\n", PACKAGE,
@@ -117,33 +282,167 @@ int main(int argc, char **argv) {
 
   LOG(VERBOSE, "Verbosity level = %d\n", verbosity)
   LOG(VERBOSE, "Kernel          = %s\n", str_kernel);
-  LOG(VERBOSE, "Training file   = %s\n", train_filename);
-  LOG(VERBOSE, "Labels file     = %s\n", labels_filename);
-  LOG(VERBOSE, "Test file       = %s\n", test_filename);
-  LOG(VERBOSE, "Answers file    = %s\n", answers_filename);
-  LOG(VERBOSE, "Out file        = %s\n", out_filename);
-  LOG(VERBOSE, "Kernel param    = %d\n", kernel_param);
-  LOG(VERBOSE, "Tau param       = %.3f\n", tau);
-  LOG(VERBOSE, "Upsilon param   = %.3f\n", upsilon);
-
-  if (train_filename == NULL) {
+  LOG(VERBOSE, "Training file   = %s\n", options.train_filename);
+  LOG(VERBOSE, "Labels file     = %s\n", options.labels_filename);
+  LOG(VERBOSE, "Test file       = %s\n", options.test_filename);
+  LOG(VERBOSE, "Answers file    = %s\n", options.answers_filename);
+  LOG(VERBOSE, "Out file        = %s\n", options.out_filename);
+  LOG(VERBOSE, "Kernel param    = %d\n", options.kernel_param);
+  LOG(VERBOSE, "Tau param       = %.3f\n", options.tau);
+  LOG(VERBOSE, "Upsilon param   = %.3f\n", options.upsilon);
+  LOG(VERBOSE, "Fast CDF        = %s\n", str_cdf_mode);
+  LOG(VERBOSE, "CDF tolerance   = %g\n", options.cdf_tolerance);
+  LOG(VERBOSE, "Models          = %zu%s\n", options.models,
+      options.bootstrap ? " (bootstrap)" : "");
+  LOG(VERBOSE, "Seed            = %lu\n", options.seed);
+  LOG(VERBOSE, "Refresh file    = %s\n", options.refresh_filename);
+  LOG(VERBOSE, "Refresh labels  = %s\n", options.refresh_labels_filename);
+  LOG(VERBOSE, "Refresh iter    = %zu\n", options.refresh_iterations);
+  LOG(VERBOSE, "RV threshold    = %g\n", options.weight_threshold);
+  LOG(VERBOSE, "Kernel tol      = %g\n", options.kernel_tolerance);
+  LOG(VERBOSE, "FGT tol         = %g\n", options.fgt_tolerance);
+  LOG(VERBOSE, "Quantize        = %s\n", str_quantization);
+  LOG(VERBOSE, "Posterior var   = %d\n", options.posterior_variance);
+  LOG(VERBOSE, "NUMA            = %s\n", str_numa_mode);
+  LOG(VERBOSE, "Pin             = %d\n", options.pin);
+  LOG(VERBOSE, "Threads         = %zu\n", options.threads);
+  LOG(VERBOSE, "Trace file      = %s\n", options.trace_filename);
+  LOG(VERBOSE, "Reproducible    = %d\n", options.reproducible);
+  LOG(VERBOSE, "Feature thresh  = %g\n", options.feature_threshold);
+  LOG(VERBOSE, "Landmarks       = %s\n", str_landmark_mode);
+  LOG(VERBOSE, "Landmark count  = %zu\n", options.landmark_count);
+  LOG(VERBOSE, "Multilevel      = %zu\n", options.multilevel);
+  LOG(VERBOSE, "Level factor    = %g\n", options.level_factor);
+  LOG(VERBOSE, "Cascade         = %zu\n", options.cascade);
+  LOG(VERBOSE, "Experts         = %zu\n", options.experts);
+  LOG(VERBOSE, "Routes          = %zu\n", options.routes);
+  LOG(VERBOSE, "Sweep           = %s\n", options.sweep);
+  LOG(VERBOSE, "ISA             = %s (%s)\n", str_simd_level,
+      Simd::Name(options.simd_level));
+
+  if (options.train_filename == NULL) {
     fprintf(stderr, "%s: Error - Training file must be specified.\n\n",
         PACKAGE);
     print_help(1);
-  } else if (labels_filename == NULL) {
+  } else if (options.labels_filename == NULL) {
     fprintf(stderr, "%s: Error - Labels file must be specified.\n\n", PACKAGE);
     print_help(1);
-  } else if (test_filename == NULL) {
+  } else if (options.test_filename == NULL) {
     fprintf(stderr, "%s: Error - Test file must be specified.\n\n", PACKAGE);
     print_help(1);
-  } else if (kernel_param == -1 && kernel != LINEAR) {
+  } else if (options.kernel_param == -1 && options.kernel != LINEAR) {
     fprintf(stderr, "%s: Error - Must specify param for non-linear kernel.\n\n",
         PACKAGE);
     print_help(1);
+  } else if ((options.refresh_filename == NULL)
+      != (options.refresh_labels_filename == NULL)) {
+    fprintf(stderr, "%s: Error - Refresh needs both samples and labels.\n\n",
+        PACKAGE);
+    print_help(1);
+  } else if (options.refresh_filename != NULL && options.models > 1) {
+    fprintf(stderr, "%s: Error - Refresh is not supported for ensembles.\n\n",
+        PACKAGE);
+    print_help(1);
+  } else if (options.quantization != QUANTIZE_NONE && options.models > 1) {
+    fprintf(stderr, "%s: Error - Quantization is not supported for "
+        "ensembles.\n\n", PACKAGE);
+    print_help(1);
+  } else if (options.posterior_variance && options.models > 1) {
+    fprintf(stderr, "%s: Error - Posterior variance is not supported for "
+        "ensembles.\n\n", PACKAGE);
+    print_help(1);
+  } else if (options.feature_threshold > 0 && options.kernel != GAUSSIAN) {
+    fprintf(stderr, "%s: Error - Feature pruning needs the gaussian "
+        "kernel.\n\n", PACKAGE);
+    print_help(1);
+  } else if (options.landmark_mode != LANDMARKS_NONE && options.models > 1) {
+    fprintf(stderr, "%s: Error - Landmarks are not supported for "
+        "ensembles.\n\n", PACKAGE);
+    print_help(1);
+  } else if (options.landmark_mode != LANDMARKS_NONE
+      && options.landmark_count == 0) {
+    fprintf(stderr, "%s: Error - Must start from at least one landmark.\n\n",
+        PACKAGE);
+    print_help(1);
+  } else if (options.multilevel > 0 && options.models > 1) {
+    fprintf(stderr, "%s: Error - Multilevel training is not supported for "
+        "ensembles.\n\n", PACKAGE);
+    print_help(1);
+  } else if (options.multilevel > 0 && options.level_factor <= 1) {
+    fprintf(stderr, "%s: Error - Level factor must exceed 1.\n\n", PACKAGE);
+    print_help(1);
+  } else if (options.cascade > 0 && options.models > 1) {
+    fprintf(stderr, "%s: Error - Cascade training is not supported for "
+        "ensembles.\n\n", PACKAGE);
+    print_help(1);
+  } else if (options.cascade > 0 && options.multilevel > 0) {
+    fprintf(stderr, "%s: Error - Choose either cascade or multilevel "
+        "training.\n\n", PACKAGE);
+    print_help(1);
+  } else if (options.experts > 0 && options.models > 1) {
+    fprintf(stderr, "%s: Error - Local experts are not supported for "
+        "ensembles.\n\n", PACKAGE);
+    print_help(1);
+  } else if (options.experts > 0
+      && (options.cascade > 0 || options.multilevel > 0)) {
+    fprintf(stderr, "%s: Error - Choose either local experts or cascade or "
+        "multilevel training.\n\n", PACKAGE);
+    print_help(1);
+  } else if (options.experts > 0 && (options.refresh_filename != NULL
+      || options.quantization != QUANTIZE_NONE
+      || options.posterior_variance)) {
+    fprintf(stderr, "%s: Error - Refresh, quantization and posterior "
+        "variance are not supported for local experts.\n\n", PACKAGE);
+    print_help(1);
+  } else if (options.routes == 0) {
+    fprintf(stderr, "%s: Error - Must route to at least one expert.\n\n",
+        PACKAGE);
+    print_help(1);
+  } else if (options.sweep != NULL && (options.models > 1
+      || options.landmark_mode != LANDMARKS_NONE || options.multilevel > 0
+      || options.cascade > 0 || options.experts > 0
+      || options.refresh_filename != NULL
+      || options.quantization != QUANTIZE_NONE
+      || options.posterior_variance)) {
+    fprintf(stderr, "%s: Error - A sweep trains single models on every "
+        "sample.\n\n", PACKAGE);
+    print_help(1);
+  } else if (options.simd_level > Simd::Detect()) {
+    fprintf(stderr, "%s: Error - This CPU supports at most %s.\n\n",
+        PACKAGE, Simd::Name(Simd::Detect()));
+    print_help(1);
+  } else if (options.models == 0) {
+    fprintf(stderr, "%s: Error - Must train at least one model.\n\n",
+        PACKAGE);
+    print_help(1);
   }
 
-  run(train_filename, labels_filename, test_filename, answers_filename,
-      out_filename, kernel, kernel_param, tau, upsilon);
+  if (options.numa_mode != NUMA_NONE || options.pin) {
+    Numa::Configure(options.numa_mode);
+  }
+  Scheduler::Configure(options.threads, options.pin ? Numa::Pin : NULL);
+  if (options.reproducible) {
+    Reduction::SetMode(REDUCTION_REPRODUCIBLE);
+  }
+  Simd::Select(options.simd_level);
+  LOG(VERBOSE, "Kernels run at  = %s\n", Simd::Name(Simd::Level()));
+  if (options.trace_filename != NULL) {
+    trace_file = fopen(options.trace_filename, "w");
+    if (trace_file == NULL) {
+      fprintf(stderr, "%s: Error - Cannot open trace file %s.\n\n", PACKAGE,
+          options.trace_filename);
+      exit(1);
+    }
+    fprintf(trace_file, "loop\tthread\tbegin\tend\tstart\tseconds\n");
+    Scheduler::SetTraceHook(TraceTask);
+  }
+
+  run(&options);
+
+  if (trace_file != NULL) {
+    Scheduler::SetTraceHook(NULL);
+    fclose(trace_file);
+  }
 
   return 0;
 }
@@ -162,6 +461,94 @@ void handleKernelOption(KernelType *kernel, char **kernel_str) {
   }
 }
 
+void handleCdfOption(CdfMode *mode, char **mode_str) {
+  *mode_str = optarg;
+  if (strcmp(optarg, "NONE") == 0) {
+    *mode = CDF_EXACT;
+  } else if (strcmp(optarg, "TRAIN") == 0) {
+    *mode = CDF_FAST_TRAIN;
+  } else if (strcmp(optarg, "PREDICT") == 0) {
+    *mode = CDF_FAST_PREDICT;
+  } else if (strcmp(optarg, "ALL") == 0) {
+    *mode = CDF_FAST_ALL;
+  } else {
+    fprintf(stderr, "%s: Error - Unknown CDF mode specified.\n\n", PACKAGE);
+    print_help(1);
+  }
+}
+
+void handleQuantizeOption(Quantization *quantization,
+    char **quantization_str) {
+  *quantization_str = optarg;
+  if (strcmp(optarg, "NONE") == 0) {
+    *quantization = QUANTIZE_NONE;
+  } else if (strcmp(optarg, "INT8") == 0) {
+    *quantization = QUANTIZE_INT8;
+  } else if (strcmp(optarg, "FP16") == 0) {
+    *quantization = QUANTIZE_FP16;
+  } else {
+    fprintf(stderr, "%s: Error - Unknown quantization specified.\n\n",
+        PACKAGE);
+    print_help(1);
+  }
+}
+
+// One line per scheduler task, written from the thread that ran it.
+void TraceTask(const TraceEvent *event) {
+  pthread_mutex_lock(&trace_lock);
+  fprintf(trace_file, "%s\t%zu\t%zu\t%zu\t%.6f\t%.6f\n", event->label,
+      event->worker, event->begin, event->end, event->start,
+      event->finish - event->start);
+  pthread_mutex_unlock(&trace_lock);
+}
+
+void handleNumaOption(NumaMode *mode, char **mode_str) {
+  *mode_str = optarg;
+  if (strcmp(optarg, "NONE") == 0) {
+    *mode = NUMA_NONE;
+  } else if (strcmp(optarg, "INTERLEAVE") == 0) {
+    *mode = NUMA_INTERLEAVE;
+  } else if (strcmp(optarg, "PARTITION") == 0) {
+    *mode = NUMA_PARTITION;
+  } else {
+    fprintf(stderr, "%s: Error - Unknown NUMA mode specified.\n\n", PACKAGE);
+    print_help(1);
+  }
+}
+
+void handleLandmarkOption(LandmarkMode *mode, char **mode_str) {
+  *mode_str = optarg;
+  if (strcmp(optarg, "NONE") == 0) {
+    *mode = LANDMARKS_NONE;
+  } else if (strcmp(optarg, "STRATIFIED") == 0) {
+    *mode = LANDMARKS_STRATIFIED;
+  } else if (strcmp(optarg, "KMEANS") == 0) {
+    *mode = LANDMARKS_KMEANS;
+  } else {
+    fprintf(stderr, "%s: Error - Unknown landmark mode specified.\n\n",
+        PACKAGE);
+    print_help(1);
+  }
+}
+
+void handleSimdOption(SimdLevel *level, const char **level_str) {
+  *level_str = optarg;
+  if (strcmp(optarg, "AUTO") == 0) {
+    *level = Simd::Detect();
+  } else if (strcmp(optarg, "SCALAR") == 0) {
+    *level = SIMD_SCALAR;
+  } else if (strcmp(optarg, "SSE4.2") == 0) {
+    *level = SIMD_SSE42;
+  } else if (strcmp(optarg, "AVX2") == 0) {
+    *level = SIMD_AVX2;
+  } else if (strcmp(optarg, "AVX512") == 0) {
+    *level = SIMD_AVX512;
+  } else {
+    fprintf(stderr, "%s: Error - Unknown ISA level specified.\n\n", PACKAGE);
+    print_help(1);
+  }
+}
+
 void print_help(int exval) {
   printf("%s, %s multi-class multi-kernel Relevance Vector Machines (mRVM)\n",
     PACKAGE, VERSION);
@@ -187,7 +574,102 @@ void print_help(int exval) {
   printf("  -p, --param n      set param for poly or gauss\n");
   printf("                     kernel to n.\n");
   printf("  -T, --tau n        set tau parameter\n");
-  printf("  -u, --upsilon n    set upsilon parameter\n\n");
+  printf("  -u, --upsilon n    set upsilon parameter\n");
+  printf("  -f, --fast-cdf     use the tabulated normal CDF in:\n");
+  printf("                       NONE (default)\n");
+  printf("                       TRAIN\n");
+  printf("                       PREDICT\n");
+  printf("                       ALL\n");
+  printf("  -e, --cdf-tol n    max abs error of the tabulated CDF\n");
+  printf("                     (default 1e-7)\n");
+  printf("  -m, --models n     train an ensemble of n models in\n");
+  printf("                     parallel and average them\n");
+  printf("  -b, --bootstrap    train each ensemble model on a\n");
+  printf("                     bootstrap sample\n");
+  printf("  -s, --seed n       set the random seed\n");
+  printf("  -R, --refresh FILE additional samples to learn incrementally\n");
+  printf("                     after training\n");
+  printf("  -L, --refresh-labels FILE\n");
+  printf("                     labels of the additional samples\n");
+  printf("  -I, --refresh-iter n\n");
+  printf("                     max update rounds for the refresh\n");
+  printf("                     (default 10)\n");
+  printf("  -W, --rv-threshold n\n");
+  printf("                     predict only with relevance vectors\n");
+  printf("                     whose weight row norm exceeds n\n");
+  printf("                     (default 0)\n");
+  printf("  -F, --feature-threshold n\n");
+  printf("                     train once, then drop the features\n");
+  printf("                     whose leave-one-feature-out margin\n");
+  printf("                     loss is below n times the largest\n");
+  printf("                     and train again on the rest\n");
+  printf("                     (gaussian only, default 0, off)\n");
+  printf("  -Y, --landmarks    start training from a subset of the\n");
+  printf("                     samples, chosen per class:\n");
+  printf("                       NONE (default, all samples)\n");
+  printf("                       STRATIFIED at random\n");
+  printf("                       KMEANS nearest the centroids\n");
+  printf("                     misclassified samples rejoin later\n");
+  printf("  -M, --landmark-count n\n");
+  printf("                     landmarks to start from, and most\n");
+  printf("                     samples readmitted at once (default\n");
+  printf("                     100)\n");
+  printf("  -O, --multilevel n train on n samples first, then on\n");
+  printf("                     growing stratified subsets seeded\n");
+  printf("                     by the previous model, up to all of\n");
+  printf("                     them (default 0, off)\n");
+  printf("  -g, --level-factor n\n");
+  printf("                     growth of each multilevel level\n");
+  printf("                     (default 4)\n");
+  printf("  -C, --cascade n    train n partitions of the samples in\n");
+  printf("                     parallel, then merge their relevance\n");
+  printf("                     vectors pairwise and retrain until\n");
+  printf("                     one model is left (default 0, off)\n");
+  printf("  -E, --experts n    split the samples into n k-means cells\n");
+  printf("                     and train one model per cell in\n");
+  printf("                     parallel (default 0, off)\n");
+  printf("  -U, --routes n     average the n experts nearest each\n");
+  printf("                     test sample (default 1)\n");
+  printf("  -S, --sweep LIST   train once per kernel param in the\n");
+  printf("                     comma separated LIST, from distances\n");
+  printf("                     or inner products computed once, and\n");
+  printf("                     test with the param that classifies\n");
+  printf("                     held-out training samples best\n");
+  printf("  -K, --kernel-tol n skip gaussian test kernel entries\n");
+  printf("                     below n via a KD-tree (default 0,\n");
+  printf("                     evaluate every entry)\n");
+  printf("  -G, --fgt-tol n    score gaussian models with the fast\n");
+  printf("                     Gauss transform to abs error n\n");
+  printf("                     (default 0, off)\n");
+  printf("  -q, --quantize     predict with the model stored in:\n");
+  printf("                       NONE (default)\n");
+  printf("                       INT8\n");
+  printf("                       FP16\n");
+  printf("                     and report agreement with the\n");
+  printf("                     double precision predictions\n");
+  printf("  -P, --posterior-variance\n");
+  printf("                     include the posterior uncertainty of\n");
+  printf("                     the weights in the probabilities\n");
+  printf("  -j, --threads n    threads for all parallel loops,\n");
+  printf("                     BLAS included (default 0, one per\n");
+  printf("                     online CPU)\n");
+  printf("  -N, --numa         place the kernel's memory:\n");
+  printf("                       NONE (default)\n");
+  printf("                       INTERLEAVE over all nodes\n");
+  printf("                       PARTITION on each thread's node\n");
+  printf("  -A, --pin          pin each thread to its node's CPUs\n");
+  printf("  -X, --trace FILE   write the timing of every parallel\n");
+  printf("                     task to FILE\n");
+  printf("  -Z, --reproducible sum in a fixed order without BLAS, for\n");
+  printf("                     bitwise identical results on any\n");
+  printf("                     thread count and BLAS build (runs\n");
+  printf("                     the scalar kernels)\n");
+  printf("  -i, --isa          vector instructions of the kernels:\n");
+  printf("                       AUTO (default, best the CPU has)\n");
+  printf("                       SCALAR\n");
+  printf("                       SSE4.2\n");
+  printf("                       AVX2\n");
+  printf("                       AVX512\n\n");
 
   printf("Based upon work by Psorakis, Damoulas, Girolami.\n");
   printf("Implementation by Marcell, jasonmarcell@gmail.com\n\n");
@@ -195,93 +677,401 @@ void print_help(int exval) {
   exit(exval);
 }
 
-void run(char *train_filename, char *labels_filename, char *test_filename,
-    char *answers_filename, char *out_filename, KernelType kernel_type,
-    int kernel_param, double tau, double upsilon) {
-  Matrix *train  = new Matrix(train_filename);
-  Vector *labels = new Vector(labels_filename);
-  Matrix *test   = new Matrix(test_filename);
-  size_t classes = labels->GetNumberOfClasses();
-
-  LOG(VERBOSE, "=== Starting... ===\n");
-
-  train->CacheMeansAndStdevs();
-  train->Sphere();
-  test->Sphere(train);
-
-  Kernel *train_kernel;
-  Kernel *test_kernel;
+Kernel *CreateKernel(KernelType kernel_type, Matrix *m1, Matrix *m2,
+    int kernel_param) {
   switch (kernel_type) {
   case LINEAR:
     LOG(DEBUG, "Creating Linear Kernels.\n");
-    train_kernel = new LinearKernel(train, train);
-    break;
+    return new LinearKernel(m1, m2);
   case POLYNOMIAL:
     LOG(DEBUG, "Creating Polynomial Kernels.\n");
-    train_kernel = new PolynomialKernel(train, train, kernel_param);
-    break;
+    return new PolynomialKernel(m1, m2, kernel_param);
   case GAUSSIAN:
     LOG(DEBUG, "Creating Gaussian Kernels.\n");
-    train_kernel = new GaussianKernel(train, train, kernel_param);
-    break;
+    return new GaussianKernel(m1, m2, kernel_param);
   default:
     fprintf(stderr, "%s: Error - No such kernel.\n", PACKAGE);
     print_help(1);
   }
+  return NULL;
+}
 
-  // Pass in training points, labels, and number of classes
-  Trainer *trainer = new Trainer(train, labels, classes, train_kernel);
-  trainer->Process(tau, upsilon);
+void run(Options *options) {
+  Matrix *train  = new Matrix(options->train_filename);
+  Vector *labels = new Vector(options->labels_filename);
+  Matrix *test   = new Matrix(options->test_filename);
+  size_t classes = labels->GetNumberOfClasses();
 
-  switch (kernel_type) {
-  case LINEAR:
-    LOG(DEBUG, "Creating Linear Kernels.\n");
-    test_kernel = new LinearKernel(train, test);
-    break;
-  case POLYNOMIAL:
-    LOG(DEBUG, "Creating Polynomial Kernels.\n");
-    test_kernel = new PolynomialKernel(train, test, kernel_param);
-    break;
-  case GAUSSIAN:
-    LOG(DEBUG, "Creating Gaussian Kernels.\n");
-    test_kernel = new GaussianKernel(train, test, kernel_param);
-    break;
-  default:
-    fprintf(stderr, "%s: Error - No such kernel.\n", PACKAGE);
-    print_help(1);
+  LOG(VERBOSE, "=== Starting... ===\n");
+
+  train->CacheMeansAndStdevs();
+  train->Sphere();
+  test->Sphere(train);
+
+  Kernel *train_kernel = CreateKernel(options->kernel, train, train,
+      options->kernel_param);
+  Kernel *test_kernel;
+
+  Vector *features = NULL;
+  if (options->feature_threshold > 0) {
+    features = SelectFeatures(options, train, labels, classes,
+        static_cast<GaussianKernel*>(train_kernel));
+    train->RemoveColumns(features);
+    test->RemoveColumns(features);
+    delete train_kernel;
+    train_kernel = CreateKernel(options->kernel, train, train,
+        options->kernel_param);
   }
 
-  // Pass in the w matrix, the training points, and the testing points
-  Predictor *predictor = new Predictor(trainer->GetW(), train, test,
-      test_kernel);
-  Matrix *predictions = predictor->Predict();
+  NormalCdfTable *cdf_table = NULL;
+  if (options->cdf_mode != CDF_EXACT) {
+    cdf_table = new NormalCdfTable(options->cdf_tolerance);
+  }
+  NormalCdfTable *train_cdf_table =
+      (options->cdf_mode & CDF_FAST_TRAIN) ? cdf_table : NULL;
+  NormalCdfTable *predict_cdf_table =
+      (options->cdf_mode & CDF_FAST_PREDICT) ? cdf_table : NULL;
+
+  Matrix *predictions;
+  if (options->sweep != NULL) {
+    predictions = Sweep(options, train, labels, test, classes, train_kernel,
+        train_cdf_table, predict_cdf_table);
+    test_kernel = NULL;
+  } else if (options->models > 1) {
+    Ensemble *ensemble = new Ensemble(train, labels, classes, train_kernel,
+        options->models, options->bootstrap);
+    if (options->seed != 0) {
+      ensemble->SetSeed(options->seed);
+    }
+    ensemble->SetCdfTables(train_cdf_table, predict_cdf_table);
+    ensemble->Process(options->tau, options->upsilon);
+
+    test_kernel = CreateKernel(options->kernel,
+        ensemble->GetRelevanceVectors(), test, options->kernel_param);
+    predictions = ensemble->Predict(test, test_kernel);
+    delete ensemble;
+  } else if (options->experts > 0) {
+    LocalExperts *experts = new LocalExperts(train, labels, classes,
+        train_kernel, options->experts);
+    experts->SetSeed(options->seed);
+    experts->SetCdfTables(train_cdf_table, predict_cdf_table);
+    if (options->landmark_mode != LANDMARKS_NONE) {
+      experts->SetLandmarks(options->landmark_mode, options->landmark_count);
+    }
+    experts->SetRoutes(options->routes);
+    experts->Process(options->tau, options->upsilon);
+
+    test_kernel = CreateKernel(options->kernel, train, test,
+        options->kernel_param);
+    predictions = experts->Predict(test, test_kernel);
+    delete experts;
+  } else {
+    Trainer *trainer;
+    MultilevelTrainer *multilevel = NULL;
+    CascadeTrainer *cascade = NULL;
+    if (options->cascade > 0) {
+      cascade = new CascadeTrainer(train, labels, classes, train_kernel,
+          options->cascade);
+      cascade->SetSeed(options->seed);
+      cascade->SetCdfTable(train_cdf_table);
+      cascade->Process(options->tau, options->upsilon);
+      trainer = cascade->GetTrainer();
+    } else if (options->multilevel > 0) {
+      multilevel = new MultilevelTrainer(train, labels, classes,
+          train_kernel);
+      multilevel->SetLevels(options->multilevel, options->level_factor);
+      if (options->landmark_mode != LANDMARKS_NONE) {
+        multilevel->SetLandmarks(options->landmark_mode,
+            options->landmark_count);
+      }
+      multilevel->SetSeed(options->seed);
+      multilevel->SetCdfTable(train_cdf_table);
+      multilevel->Process(options->tau, options->upsilon);
+      trainer = multilevel->GetTrainer();
+    } else {
+      // Pass in training points, labels, and number of classes
+      trainer = new Trainer(train, labels, classes, train_kernel);
+      trainer->SetSeed(options->seed);
+      trainer->SetCdfTable(train_cdf_table);
+      trainer->SetLandmarks(options->landmark_mode, options->landmark_count);
+      trainer->Process(options->tau, options->upsilon);
+    }
+
+    if (options->refresh_filename) {
+      Matrix *refresh = new Matrix(options->refresh_filename);
+      Vector *refresh_labels = new Vector(options->refresh_labels_filename);
+      refresh->Sphere(train);
+      if (features != NULL) {
+        refresh->RemoveColumns(features);
+      }
+      if (!trainer->Update(refresh, refresh_labels,
+          options->refresh_iterations, options->tau, options->upsilon)) {
+        fprintf(stderr, "%s: Error - Cannot refresh this model.\n\n",
+            PACKAGE);
+        exit(1);
+      }
+      delete refresh_labels;
+      delete refresh;
+    }
+
+    Matrix *relevance_vectors = trainer->GetRelevanceVectors();
+    test_kernel = CreateKernel(options->kernel, relevance_vectors, test,
+        options->kernel_param);
+
+    // Pass in the w matrix, the relevance vectors, and the testing points
+    Predictor *predictor = new Predictor(trainer->GetW(), relevance_vectors,
+        test, test_kernel);
+    predictor->SetCdfTable(predict_cdf_table);
+    predictor->SetWeightThreshold(options->weight_threshold);
+    predictor->SetKernelTolerance(options->kernel_tolerance);
+    predictor->SetFastGaussTolerance(options->fgt_tolerance);
+    if (options->posterior_variance) {
+      predictor->SetPosteriorFactors(trainer->GetPosteriorFactors());
+    }
+    predictions = predictor->Predict();
+
+    if (options->quantization != QUANTIZE_NONE) {
+      QuantizedModel *quantized = new QuantizedModel(relevance_vectors,
+          trainer->GetW(), options->kernel, options->kernel_param,
+          options->quantization);
+      Matrix *scores = quantized->Scores(test);
+      Matrix *quantized_predictions =
+          predictor->QuadratureApproximation(scores);
+      quantized_predictions->NormalizeResults();
+      if (quantized->Bytes() > 0) {
+        LOG(NORMAL, "Quantized model: %zu bytes (%.1fx smaller)\n",
+            quantized->Bytes(), static_cast<double>(quantized->DoubleBytes())
+            / quantized->Bytes());
+      } else {
+        LOG(NORMAL, "Quantized model: 0 bytes (no relevance vectors)\n");
+      }
+      ReportAgreement(predictions, quantized_predictions);
+      delete predictions;
+      predictions = quantized_predictions;
+      delete scores;
+      delete quantized;
+    }
+    delete predictor;
+    delete relevance_vectors;
+    if (cascade != NULL) {
+      delete cascade;
+    } else if (multilevel != NULL) {
+      delete multilevel;
+    } else {
+      delete trainer;
+    }
+  }
 
   LOG(VERBOSE, "= Predictions: =\n");
   LOG(VERBOSE, "%s\n", predictions->ToString());
 
-  if (answers_filename) {
-    Vector *answers = new Vector(answers_filename);
+  if (options->answers_filename) {
+    Vector *answers = new Vector(options->answers_filename);
     PerformEvaluation(predictions, answers);
     delete answers;
   }
 
-  if (out_filename) {
-    LOG(VERBOSE, "Writing to file %s.\n", out_filename);
-    predictions->Write(out_filename);
+  if (options->out_filename) {
+    LOG(VERBOSE, "Writing to file %s.\n", options->out_filename);
+    predictions->Write(options->out_filename);
   }
 
   delete train;
   delete labels;
   delete test;
+  delete features;
   delete predictions;
-  delete predictor;
-  delete trainer;
   delete train_kernel;
   delete test_kernel;
+  delete cdf_table;
 
   LOG(VERBOSE, "=== End. ===\n");
 }
 
+// Trains a first model on every feature and keeps the features whose
+// leave-one-feature-out relevance to it is positive and at least
+// options->feature_threshold times the largest.
+// Returns a mask for Matrix::RemoveColumns, 1 for the features kept.
+Vector *SelectFeatures(Options *options, Matrix *train, Vector *labels,
+    size_t classes, GaussianKernel *kernel) {
+  Trainer *trainer = new Trainer(train, labels, classes, kernel);
+  trainer->SetSeed(options->seed);
+  trainer->Process(options->tau, options->upsilon);
+  Matrix *relevance_vectors = trainer->GetRelevanceVectors();
+  Vector *relevance = kernel->FeatureRelevance(relevance_vectors,
+      trainer->GetW(), train, labels);
+  size_t best = 0;
+  for (size_t d = 1; d < relevance->Size(); ++d) {
+    if (relevance->Get(d) > relevance->Get(best)) {
+      best = d;
+    }
+  }
+  double cutoff = options->feature_threshold * relevance->Get(best);
+  Vector *features = new Vector(relevance->Size());
+  size_t kept = 0;
+  for (size_t d = 0; d < relevance->Size(); ++d) {
+    // Keeps the best feature even when none of them helps the margin.
+    bool keep = d == best || (relevance->Get(d) > 0
+        && relevance->Get(d) >= cutoff);
+    features->Set(d, keep ? 1 : 0);
+    kept += keep;
+    LOG(VERBOSE, "Feature %zu relevance %g%s\n", d, relevance->Get(d),
+        keep ? "" : " (dropped)");
+  }
+  LOG(NORMAL, "Kept %zu of %zu features.\n", kept, relevance->Size());
+  delete relevance;
+  delete relevance_vectors;
+  delete trainer;
+  return features;
+}
+
+// Trains one model per kernel parameter in options->sweep on the training
+// samples less every SWEEP_HOLDOUT-th one of each class, and retrains on
+// every sample with the parameter that classifies those held-out samples
+// best; the test answers play no part in the choice.  The squared
+// distances or inner products between the training samples, and between
+// them and the test samples, are computed once; each parameter then only
+// transforms them element-wise into the two kernels.  The test kernel
+// spans every training sample, with zero weights off the relevance
+// vectors, so it does not depend on the model.
+// Returns the predictions of the chosen parameter.
+Matrix *Sweep(Options *options, Matrix *train, Vector *labels, Matrix *test,
+    size_t classes, Kernel *train_kernel, NormalCdfTable *train_cdf_table,
+    NormalCdfTable *predict_cdf_table) {
+  Kernel *test_kernel = CreateKernel(options->kernel, train, test,
+      options->kernel_param);
+  KernelCache *train_cache = new KernelCache(train, train,
+      train_kernel->BaseType());
+  KernelCache *test_cache = new KernelCache(train, test,
+      test_kernel->BaseType());
+  train_kernel->SetCache(train_cache);
+  test_kernel->SetCache(test_cache);
+
+  size_t *seen = new size_t[classes];
+  for (size_t c = 0; c < classes; ++c) {
+    seen[c] = 0;
+  }
+  size_t held = 0;
+  bool *held_out = new bool[train->Height()];
+  for (size_t n = 0; n < train->Height(); ++n) {
+    held_out[n] = ++seen[static_cast<size_t>(labels->Get(n))]
+        % SWEEP_HOLDOUT == 0;
+    held += held_out[n];
+  }
+  Vector *fit_rows = new Vector(train->Height() - held);
+  Vector *held_rows = new Vector(held);
+  for (size_t n = 0, fit = 0, validate = 0; n < train->Height(); ++n) {
+    if (held_out[n]) {
+      held_rows->Set(validate++, n);
+    } else {
+      fit_rows->Set(fit++, n);
+    }
+  }
+  delete[] held_out;
+  delete[] seen;
+
+  int best_param = options->kernel_param;
+  double best_accuracy = -1;
+  Matrix *scores = new Matrix(1, classes);
+  char *params = strdup(options->sweep);
+  char *save = NULL;
+  for (char *param = strtok_r(params, ",", &save); param != NULL;
+      param = strtok_r(NULL, ",", &save)) {
+    train_kernel->SetOperands(train, train);
+    train_kernel->SetParam(atoi(param));
+    train_kernel->Init();
+    Trainer *trainer = new Trainer(train_kernel, labels, classes, fit_rows);
+    trainer->SetSeed(options->seed);
+    trainer->SetCdfTable(train_cdf_table);
+    trainer->Process(options->tau, options->upsilon);
+
+    Vector *active = trainer->GetActive();
+    Matrix *w = trainer->GetW();
+    size_t correct = 0;
+    for (size_t i = 0; i < held_rows->Size(); ++i) {
+      size_t n = held_rows->Get(i);
+      scores->SetAll(0.0);
+      for (size_t row = 0; row < active->Size(); ++row) {
+        double elem = train_kernel->Get(active->Get(row), n);
+        for (size_t c = 0; c < classes; ++c) {
+          scores->Set(0, c, scores->Get(0, c) + elem * w->Get(row, c));
+        }
+      }
+      correct += ArgMax(scores, 0) == labels->Get(n);
+    }
+    double accuracy = held > 0 ? static_cast<double>(correct) / held : 0;
+    LOG(NORMAL, "Param %d: %zu relevance vectors, held-out percent correct "
+        "%.3f\n", atoi(param), active->Size(), accuracy);
+    if (accuracy > best_accuracy) {
+      best_param = atoi(param);
+      best_accuracy = accuracy;
+    }
+    delete trainer;
+  }
+  free(params);
+  delete scores;
+  delete held_rows;
+  delete fit_rows;
+  LOG(NORMAL, "Testing with param %d.\n", best_param);
+
+  // The trainer prunes the kernel it is given in place.
+  train_kernel->SetOperands(train, train);
+  train_kernel->SetParam(best_param);
+  test_kernel->SetParam(best_param);
+  Trainer *trainer = new Trainer(train, labels, classes, train_kernel);
+  trainer->SetSeed(options->seed);
+  trainer->SetCdfTable(train_cdf_table);
+  trainer->Process(options->tau, options->upsilon);
+
+  Vector *active = trainer->GetActive();
+  Matrix *w = new Matrix(train->Height(), classes);
+  w->SetAll(0.0);
+  for (size_t row = 0; row < active->Size(); ++row) {
+    for (size_t c = 0; c < classes; ++c) {
+      w->Set(active->Get(row), c, trainer->GetW()->Get(row, c));
+    }
+  }
+  Predictor *predictor = new Predictor(w, NULL, test, test_kernel);
+  predictor->SetCdfTable(predict_cdf_table);
+  Matrix *predictions = predictor->Predict();
+  delete predictor;
+  delete w;
+  delete trainer;
+  train_kernel->SetCache(NULL);
+  delete test_cache;
+  delete train_cache;
+  delete test_kernel;
+  return predictions;
+}
+
+size_t ArgMax(Matrix *m, size_t row) {
+  size_t max_index = 0;
+  for (size_t col = 1; col < m->Width(); ++col) {
+    if (m->Get(row, col) > m->Get(row, max_index)) {
+      max_index = col;
+    }
+  }
+  return max_index;
+}
+
+// Compares the predictions of a reduced precision model against the
+// reference ones: how often the predicted class matches, and the largest
+// difference between class probabilities.
+void ReportAgreement(Matrix *reference, Matrix *predictions) {
+  size_t agree = 0;
+  double max_difference = 0;
+  for (size_t row = 0; row < reference->Height(); ++row) {
+    agree += ArgMax(reference, row) == ArgMax(predictions, row);
+    for (size_t col = 0; col < reference->Width(); ++col) {
+      max_difference = fmax(max_difference,
+          fabs(reference->Get(row, col) - predictions->Get(row, col)));
+    }
+  }
+  LOG(NORMAL, "Agreement with double precision: %.3f "
+      "(max probability difference %.2e)\n",
+      static_cast<double>(agree) / reference->Height(), max_difference);
+}
+
 void PerformEvaluation(Matrix *predictions, Vector *answers) {
   LOG(DEBUG, "= Evaluation =\n");
   size_t total_correct = 0;
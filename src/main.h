@@ -10,12 +10,66 @@ extern int verbosity;
 
 namespace jason {
 
+struct Options {
+  char *train_filename;
+  char *labels_filename;
+  char *test_filename;
+  char *answers_filename;
+  char *out_filename;
+  KernelType kernel;
+  int kernel_param;
+  double tau;
+  double upsilon;
+  CdfMode cdf_mode;
+  double cdf_tolerance;
+  size_t models;
+  bool bootstrap;
+  unsigned long seed;
+  char *refresh_filename;
+  char *refresh_labels_filename;
+  size_t refresh_iterations;
+  double weight_threshold;
+  double kernel_tolerance;
+  double fgt_tolerance;
+  Quantization quantization;
+  bool posterior_variance;
+  NumaMode numa_mode;
+  bool pin;
+  size_t threads;
+  char *trace_filename;
+  bool reproducible;
+  double feature_threshold;
+  LandmarkMode landmark_mode;
+  size_t landmark_count;
+  size_t multilevel;
+  double level_factor;
+  size_t cascade;
+  size_t experts;
+  size_t routes;
+  char *sweep;
+  SimdLevel simd_level;
+};
+
 int main(int argc, char **argv);
 void print_help(int exval);
-void run(char *train_filename, char *labels_filename, char *test_filename,
-    char *answers_filename, char *out_filename, KernelType kernel_type,
-    int kernel_param, double tau, double upsilon);
+void run(Options *options);
+Kernel *CreateKernel(KernelType kernel_type, Matrix *m1, Matrix *m2,
+    int kernel_param);
 void handleKernelOption(KernelType *kernel, char **kernel_str);
+void handleCdfOption(CdfMode *mode, char **mode_str);
+void handleQuantizeOption(Quantization *quantization,
+    char **quantization_str);
+void handleNumaOption(NumaMode *mode, char **mode_str);
+void handleLandmarkOption(LandmarkMode *mode, char **mode_str);
+void handleSimdOption(SimdLevel *level, const char **level_str);
+void TraceTask(const TraceEvent *event);
+Vector *SelectFeatures(Options *options, Matrix *train, Vector *labels,
+    size_t classes, GaussianKernel *kernel);
+Matrix *Sweep(Options *options, Matrix *train, Vector *labels, Matrix *test,
+    size_t classes, Kernel *train_kernel, NormalCdfTable *train_cdf_table,
+    NormalCdfTable *predict_cdf_table);
+size_t ArgMax(Matrix *m, size_t row);
+void ReportAgreement(Matrix *reference, Matrix *predictions);
 void PerformEvaluation(Matrix *predictions, Vector *answers);
 }
 
@@ -0,0 +1,610 @@
+// Copyright 2011 Jason Marcell
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include <new>
+
+#include "./mrvm.h"
+#include "lib/Matrix.h"
+#include "lib/Vector.h"
+#include "lib/Kernel.h"
+#include "lib/LinearKernel.h"
+#include "lib/PolynomialKernel.h"
+#include "lib/GaussianKernel.h"
+#include "lib/Trainer.h"
+#include "lib/Predictor.h"
+#include "lib/PredictionCache.h"
+#include "lib/ModelRegistry.h"
+#include "lib/Scheduler.h"
+#include "lib/Reduction.h"
+#include "lib/Log.h"
+
+#define MODEL_MAGIC "mRVM-model"
+#define SHARED_MAGIC 0x6c65646f4d56526dULL  // "mRVMModl"
+#define SHARED_LAYOUT 1
+
+struct mrvm_model {
+  jason::KernelType kernel;
+  int kernel_param;
+  size_t classes;
+  jason::Vector *means;   // Sphering of the training data
+  jason::Vector *stdevs;
+  jason::Matrix *relevance_vectors;  // Sphered
+  jason::Matrix *w;
+  uint64_t version;  // Unique per trained or loaded model
+  // Attached models view a read-only shared memory segment.
+  jason::ModelRegistry *registry;
+  const void *mapping;
+  size_t mapping_bytes;
+  uint64_t generation;
+};
+
+// Start of a shared memory model, followed by the means, stdevs, relevance
+// vectors and w as doubles, matrices row-major.
+struct SharedModelHeader {
+  uint64_t magic;
+  uint32_t layout;
+  int32_t kernel;
+  int32_t kernel_param;
+  uint32_t reserved;
+  uint64_t classes;
+  uint64_t features;
+  uint64_t rows;
+};
+
+struct mrvm_cache {
+  jason::PredictionCache *cache;
+};
+
+namespace jason {
+
+namespace {
+
+Kernel *NewKernel(KernelType kernel, Matrix *m1, Matrix *m2, int param) {
+  switch (kernel) {
+  case POLYNOMIAL:
+    return new PolynomialKernel(m1, m2, param);
+  case GAUSSIAN:
+    return new GaussianKernel(m1, m2, param);
+  default:
+    return new LinearKernel(m1, m2);
+  }
+}
+
+Matrix *Copy(Matrix *m) {
+  Matrix *ret = new Matrix(m->Height(), m->Width());
+  for (size_t row = 0; row < m->Height(); ++row) {
+    for (size_t col = 0; col < m->Width(); ++col) {
+      ret->Set(row, col, m->Get(row, col));
+    }
+  }
+  return ret;
+}
+
+Vector *Copy(Vector *v) {
+  Vector *ret = new Vector(v->Size());
+  for (size_t i = 0; i < v->Size(); ++i) {
+    ret->Set(i, v->Get(i));
+  }
+  return ret;
+}
+
+uint64_t model_versions = 0;
+
+// Doubles stored for a model of these dimensions, or 0 if that many would
+// not fit in the address space.
+size_t ModelValues(uint64_t features, uint64_t rows, uint64_t classes) {
+  const uint64_t limit = SIZE_MAX / sizeof(double);
+  if (features == 0 || features > limit / 2 || classes > limit - features) {
+    return 0;
+  }
+  uint64_t per_row = features + classes;
+  if (rows > (limit - 2 * features) / per_row) {
+    return 0;
+  }
+  return 2 * features + rows * per_row;
+}
+
+mrvm_model *NewModel(KernelType kernel, int kernel_param, size_t classes) {
+  mrvm_model *model = new mrvm_model;
+  model->version = __sync_add_and_fetch(&model_versions, 1);
+  model->kernel = kernel;
+  model->kernel_param = kernel_param;
+  model->classes = classes;
+  model->means = NULL;
+  model->stdevs = NULL;
+  model->relevance_vectors = NULL;
+  model->w = NULL;
+  model->registry = NULL;
+  model->mapping = NULL;
+  model->mapping_bytes = 0;
+  model->generation = 0;
+  return model;
+}
+
+void WriteRow(FILE *f, Vector *v) {
+  for (size_t i = 0; i < v->Size(); ++i) {
+    fprintf(f, i == 0 ? "%.17g" : " %.17g", v->Get(i));
+  }
+  fprintf(f, "\n");
+}
+
+void WriteRows(FILE *f, Matrix *m) {
+  for (size_t row = 0; row < m->Height(); ++row) {
+    Vector *v = m->Row(row);
+    WriteRow(f, v);
+    delete v;
+  }
+}
+
+double *CopyValues(Vector *v, double *out) {
+  for (size_t i = 0; i < v->Size(); ++i) {
+    *out++ = v->Get(i);
+  }
+  return out;
+}
+
+double *CopyValues(Matrix *m, double *out) {
+  for (size_t row = 0; row < m->Height(); ++row) {
+    for (size_t col = 0; col < m->Width(); ++col) {
+      *out++ = m->Get(row, col);
+    }
+  }
+  return out;
+}
+
+// Maps the registry's current generation into a model whose matrices view
+// the mapping.  Takes ownership of the registry on success.
+int AttachModel(ModelRegistry *registry, mrvm_model **model) {
+  uint64_t generation;
+  size_t bytes;
+  const void *data = registry->Attach(&generation, &bytes);
+  if (data == NULL) {
+    return MRVM_ERROR_IO;
+  }
+  const SharedModelHeader *header =
+      reinterpret_cast<const SharedModelHeader*>(data);
+  size_t values = bytes < sizeof(*header) ? 0
+      : ModelValues(header->features, header->rows, header->classes);
+  if (bytes < sizeof(*header) || header->magic != SHARED_MAGIC
+      || header->layout != SHARED_LAYOUT
+      || header->kernel < MRVM_LINEAR || header->kernel > MRVM_GAUSSIAN
+      || header->classes == 0 || values == 0
+      || (bytes - sizeof(*header)) / sizeof(double) < values) {
+    ModelRegistry::Detach(data, bytes);
+    return MRVM_ERROR_FORMAT;
+  }
+  size_t features = header->features;
+  size_t rows = header->rows;
+  size_t classes = header->classes;
+  double *in = const_cast<double*>(
+      reinterpret_cast<const double*>(header + 1));
+  mrvm_model *ret = NewModel(static_cast<KernelType>(header->kernel),
+      header->kernel_param, classes);
+  ret->means = new Vector(in, features, 1, BUFFER_VIEW);
+  ret->stdevs = new Vector(in + features, features, 1, BUFFER_VIEW);
+  in += 2 * features;
+  ret->relevance_vectors = new Matrix(in, rows, features, features,
+      BUFFER_VIEW);
+  ret->w = new Matrix(in + rows * features, rows, classes, classes,
+      BUFFER_VIEW);
+  ret->registry = registry;
+  ret->mapping = data;
+  ret->mapping_bytes = bytes;
+  ret->generation = generation;
+  *model = ret;
+  return MRVM_OK;
+}
+
+// The caller's rows without copying doubles; floats are converted.
+Matrix *RawRows(const void *x, int type, size_t samples, size_t features,
+    size_t stride) {
+  if (type == MRVM_FLOAT) {
+    return new Matrix(static_cast<const float*>(x), samples, features,
+        stride);
+  }
+  return new Matrix(const_cast<double*>(static_cast<const double*>(x)),
+      samples, features, stride, BUFFER_VIEW);
+}
+
+// Frees rows from RawRows() and returns them sphered.  Converted floats
+// are already a copy and are sphered in place; viewed doubles are sphered
+// into a new matrix.
+Matrix *SphereRows(Matrix *rows, int type, Vector *means, Vector *stdevs) {
+  if (type == MRVM_FLOAT) {
+    rows->Sphere(means, stdevs);
+    return rows;
+  }
+  Matrix *ret = rows->Sphered(means, stdevs);
+  delete rows;
+  return ret;
+}
+
+bool ValidRows(const void *x, int type, size_t stride, size_t samples,
+    size_t features) {
+  return x != NULL && (type == MRVM_DOUBLE || type == MRVM_FLOAT)
+      && samples != 0 && features != 0 && stride >= features;
+}
+
+bool ReadValues(FILE *f, size_t count, double *out) {
+  for (size_t i = 0; i < count; ++i) {
+    if (fscanf(f, "%lf", &out[i]) != 1) {
+      return false;
+    }
+  }
+  return true;
+}
+}  // namespace
+}  // namespace jason
+
+using jason::Matrix;
+using jason::Vector;
+
+extern "C" {
+
+void mrvm_default_params(mrvm_params *params) {
+  params->kernel = MRVM_LINEAR;
+  params->kernel_param = 1;
+  params->tau = 1e-6;
+  params->upsilon = 1e-6;
+  params->seed = 0;
+}
+
+int mrvm_train(const double *x, const int *labels, size_t samples,
+    size_t features, const mrvm_params *params, mrvm_model **model) {
+  return mrvm_train_strided(x, MRVM_DOUBLE, features, labels, samples,
+      features, params, model);
+}
+
+int mrvm_train_strided(const void *x, int type, size_t stride,
+    const int *labels, size_t samples, size_t features,
+    const mrvm_params *params, mrvm_model **model) {
+  if (!jason::ValidRows(x, type, stride, samples, features)
+      || labels == NULL || params == NULL || model == NULL
+      || params->kernel < MRVM_LINEAR || params->kernel > MRVM_GAUSSIAN) {
+    return MRVM_ERROR_ARGUMENT;
+  }
+  Vector *t = new Vector(samples);
+  for (size_t n = 0; n < samples; ++n) {
+    if (labels[n] < 0) {
+      delete t;
+      return MRVM_ERROR_ARGUMENT;
+    }
+    t->Set(n, labels[n]);
+  }
+  size_t classes = t->GetNumberOfClasses();
+  if (classes < 2) {
+    delete t;
+    return MRVM_ERROR_ARGUMENT;
+  }
+
+  Matrix *raw = jason::RawRows(x, type, samples, features, stride);
+  raw->CacheMeansAndStdevs();
+  Vector *means = jason::Copy(raw->GetMeans());
+  Vector *stdevs = jason::Copy(raw->GetStdevs());
+  Matrix *train = jason::SphereRows(raw, type, means, stdevs);
+  jason::KernelType kernel = static_cast<jason::KernelType>(params->kernel);
+  jason::Kernel *train_kernel = jason::NewKernel(kernel, train, train,
+      params->kernel_param);
+  jason::Trainer *trainer = new jason::Trainer(train, t, classes,
+      train_kernel);
+  trainer->SetSeed(params->seed);
+  trainer->Process(params->tau, params->upsilon);
+
+  mrvm_model *ret = jason::NewModel(kernel, params->kernel_param, classes);
+  ret->means = means;
+  ret->stdevs = stdevs;
+  ret->relevance_vectors = trainer->GetRelevanceVectors();
+  ret->w = jason::Copy(trainer->GetW());
+  delete trainer;
+  delete train_kernel;
+  delete train;
+  delete t;
+  *model = ret;
+  return MRVM_OK;
+}
+
+int mrvm_predict(const mrvm_model *model, const double *x, size_t samples,
+    size_t features, double *out) {
+  return mrvm_predict_strided(model, x, MRVM_DOUBLE, features, samples,
+      features, out);
+}
+
+int mrvm_predict_strided(const mrvm_model *model, const void *x, int type,
+    size_t stride, size_t samples, size_t features, double *out) {
+  if (model == NULL || out == NULL
+      || !jason::ValidRows(x, type, stride, samples, features)
+      || features != model->means->Size()) {
+    return MRVM_ERROR_ARGUMENT;
+  }
+  Matrix *test = jason::SphereRows(
+      jason::RawRows(x, type, samples, features, stride), type,
+      model->means, model->stdevs);
+  jason::Kernel *test_kernel = jason::NewKernel(model->kernel,
+      model->relevance_vectors, test, model->kernel_param);
+  jason::Predictor *predictor = new jason::Predictor(model->w,
+      model->relevance_vectors, test, test_kernel);
+  Matrix *predictions = predictor->Predict();
+  for (size_t n = 0; n < samples; ++n) {
+    for (size_t c = 0; c < model->classes; ++c) {
+      out[n * model->classes + c] = predictions->Get(n, c);
+    }
+  }
+  delete predictions;
+  delete predictor;
+  delete test_kernel;
+  delete test;
+  return MRVM_OK;
+}
+
+mrvm_cache *mrvm_cache_create(size_t max_bytes, size_t shards) {
+  mrvm_cache *cache = new mrvm_cache;
+  cache->cache = new jason::PredictionCache(max_bytes, shards);
+  return cache;
+}
+
+void mrvm_cache_free(mrvm_cache *cache) {
+  if (cache == NULL) {
+    return;
+  }
+  delete cache->cache;
+  delete cache;
+}
+
+void mrvm_cache_stats(mrvm_cache *cache, size_t *hits, size_t *misses,
+    size_t *bytes) {
+  *hits = cache->cache->Hits();
+  *misses = cache->cache->Misses();
+  *bytes = cache->cache->Bytes();
+}
+
+int mrvm_predict_cached(const mrvm_model *model, mrvm_cache *cache,
+    const double *x, size_t samples, size_t features, double *out) {
+  if (cache == NULL) {
+    return mrvm_predict(model, x, samples, features, out);
+  }
+  if (model == NULL || x == NULL || out == NULL || samples == 0
+      || features != model->means->Size()) {
+    return MRVM_ERROR_ARGUMENT;
+  }
+  size_t classes = model->classes;
+  size_t *misses = new size_t[samples];
+  size_t count = 0;
+  for (size_t n = 0; n < samples; ++n) {
+    if (!cache->cache->Lookup(x + n * features, features, model->version,
+        out + n * classes, classes)) {
+      misses[count++] = n;
+    }
+  }
+  int status = MRVM_OK;
+  if (count > 0) {
+    double *missed = new double[count * features];
+    double *scored = new double[count * classes];
+    for (size_t i = 0; i < count; ++i) {
+      memcpy(missed + i * features, x + misses[i] * features,
+          features * sizeof(*x));
+    }
+    status = mrvm_predict(model, missed, count, features, scored);
+    for (size_t i = 0; status == MRVM_OK && i < count; ++i) {
+      memcpy(out + misses[i] * classes, scored + i * classes,
+          classes * sizeof(*out));
+      cache->cache->Insert(missed + i * features, features, model->version,
+          scored + i * classes, classes);
+    }
+    delete[] scored;
+    delete[] missed;
+  }
+  delete[] misses;
+  return status;
+}
+
+// A text file, exact through %.17g:
+//
+//   mRVM-model <version>
+//   <kernel> <kernel param> <classes> <features> <relevance vectors>
+//   <means>
+//   <stdevs>
+//   <one line per relevance vector>
+//   <one line of weights per relevance vector>
+//
+// A model may have no relevance vectors; every class then scores 0.
+int mrvm_save(const mrvm_model *model, const char *filename) {
+  if (model == NULL || filename == NULL) {
+    return MRVM_ERROR_ARGUMENT;
+  }
+  FILE *f = fopen(filename, "w");
+  if (f == NULL) {
+    return MRVM_ERROR_IO;
+  }
+  fprintf(f, "%s %d\n", MODEL_MAGIC, MRVM_API_VERSION);
+  fprintf(f, "%d %d %zu %zu %zu\n", model->kernel, model->kernel_param,
+      model->classes, model->means->Size(),
+      model->relevance_vectors->Height());
+  jason::WriteRow(f, model->means);
+  jason::WriteRow(f, model->stdevs);
+  jason::WriteRows(f, model->relevance_vectors);
+  jason::WriteRows(f, model->w);
+  bool failed = ferror(f);
+  if (fclose(f) != 0 || failed) {
+    return MRVM_ERROR_IO;
+  }
+  return MRVM_OK;
+}
+
+int mrvm_load(const char *filename, mrvm_model **model) {
+  if (filename == NULL || model == NULL) {
+    return MRVM_ERROR_ARGUMENT;
+  }
+  FILE *f = fopen(filename, "r");
+  struct stat info;
+  if (f == NULL || fstat(fileno(f), &info) != 0) {
+    if (f != NULL) {
+      fclose(f);
+    }
+    return MRVM_ERROR_IO;
+  }
+  char magic[sizeof(MODEL_MAGIC)];
+  int version, kernel, kernel_param;
+  size_t classes, features, rows;
+  if (fscanf(f, "%10s %d", magic, &version) != 2
+      || strcmp(magic, MODEL_MAGIC) != 0 || version != MRVM_API_VERSION
+      || fscanf(f, "%d %d %zu %zu %zu", &kernel, &kernel_param, &classes,
+          &features, &rows) != 5
+      || kernel < MRVM_LINEAR || kernel > MRVM_GAUSSIAN || classes == 0) {
+    fclose(f);
+    return MRVM_ERROR_FORMAT;
+  }
+  // Every value takes at least a digit and a separator, so a header that
+  // claims more than the file can hold is rejected before allocating.
+  size_t count = jason::ModelValues(features, rows, classes);
+  if (count == 0 || count > static_cast<uint64_t>(info.st_size) / 2) {
+    fclose(f);
+    return MRVM_ERROR_FORMAT;
+  }
+  double *values = new (std::nothrow) double[count];
+  if (values == NULL) {
+    fclose(f);
+    return MRVM_ERROR_MEMORY;
+  }
+  bool ok = jason::ReadValues(f, count, values);
+  fclose(f);
+  if (!ok) {
+    delete[] values;
+    return MRVM_ERROR_FORMAT;
+  }
+  mrvm_model *ret = jason::NewModel(static_cast<jason::KernelType>(kernel),
+      kernel_param, classes);
+  ret->means = new Vector(values, features);
+  ret->stdevs = new Vector(values + features, features);
+  ret->relevance_vectors = new Matrix(values + 2 * features, rows, features);
+  ret->w = new Matrix(values + 2 * features + rows * features, rows, classes);
+  delete[] values;
+  *model = ret;
+  return MRVM_OK;
+}
+
+int mrvm_publish(const mrvm_model *model, const char *name) {
+  if (model == NULL || name == NULL) {
+    return MRVM_ERROR_ARGUMENT;
+  }
+  size_t features = model->means->Size();
+  size_t rows = model->relevance_vectors->Height();
+  size_t bytes = sizeof(SharedModelHeader)
+      + (2 * features + rows * (features + model->classes)) * sizeof(double);
+  jason::ModelRegistry *registry = new jason::ModelRegistry(name);
+  uint64_t generation;
+  void *data = registry->Create(bytes, &generation);
+  if (data == NULL) {
+    delete registry;
+    return MRVM_ERROR_IO;
+  }
+  SharedModelHeader *header = reinterpret_cast<SharedModelHeader*>(data);
+  header->magic = SHARED_MAGIC;
+  header->layout = SHARED_LAYOUT;
+  header->kernel = model->kernel;
+  header->kernel_param = model->kernel_param;
+  header->reserved = 0;
+  header->classes = model->classes;
+  header->features = features;
+  header->rows = rows;
+  double *out = reinterpret_cast<double*>(header + 1);
+  out = jason::CopyValues(model->means, out);
+  out = jason::CopyValues(model->stdevs, out);
+  out = jason::CopyValues(model->relevance_vectors, out);
+  jason::CopyValues(model->w, out);
+  bool published = registry->Publish(data, bytes, generation);
+  delete registry;
+  return published ? MRVM_OK : MRVM_ERROR_IO;
+}
+
+int mrvm_attach(const char *name, mrvm_model **model) {
+  if (name == NULL || model == NULL) {
+    return MRVM_ERROR_ARGUMENT;
+  }
+  jason::ModelRegistry *registry = new jason::ModelRegistry(name);
+  int status = jason::AttachModel(registry, model);
+  if (status != MRVM_OK) {
+    delete registry;
+  }
+  return status;
+}
+
+int mrvm_refresh(mrvm_model **model) {
+  if (model == NULL || *model == NULL || (*model)->registry == NULL) {
+    return MRVM_ERROR_ARGUMENT;
+  }
+  jason::ModelRegistry *registry = (*model)->registry;
+  if (registry->Current() == (*model)->generation) {
+    return 0;
+  }
+  mrvm_model *fresh;
+  int status = jason::AttachModel(registry, &fresh);
+  if (status != MRVM_OK) {
+    return status;
+  }
+  (*model)->registry = NULL;
+  mrvm_free(*model);
+  *model = fresh;
+  return 1;
+}
+
+void mrvm_free(mrvm_model *model) {
+  if (model == NULL) {
+    return;
+  }
+  delete model->means;
+  delete model->stdevs;
+  delete model->relevance_vectors;
+  delete model->w;
+  if (model->mapping != NULL) {
+    jason::ModelRegistry::Detach(model->mapping, model->mapping_bytes);
+  }
+  delete model->registry;
+  delete model;
+}
+
+size_t mrvm_classes(const mrvm_model *model) {
+  return model->classes;
+}
+
+size_t mrvm_features(const mrvm_model *model) {
+  return model->means->Size();
+}
+
+size_t mrvm_relevance_vectors(const mrvm_model *model) {
+  return model->relevance_vectors->Height();
+}
+
+void mrvm_set_verbosity(int level) {
+  verbosity = level;
+}
+
+void mrvm_set_threads(size_t threads) {
+  jason::Scheduler::Configure(threads, NULL);
+}
+
+void mrvm_set_reproducible(int enabled) {
+  jason::Reduction::SetMode(enabled ? jason::REDUCTION_REPRODUCIBLE
+      : jason::REDUCTION_FAST);
+}
+
+const char *mrvm_strerror(int status) {
+  switch (status) {
+  case MRVM_OK:
+    return "success";
+  case MRVM_ERROR_ARGUMENT:
+    return "invalid argument";
+  case MRVM_ERROR_IO:
+    return "model file or shared memory unavailable";
+  case MRVM_ERROR_FORMAT:
+    return "not an mRVM model";
+  case MRVM_ERROR_MEMORY:
+    return "out of memory";
+  default:
+    return "unknown error";
+  }
+}
+}
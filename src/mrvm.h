@@ -0,0 +1,135 @@
+/* Copyright 2011 Jason Marcell */
+
+/*
+ * C interface to the mRVM trainer and predictor, built into libmrvm.so and
+ * libmrvm.a by `make libmrvm`.
+ *
+ * All matrices are dense, row-major arrays of doubles with one sample per
+ * row, except where a function takes a row stride and an element type.
+ * Labels are class indices 0 .. classes - 1.  Functions returning int
+ * return MRVM_OK or one of the MRVM_ERROR_* codes.  A model may be used
+ * for predictions from several threads at once.
+ */
+
+#ifndef SRC_MRVM_H_
+#define SRC_MRVM_H_
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MRVM_API_VERSION 1
+
+enum mrvm_status {
+  MRVM_OK = 0,
+  MRVM_ERROR_ARGUMENT = -1,  /* NULL pointer, bad size or label */
+  MRVM_ERROR_IO = -2,        /* Model file or shared memory unavailable */
+  MRVM_ERROR_FORMAT = -3,    /* Not a version 1 model file or segment */
+  MRVM_ERROR_MEMORY = -4     /* The model does not fit in memory */
+};
+
+enum mrvm_kernel {
+  MRVM_LINEAR = 0,
+  MRVM_POLYNOMIAL = 1,
+  MRVM_GAUSSIAN = 2
+};
+
+enum mrvm_type {
+  MRVM_DOUBLE = 0,
+  MRVM_FLOAT = 1     /* Converted to double as it is read */
+};
+
+typedef struct mrvm_params {
+  int kernel;            /* One of mrvm_kernel */
+  int kernel_param;      /* Degree or Gaussian theta, unused for LINEAR */
+  double tau;
+  double upsilon;
+  unsigned long seed;    /* 0 seeds from the environment like the CLI */
+} mrvm_params;
+
+typedef struct mrvm_model mrvm_model;
+typedef struct mrvm_cache mrvm_cache;
+
+/* Linear kernel, tau = upsilon = 1e-6, seed 0. */
+void mrvm_default_params(mrvm_params *params);
+
+/* Trains on `samples` rows of `features` values and their labels.  The
+ * buffers are copied; the caller keeps ownership. */
+int mrvm_train(const double *x, const int *labels, size_t samples,
+    size_t features, const mrvm_params *params, mrvm_model **model);
+
+/* Class probabilities of `samples` rows of x, written row-major into out,
+ * which must hold samples * mrvm_classes(model) values. */
+int mrvm_predict(const mrvm_model *model, const double *x, size_t samples,
+    size_t features, double *out);
+
+/* Like mrvm_train and mrvm_predict, for rows of `type` values (one of
+ * mrvm_type) starting every `stride` >= features elements, such as a
+ * column subset of a wider table.  x is read in place: the one copy made
+ * is the sphered working copy the model computes on. */
+int mrvm_train_strided(const void *x, int type, size_t stride,
+    const int *labels, size_t samples, size_t features,
+    const mrvm_params *params, mrvm_model **model);
+int mrvm_predict_strided(const mrvm_model *model, const void *x, int type,
+    size_t stride, size_t samples, size_t features, double *out);
+
+/* A bounded LRU cache of predicted probabilities, keyed by the raw feature
+ * vector and the model it was scored with, split into `shards`
+ * independently locked parts.  One cache may serve several models and
+ * threads. */
+mrvm_cache *mrvm_cache_create(size_t max_bytes, size_t shards);
+void mrvm_cache_free(mrvm_cache *cache);
+void mrvm_cache_stats(mrvm_cache *cache, size_t *hits, size_t *misses,
+    size_t *bytes);
+
+/* Like mrvm_predict, but rows already in the cache are answered from it
+ * and only the others are scored, then added.  A NULL cache scores every
+ * row. */
+int mrvm_predict_cached(const mrvm_model *model, mrvm_cache *cache,
+    const double *x, size_t samples, size_t features, double *out);
+
+int mrvm_save(const mrvm_model *model, const char *filename);
+int mrvm_load(const char *filename, mrvm_model **model);
+void mrvm_free(mrvm_model *model);
+
+/* Publishes a copy of the model into the named POSIX shared memory
+ * registry as its new current version.  The previous version is freed once
+ * every process attached to it has moved on. */
+int mrvm_publish(const mrvm_model *model, const char *name);
+
+/* Maps the current version published under `name` read-only, without
+ * copying it.  Returns MRVM_ERROR_IO if nothing was published. */
+int mrvm_attach(const char *name, mrvm_model **model);
+
+/* For an attached model: if a newer version was published, attaches it,
+ * frees *model and replaces it.  Returns 1 after a swap, 0 if *model is
+ * current, or an error.  The old model must not be in use by other
+ * threads. */
+int mrvm_refresh(mrvm_model **model);
+
+size_t mrvm_classes(const mrvm_model *model);
+size_t mrvm_features(const mrvm_model *model);
+size_t mrvm_relevance_vectors(const mrvm_model *model);
+
+/* Library log level: 0 silent, 1 normal (default), 2 verbose, 3 debug. */
+void mrvm_set_verbosity(int level);
+
+/* Threads shared by all training and prediction calls, including the
+ * caller's; 0 (the default) uses every online CPU.  Must not be called
+ * while another call is running.  BLAS is kept to a single thread. */
+void mrvm_set_threads(size_t threads);
+
+/* Nonzero makes later training and prediction bitwise reproducible across
+ * thread counts and BLAS builds, by summing in a fixed order without BLAS;
+ * zero (the default) restores the faster BLAS routines. */
+void mrvm_set_reproducible(int enabled);
+
+const char *mrvm_strerror(int status);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* SRC_MRVM_H_ */
@@ -0,0 +1,1098 @@
+// Copyright 2011 Jason Marcell
+//
+// Differential tests: every optimized path of the library is run side by
+// side with a straightforward reference written here from the model's
+// definition, on generated datasets of several sizes, feature counts and
+// class counts.  Each comparison states its tolerance next to it.
+
+#include <fcntl.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <gsl/gsl_cdf.h>
+
+#include "gtest/gtest.h"
+
+#include "./mrvm.h"
+#include "lib/Matrix.h"
+#include "lib/Vector.h"
+#include "lib/Kernel.h"
+#include "lib/KernelCache.h"
+#include "lib/KdTree.h"
+#include "lib/ModelRegistry.h"
+#include "lib/LinearKernel.h"
+#include "lib/PolynomialKernel.h"
+#include "lib/GaussianKernel.h"
+#include "lib/Trainer.h"
+#include "lib/Predictor.h"
+#include "lib/PredictionCache.h"
+#include "lib/NormalCdfTable.h"
+#include "lib/Numa.h"
+#include "lib/RandomNumberGenerator.h"
+#include "lib/Reduction.h"
+#include "lib/Scheduler.h"
+#include "lib/Simd.h"
+#include "lib/Log.h"
+
+#define TEST_THREADS 4  // Enough to split every parallel loop
+
+namespace jason {
+
+// Drives a trainer one update step at a time and exposes its state, in the
+// samples x classes orientation.  Returned matrices are copies.
+class TrainerPeer {
+  public:
+    // What Process() does before iterating, for a trainer over its own
+    // data: the whole kernel, every sample active, random y, a and w.
+    static void Start(Trainer *trainer) {
+      trainer->kernel->Init();
+      trainer->active = new Vector(trainer->samples);
+      for (size_t n = 0; n < trainer->samples; ++n) {
+        trainer->active->Set(n, n);
+      }
+      trainer->InitializeYAW();
+    }
+    static void UpdateW(Trainer *trainer) {
+      trainer->UpdateW();
+    }
+    static void UpdateA(Trainer *trainer, double tau, double upsilon) {
+      trainer->UpdateA(tau, upsilon);
+    }
+    static void UpdateY(Trainer *trainer) {
+      trainer->UpdateY();
+    }
+    static Matrix *W(Trainer *trainer) {
+      return trainer->w->Transpose();
+    }
+    static Matrix *A(Trainer *trainer) {
+      return trainer->a->Transpose();
+    }
+    static Matrix *Y(Trainer *trainer) {
+      return trainer->y->Transpose();
+    }
+    static Matrix *K(Trainer *trainer) {
+      return trainer->k->Copy();
+    }
+};
+
+// Exposes the posterior variances of the last Predict() with posterior
+// factors, samples x classes.
+class PredictorPeer {
+  public:
+    static Matrix *Variances(Predictor *predictor) {
+      return predictor->Variances();
+    }
+};
+
+namespace {
+
+struct Shape {
+  size_t samples;
+  size_t features;
+  size_t classes;
+};
+
+// Gaussian blobs, class c shifted by 1.5 along feature c mod d, sphered
+// like the command line does.
+void Generate(Shape shape, unsigned long seed, Matrix **x, Vector **labels) {
+  RandomNumberGenerator *r = new RandomNumberGenerator(seed);
+  *x = new Matrix(shape.samples, shape.features);
+  *labels = new Vector(shape.samples);
+  for (size_t n = 0; n < shape.samples; ++n) {
+    size_t c = n % shape.classes;
+    (*labels)->Set(n, c);
+    for (size_t d = 0; d < shape.features; ++d) {
+      double shift = d == c % shape.features ? 1.5 : 0;
+      (*x)->Set(n, d, r->SampleGaussian(1.0) + shift
+          + (c >= shape.features && d == 0 ? 1.5 : 0));
+    }
+  }
+  delete r;
+  (*x)->CacheMeansAndStdevs();
+  (*x)->Sphere();
+}
+
+double MaxAbsDiff(Matrix *a, Matrix *b) {
+  EXPECT_EQ(a->Height(), b->Height());
+  EXPECT_EQ(a->Width(), b->Width());
+  double ret = 0;
+  for (size_t i = 0; i < a->Height() && i < b->Height(); ++i) {
+    for (size_t j = 0; j < a->Width() && j < b->Width(); ++j) {
+      ret = fmax(ret, fabs(a->Get(i, j) - b->Get(i, j)));
+    }
+  }
+  return ret;
+}
+
+double MaxAbs(Matrix *a) {
+  double ret = 0;
+  for (size_t i = 0; i < a->Height(); ++i) {
+    for (size_t j = 0; j < a->Width(); ++j) {
+      ret = fmax(ret, fabs(a->Get(i, j)));
+    }
+  }
+  return ret;
+}
+
+bool SameBits(Matrix *a, Matrix *b) {
+  if (a->Height() != b->Height() || a->Width() != b->Width()) {
+    return false;
+  }
+  for (size_t i = 0; i < a->Height(); ++i) {
+    for (size_t j = 0; j < a->Width(); ++j) {
+      double x = a->Get(i, j);
+      double y = b->Get(i, j);
+      if (memcmp(&x, &y, sizeof(x)) != 0) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+double Phi(double x) {
+  return 0.5 * erfc(-x / M_SQRT2);
+}
+
+double NormalPdf(double x) {
+  return exp(-0.5 * x * x) / sqrt(2 * M_PI);
+}
+
+// a b', a' b or a b, one dot product per entry.
+Matrix *ReferenceProduct(Matrix *a, bool trans_a, Matrix *b, bool trans_b) {
+  size_t rows = trans_a ? a->Width() : a->Height();
+  size_t inner = trans_a ? a->Height() : a->Width();
+  size_t cols = trans_b ? b->Height() : b->Width();
+  Matrix *ret = new Matrix(rows, cols);
+  for (size_t i = 0; i < rows; ++i) {
+    for (size_t j = 0; j < cols; ++j) {
+      double sum = 0;
+      for (size_t l = 0; l < inner; ++l) {
+        sum += (trans_a ? a->Get(l, i) : a->Get(i, l))
+            * (trans_b ? b->Get(j, l) : b->Get(l, j));
+      }
+      ret->Set(i, j, sum);
+    }
+  }
+  return ret;
+}
+
+// Normalized kernel k(a, b) / sqrt(k(a, a) k(b, b)) from the definitions.
+Matrix *ReferenceKernel(KernelType type, int param, Matrix *m1, Matrix *m2) {
+  Matrix *ret = new Matrix(m1->Height(), m2->Height());
+  for (size_t i = 0; i < m1->Height(); ++i) {
+    for (size_t j = 0; j < m2->Height(); ++j) {
+      double ab = 0, aa = 0, bb = 0, d2 = 0;
+      for (size_t d = 0; d < m1->Width(); ++d) {
+        double a = m1->Get(i, d);
+        double b = m2->Get(j, d);
+        ab += a * b;
+        aa += a * a;
+        bb += b * b;
+        d2 += (a - b) * (a - b);
+      }
+      double value;
+      if (type == GAUSSIAN) {
+        value = exp(-0.5 * param * d2);
+      } else if (type == POLYNOMIAL) {
+        value = pow(1 + ab, param) / sqrt(pow(1 + aa, param)
+            * pow(1 + bb, param));
+      } else {
+        value = ab / sqrt(aa * bb);
+      }
+      ret->Set(i, j, value);
+    }
+  }
+  return ret;
+}
+
+Kernel *NewKernel(KernelType type, int param, Matrix *m1, Matrix *m2) {
+  if (type == GAUSSIAN) {
+    return new GaussianKernel(m1, m2, param);
+  } else if (type == POLYNOMIAL) {
+    return new PolynomialKernel(m1, m2, param);
+  }
+  return new LinearKernel(m1, m2);
+}
+
+// Solves m x = b by Gaussian elimination with partial pivoting.
+void Solve(size_t size, double *m, double *b, double *x) {
+  for (size_t col = 0; col < size; ++col) {
+    size_t pivot = col;
+    for (size_t row = col + 1; row < size; ++row) {
+      if (fabs(m[row * size + col]) > fabs(m[pivot * size + col])) {
+        pivot = row;
+      }
+    }
+    for (size_t j = 0; j < size; ++j) {
+      double swap = m[col * size + j];
+      m[col * size + j] = m[pivot * size + j];
+      m[pivot * size + j] = swap;
+    }
+    double swap = b[col];
+    b[col] = b[pivot];
+    b[pivot] = swap;
+    for (size_t row = col + 1; row < size; ++row) {
+      double factor = m[row * size + col] / m[col * size + col];
+      for (size_t j = col; j < size; ++j) {
+        m[row * size + j] -= factor * m[col * size + j];
+      }
+      b[row] -= factor * b[col];
+    }
+  }
+  for (size_t row = size; row-- > 0;) {
+    double sum = b[row];
+    for (size_t j = row + 1; j < size; ++j) {
+      sum -= m[row * size + j] * x[j];
+    }
+    x[row] = sum / m[row * size + row];
+  }
+}
+
+// w_c = (K K' + diag(a_c))^-1 K y_c for every class.
+Matrix *ReferenceW(Matrix *k, Matrix *a, Matrix *y) {
+  size_t rows = k->Height();
+  Matrix *kk = ReferenceProduct(k, false, k, true);
+  Matrix *ky = ReferenceProduct(k, false, y, false);
+  Matrix *w = new Matrix(rows, a->Width());
+  double *m = new double[rows * rows];
+  double *b = new double[rows];
+  double *x = new double[rows];
+  for (size_t c = 0; c < a->Width(); ++c) {
+    for (size_t i = 0; i < rows; ++i) {
+      for (size_t j = 0; j < rows; ++j) {
+        m[i * rows + j] = kk->Get(i, j) + (i == j ? a->Get(i, c) : 0);
+      }
+      b[i] = ky->Get(i, c);
+    }
+    Solve(rows, m, b, x);
+    for (size_t i = 0; i < rows; ++i) {
+      w->Set(i, c, x[i]);
+    }
+  }
+  delete[] x;
+  delete[] b;
+  delete[] m;
+  delete ky;
+  delete kk;
+  return w;
+}
+
+// The expectations UpdateY estimates by Monte Carlo, by Simpson's rule
+// over u: for every wrong class c,
+//   y_c = s_c - pdf(s_c - s_i) E[prod_{j != i, c} Phi(u + s_i - s_j)]
+//       / E[Phi(u + s_i - s_c) prod_{j != i, c} Phi(u + s_i - s_j)]
+// with s = w' k_n, and y_i = s_i - sum_{c != i} (y_c - s_c).
+Matrix *ReferenceY(Matrix *k, Matrix *w, Vector *labels) {
+  const size_t kNodes = 4001;
+  const double kLimit = 10;
+  size_t classes = w->Width();
+  Matrix *s = ReferenceProduct(k, true, w, false);
+  Matrix *y = new Matrix(s->Height(), classes);
+  double *numerator = new double[classes];
+  double *denominator = new double[classes];
+  for (size_t n = 0; n < s->Height(); ++n) {
+    size_t i = labels->Get(n);
+    for (size_t c = 0; c < classes; ++c) {
+      numerator[c] = 0;
+      denominator[c] = 0;
+    }
+    double h = 2 * kLimit / (kNodes - 1);
+    for (size_t node = 0; node < kNodes; ++node) {
+      double u = -kLimit + node * h;
+      double weight = (node == 0 || node + 1 == kNodes ? 1
+          : node % 2 == 1 ? 4 : 2) * h / 3 * NormalPdf(u);
+      for (size_t c = 0; c < classes; ++c) {
+        if (c == i) {
+          continue;
+        }
+        double others = 1;
+        for (size_t j = 0; j < classes; ++j) {
+          if (j != i && j != c) {
+            others *= Phi(u + s->Get(n, i) - s->Get(n, j));
+          }
+        }
+        numerator[c] += weight * others;
+        denominator[c] += weight * others
+            * Phi(u + s->Get(n, i) - s->Get(n, c));
+      }
+    }
+    double y_i = s->Get(n, i);
+    for (size_t c = 0; c < classes; ++c) {
+      if (c != i) {
+        double pdf = NormalPdf(s->Get(n, c) - s->Get(n, i));
+        y->Set(n, c, s->Get(n, c) - pdf * numerator[c] / denominator[c]);
+        y_i -= y->Get(n, c) - s->Get(n, c);
+      }
+    }
+    y->Set(n, i, y_i);
+  }
+  delete[] denominator;
+  delete[] numerator;
+  delete s;
+  return y;
+}
+
+// k_n' (K K' + diag(a_c))^-1 k_n for every column n of the test kernel k
+// (M x T) and class c, from the training kernel rows K (M x N) and a
+// (M x C).
+Matrix *ReferenceVariances(Matrix *k, Matrix *train_k, Matrix *a) {
+  size_t rows = k->Height();
+  Matrix *kk = ReferenceProduct(train_k, false, train_k, true);
+  Matrix *ret = new Matrix(k->Width(), a->Width());
+  double *m = new double[rows * rows];
+  double *b = new double[rows];
+  double *x = new double[rows];
+  for (size_t c = 0; c < a->Width(); ++c) {
+    for (size_t n = 0; n < k->Width(); ++n) {
+      for (size_t i = 0; i < rows; ++i) {
+        for (size_t j = 0; j < rows; ++j) {
+          m[i * rows + j] = kk->Get(i, j) + (i == j ? a->Get(i, c) : 0);
+        }
+        b[i] = k->Get(i, n);
+      }
+      Solve(rows, m, b, x);
+      double sum = 0;
+      for (size_t i = 0; i < rows; ++i) {
+        sum += k->Get(i, n) * x[i];
+      }
+      ret->Set(n, c, sum);
+    }
+  }
+  delete[] x;
+  delete[] b;
+  delete[] m;
+  delete kk;
+  return ret;
+}
+
+// Class probabilities from the test kernel against the relevance vectors
+// (M x T) and their weights (M x C), with the three point Gauss-Hermite
+// rule over u written out, normalized per sample.  With `variances` (T x
+// C, may be NULL), class j's score has stdev sqrt(1 + variances_nj)
+// instead of 1.
+Matrix *ReferencePredictions(Matrix *k, Matrix *w, Matrix *variances) {
+  const double kPoints[] = { -sqrt(1.5), 0, sqrt(1.5) };
+  const double kWeights[] = { 1, 4, 1 };
+  size_t classes = w->Width();
+  Matrix *s = ReferenceProduct(k, true, w, false);
+  Matrix *ret = new Matrix(s->Height(), classes);
+  for (size_t n = 0; n < s->Height(); ++n) {
+    double total = 0;
+    for (size_t i = 0; i < classes; ++i) {
+      double sum = 0;
+      double stdev_i = variances ? sqrt(1 + variances->Get(n, i)) : 1;
+      for (size_t q = 0; q < 3; ++q) {
+        double prod = 1;
+        for (size_t j = 0; j < classes; ++j) {
+          if (j != i) {
+            double stdev_j = variances ? sqrt(1 + variances->Get(n, j)) : 1;
+            prod *= Phi((kPoints[q] * stdev_i + s->Get(n, i) - s->Get(n, j))
+                / stdev_j);
+          }
+        }
+        sum += kWeights[q] * prod;
+      }
+      ret->Set(n, i, sum);
+      total += sum;
+    }
+    for (size_t i = 0; i < classes; ++i) {
+      ret->Set(n, i, ret->Get(n, i) / total);
+    }
+  }
+  delete s;
+  return ret;
+}
+
+Matrix *ReferencePredictions(Matrix *k, Matrix *w) {
+  return ReferencePredictions(k, w, NULL);
+}
+
+class DifferentialTest : public ::testing::TestWithParam<Shape> {
+  protected:
+    virtual void SetUp() {
+      verbosity = 0;
+      Scheduler::Configure(TEST_THREADS, NULL);
+      Reduction::SetMode(REDUCTION_FAST);
+      shape = GetParam();
+      Generate(shape, 7, &x, &labels);
+      Vector *test_labels;
+      Shape test_shape = { shape.samples / 2, shape.features, shape.classes };
+      Generate(test_shape, 11, &test, &test_labels);
+      delete test_labels;
+    }
+    virtual void TearDown() {
+      Reduction::SetMode(REDUCTION_FAST);
+      Simd::Select(Simd::Detect());
+      delete test;
+      delete labels;
+      delete x;
+    }
+    // A trainer after the random start and one UpdateW.
+    Trainer *StartTrainer(GaussianKernel *kernel) {
+      Trainer *trainer = new Trainer(x, labels, shape.classes, kernel);
+      trainer->SetSeed(5);
+      TrainerPeer::Start(trainer);
+      TrainerPeer::UpdateW(trainer);
+      return trainer;
+    }
+    Shape shape;
+    Matrix *x;
+    Vector *labels;
+    Matrix *test;
+};
+
+// Blocked, threaded GEMM against one dot product per entry, in both
+// reduction modes and in the thread blocks of -N PARTITION: 1e-12 relative
+// to the largest entry.
+TEST_P(DifferentialTest, GemmMatchesReference) {
+  RandomNumberGenerator *r = new RandomNumberGenerator(3);
+  Matrix *b = new Matrix(shape.features, shape.classes);
+  Matrix *c = new Matrix(shape.samples, shape.classes);
+  for (size_t i = 0; i < b->Height(); ++i) {
+    for (size_t j = 0; j < b->Width(); ++j) {
+      b->Set(i, j, r->SampleGaussian(1.0));
+    }
+  }
+  for (size_t i = 0; i < c->Height(); ++i) {
+    for (size_t j = 0; j < c->Width(); ++j) {
+      c->Set(i, j, r->SampleGaussian(1.0));
+    }
+  }
+  delete r;
+  Matrix *expected[] = {
+      ReferenceProduct(x, false, x, true),
+      ReferenceProduct(x, false, b, false),
+      ReferenceProduct(x, true, c, false) };
+  for (int mode = 0; mode < 3; ++mode) {
+    Reduction::SetMode(mode == 1 ? REDUCTION_REPRODUCIBLE : REDUCTION_FAST);
+    Numa::Configure(mode == 2 ? NUMA_PARTITION : NUMA_NONE);
+    Matrix *actual[] = {
+        x->Multiply(x), x->MultiplyNoTrans(b), x->TransposeMultiply(c) };
+    for (int i = 0; i < 3; ++i) {
+      EXPECT_LE(MaxAbsDiff(actual[i], expected[i]),
+          1e-12 * (1 + MaxAbs(expected[i])))
+          << "product " << i << " mode " << mode;
+      delete actual[i];
+    }
+  }
+  Numa::Configure(NUMA_NONE);
+  for (int i = 0; i < 3; ++i) {
+    delete expected[i];
+  }
+  delete c;
+  delete b;
+}
+
+// Init(), Block() and the cached base against the definitions: 1e-12.
+// The KD-tree cutoff only drops entries below its tolerance.
+TEST_P(DifferentialTest, KernelsMatchReference) {
+  const KernelType kTypes[] = { GAUSSIAN, POLYNOMIAL, LINEAR };
+  const int kParams[] = { 1, 2, 0 };
+  for (int t = 0; t < 3; ++t) {
+    Matrix *expected = ReferenceKernel(kTypes[t], kParams[t], x, test);
+    Kernel *kernel = NewKernel(kTypes[t], kParams[t], x, test);
+    kernel->Init();
+    EXPECT_LE(MaxAbsDiff(kernel, expected), 1e-12) << "Init, kernel " << t;
+
+    Matrix *block = kernel->Block(x, test);
+    EXPECT_LE(MaxAbsDiff(block, expected), 1e-12) << "Block, kernel " << t;
+    delete block;
+
+    KernelCache *cache = new KernelCache(x, test, kernel->BaseType());
+    kernel->SetCache(cache);
+    kernel->SetAll(0.0);
+    kernel->Init();
+    EXPECT_LE(MaxAbsDiff(kernel, expected), 1e-12) << "cache, kernel " << t;
+    kernel->SetCache(NULL);
+    delete cache;
+
+    double radius = kernel->CutoffRadius(1e-6);
+    if (radius > 0) {
+      KdTree *index = new KdTree(x);
+      kernel->InitWithIndex(index, radius);
+      EXPECT_LE(MaxAbsDiff(kernel, expected), 1e-6) << "cutoff";
+      delete index;
+    }
+    delete kernel;
+    delete expected;
+  }
+}
+
+// UpdateW's shared K K', threaded inversions and GEMMs against a pivoted
+// elimination per class: 1e-8 relative to the largest weight.
+TEST_P(DifferentialTest, UpdateWMatchesReference) {
+  GaussianKernel *kernel = new GaussianKernel(x, x, 1);
+  Trainer *trainer = new Trainer(x, labels, shape.classes, kernel);
+  trainer->SetSeed(5);
+  TrainerPeer::Start(trainer);
+  Matrix *k = TrainerPeer::K(trainer);
+  Matrix *a = TrainerPeer::A(trainer);
+  Matrix *y = TrainerPeer::Y(trainer);
+  Matrix *expected = ReferenceW(k, a, y);
+  TrainerPeer::UpdateW(trainer);
+  Matrix *w = TrainerPeer::W(trainer);
+  EXPECT_LE(MaxAbsDiff(w, expected), 1e-8 * (1 + MaxAbs(expected)));
+  delete w;
+  delete expected;
+  delete y;
+  delete a;
+  delete k;
+  delete trainer;
+  delete kernel;
+}
+
+// The class-major a update against the formula, exact up to rounding,
+// and the samples it purges against the a >= 1000 in every class rule.
+TEST_P(DifferentialTest, UpdateAMatchesReference) {
+  const double kTau = 1e-6;
+  const double kUpsilon = 1e-6;
+  GaussianKernel *kernel = new GaussianKernel(x, x, 1);
+  Trainer *trainer = StartTrainer(kernel);
+  Matrix *w = TrainerPeer::W(trainer);
+  Vector *kept = new Vector(w->Height());
+  size_t count = 0;
+  for (size_t n = 0; n < w->Height(); ++n) {
+    bool keep = false;
+    for (size_t c = 0; c < w->Width(); ++c) {
+      double wval = w->Get(n, c);
+      keep = keep || (2 * kTau + 1) / (wval * wval + 2 * kUpsilon) < 1000;
+    }
+    kept->Set(n, keep);
+    count += keep;
+  }
+  TrainerPeer::UpdateA(trainer, kTau, kUpsilon);
+  ASSERT_EQ(count, trainer->GetActive()->Size());
+  Matrix *a = TrainerPeer::A(trainer);
+  for (size_t n = 0, row = 0; n < w->Height(); ++n) {
+    if (kept->Get(n) == 0) {
+      continue;
+    }
+    EXPECT_EQ(n, trainer->GetActive()->Get(row));
+    for (size_t c = 0; c < w->Width(); ++c) {
+      double wval = w->Get(n, c);
+      double expected = (2 * kTau + 1) / (wval * wval + 2 * kUpsilon);
+      EXPECT_NEAR(expected, a->Get(row, c), 1e-12 * expected);
+    }
+    ++row;
+  }
+  delete a;
+  delete kept;
+  delete w;
+  delete trainer;
+  delete kernel;
+}
+
+// UpdateY's shared-draw Monte Carlo against the same expectations by
+// quadrature.  With 1000 draws each y is within 0.1 of its correction
+// term's size (plus 0.05); the tabulated CDF must match the exact one to
+// 1e-4 on the same draws, and any thread count must give the same bits.
+TEST_P(DifferentialTest, UpdateYMatchesReference) {
+  GaussianKernel *kernel = new GaussianKernel(x, x, 1);
+  Trainer *trainer = StartTrainer(kernel);
+  Matrix *k = TrainerPeer::K(trainer);
+  Matrix *w = TrainerPeer::W(trainer);
+  Matrix *expected = ReferenceY(k, w, labels);
+  Matrix *s = ReferenceProduct(k, true, w, false);
+  TrainerPeer::UpdateY(trainer);
+  Matrix *y = TrainerPeer::Y(trainer);
+  for (size_t n = 0; n < y->Height(); ++n) {
+    for (size_t c = 0; c < y->Width(); ++c) {
+      double correction = fabs(expected->Get(n, c) - s->Get(n, c));
+      EXPECT_NEAR(expected->Get(n, c), y->Get(n, c),
+          0.05 + 0.1 * correction) << "sample " << n << " class " << c;
+    }
+  }
+
+  Trainer *tabulated = StartTrainer(kernel);
+  NormalCdfTable *table = new NormalCdfTable(1e-7);
+  tabulated->SetCdfTable(table);
+  TrainerPeer::UpdateY(tabulated);
+  Matrix *y_tabulated = TrainerPeer::Y(tabulated);
+  EXPECT_LE(MaxAbsDiff(y, y_tabulated), 1e-4);
+
+  Scheduler::Configure(1, NULL);
+  Trainer *serial = StartTrainer(kernel);
+  TrainerPeer::UpdateY(serial);
+  Matrix *y_serial = TrainerPeer::Y(serial);
+  Scheduler::Configure(TEST_THREADS, NULL);
+  EXPECT_TRUE(SameBits(y, y_serial));
+
+  delete y_serial;
+  delete serial;
+  delete y_tabulated;
+  delete table;
+  delete tabulated;
+  delete y;
+  delete s;
+  delete expected;
+  delete w;
+  delete k;
+  delete trainer;
+  delete kernel;
+}
+
+// Threaded prediction against scores and quadrature written out: 1e-6,
+// as NormalizeResults() sums and divides in single precision.
+// The tabulated CDF, the KD-tree cutoff and the fast Gauss transform
+// stay within their tolerances of the exact predictor.
+TEST_P(DifferentialTest, PredictionsMatchReference) {
+  GaussianKernel *kernel = new GaussianKernel(x, x, 1);
+  Trainer *trainer = new Trainer(x, labels, shape.classes, kernel);
+  trainer->SetSeed(5);
+  trainer->SetIterations(10);
+  trainer->Process(1e-6, 1e-6);
+  Matrix *relevance_vectors = trainer->GetRelevanceVectors();
+  Matrix *w = trainer->GetW();
+  Matrix *k = ReferenceKernel(GAUSSIAN, 1, relevance_vectors, test);
+  Matrix *expected = ReferencePredictions(k, w);
+
+  GaussianKernel *test_kernel = new GaussianKernel(relevance_vectors, test,
+      1);
+  Predictor *predictor = new Predictor(w, relevance_vectors, test,
+      test_kernel);
+  Matrix *exact = predictor->Predict();
+  EXPECT_LE(MaxAbsDiff(exact, expected), 1e-6);
+  delete predictor;
+
+  NormalCdfTable *table = new NormalCdfTable(1e-7);
+  predictor = new Predictor(w, relevance_vectors, test, test_kernel);
+  predictor->SetCdfTable(table);
+  Matrix *tabulated = predictor->Predict();
+  EXPECT_LE(MaxAbsDiff(tabulated, exact), 1e-6) << "tabulated CDF";
+  delete tabulated;
+  delete predictor;
+  delete table;
+
+  predictor = new Predictor(w, relevance_vectors, test, test_kernel);
+  predictor->SetKernelTolerance(1e-9);
+  Matrix *cutoff = predictor->Predict();
+  EXPECT_LE(MaxAbsDiff(cutoff, exact), 1e-6) << "kernel cutoff";
+  delete cutoff;
+  delete predictor;
+
+  predictor = new Predictor(w, relevance_vectors, test, test_kernel);
+  predictor->SetFastGaussTolerance(1e-9);
+  Matrix *fgt = predictor->Predict();
+  EXPECT_LE(MaxAbsDiff(fgt, exact), 1e-6) << "fast Gauss transform";
+  delete fgt;
+  delete predictor;
+
+  delete exact;
+  delete test_kernel;
+  delete expected;
+  delete k;
+  delete relevance_vectors;
+  delete trainer;
+  delete kernel;
+}
+
+// Predictions that integrate over the posterior of w: the variances from
+// the trainer's Cholesky factors against explicit solves of K K' + diag(a)
+// to 1e-8 relative, and the probabilities against the reference with
+// those variances to 1e-6.
+TEST_P(DifferentialTest, PosteriorPredictionsMatchReference) {
+  GaussianKernel *kernel = new GaussianKernel(x, x, 1);
+  Trainer *trainer = new Trainer(x, labels, shape.classes, kernel);
+  trainer->SetSeed(5);
+  trainer->SetIterations(10);
+  trainer->Process(1e-6, 1e-6);
+  Matrix *relevance_vectors = trainer->GetRelevanceVectors();
+  Matrix *w = trainer->GetW();
+  Matrix *train_k = TrainerPeer::K(trainer);
+  Matrix *a = TrainerPeer::A(trainer);
+  Matrix *k = ReferenceKernel(GAUSSIAN, 1, relevance_vectors, test);
+  Matrix *expected_variances = ReferenceVariances(k, train_k, a);
+  Matrix *expected = ReferencePredictions(k, w, expected_variances);
+
+  GaussianKernel *test_kernel = new GaussianKernel(relevance_vectors, test,
+      1);
+  Predictor *predictor = new Predictor(w, relevance_vectors, test,
+      test_kernel);
+  predictor->SetPosteriorFactors(trainer->GetPosteriorFactors());
+  Matrix *predictions = predictor->Predict();
+  Matrix *variances = PredictorPeer::Variances(predictor);
+  EXPECT_LE(MaxAbsDiff(variances, expected_variances),
+      1e-8 * fmax(1, MaxAbs(expected_variances)));
+  EXPECT_LE(MaxAbsDiff(predictions, expected), 1e-6);
+
+  delete variances;
+  delete predictions;
+  delete predictor;
+  delete test_kernel;
+  delete expected;
+  delete expected_variances;
+  delete k;
+  delete a;
+  delete train_k;
+  delete relevance_vectors;
+  delete trainer;
+  delete kernel;
+}
+
+// A trainer over bootstrap rows of a shared kernel, which builds its
+// products from panels of that kernel, against one trained on the same
+// rows as its own data: the same model to 1e-8 relative.
+TEST_P(DifferentialTest, SharedKernelMatchesOwnKernel) {
+  RandomNumberGenerator *r = new RandomNumberGenerator(7);
+  size_t samples = x->Height();
+  Vector *rows = new Vector(samples);
+  Vector *row_labels = new Vector(samples);
+  for (size_t n = 0; n < samples; ++n) {
+    size_t draw = r->SampleUniform(0, samples);
+    rows->Set(n, draw < samples ? draw : samples - 1);
+    row_labels->Set(n, labels->Get(rows->Get(n)));
+  }
+  delete r;
+  Matrix *x_rows = x->GatherRows(rows);
+
+  GaussianKernel *shared_kernel = new GaussianKernel(x, x, 1);
+  shared_kernel->Init();
+  Trainer *shared = new Trainer(shared_kernel, labels, shape.classes, rows);
+  GaussianKernel *own_kernel = new GaussianKernel(x_rows, x_rows, 1);
+  Trainer *own = new Trainer(x_rows, row_labels, shape.classes, own_kernel);
+  Trainer *trainers[] = { shared, own };
+  for (int i = 0; i < 2; ++i) {
+    trainers[i]->SetSeed(5);
+    trainers[i]->SetIterations(5);
+    trainers[i]->Process(1e-6, 1e-6);
+  }
+  ASSERT_EQ(own->GetActive()->Size(), shared->GetActive()->Size());
+  for (size_t i = 0; i < own->GetActive()->Size(); ++i) {
+    EXPECT_EQ(rows->Get(own->GetActive()->Get(i)),
+        shared->GetActive()->Get(i));
+  }
+  EXPECT_LE(MaxAbsDiff(shared->GetW(), own->GetW()),
+      1e-8 * (1 + MaxAbs(own->GetW())));
+
+  delete own;
+  delete own_kernel;
+  delete shared;
+  delete shared_kernel;
+  delete x_rows;
+  delete row_labels;
+  delete rows;
+}
+
+// Reproducible mode must train the same bits on one thread and on many.
+TEST_P(DifferentialTest, ReproducibleTrainingIsThreadInvariant) {
+  Matrix *w[2];
+  for (int run = 0; run < 2; ++run) {
+    Scheduler::Configure(run == 0 ? 1 : TEST_THREADS, NULL);
+    Reduction::SetMode(REDUCTION_REPRODUCIBLE);
+    GaussianKernel *kernel = new GaussianKernel(x, x, 1);
+    Trainer *trainer = new Trainer(x, labels, shape.classes, kernel);
+    trainer->SetSeed(5);
+    trainer->SetIterations(10);
+    trainer->Process(1e-6, 1e-6);
+    w[run] = trainer->GetW()->Copy();
+    delete trainer;
+    delete kernel;
+  }
+  EXPECT_TRUE(SameBits(w[0], w[1]));
+  delete w[1];
+  delete w[0];
+}
+
+// Every ISA level the CPU has against the scalar code and the reference:
+// dot products and distances to 1e-12 relative, kernels to 1e-12, int8
+// dot products exactly and fp16 ones to 1e-6 relative, and batched CDF
+// values with the same bits as NormalCdfTable::P(), also beyond the ends
+// of the table, where both are the exact CDF.
+// Reproducible mode runs scalar.
+TEST_P(DifferentialTest, SimdLevelsMatchScalar) {
+  const size_t kPoints = 1003;
+  NormalCdfTable *table = new NormalCdfTable(1e-7);
+  double *points = new double[kPoints];
+  double *batch = new double[kPoints];
+  for (size_t i = 0; i < kPoints; ++i) {
+    points[i] = -12.0 + 24.0 * i / (kPoints - 1);
+  }
+  Matrix *expected = ReferenceKernel(GAUSSIAN, 1, x, test);
+  Matrix *linear = ReferenceKernel(LINEAR, 0, x, test);
+  // 48 int8s and 40 halves: 2.5 steps of AVX-512's 16 halves.
+  const size_t kInt8s = 48, kHalves = 40;
+  int8_t int8_a[kInt8s], int8_b[kInt8s];
+  int32_t int8_dot = 0;
+  for (size_t i = 0; i < kInt8s; ++i) {
+    int8_a[i] = static_cast<int8_t>(127 - 37 * i % 255);
+    int8_b[i] = static_cast<int8_t>(-128 + 53 * i % 256);
+    int8_dot += int8_a[i] * int8_b[i];
+  }
+  uint16_t halves[kHalves];
+  float floats[kHalves];
+  double half_dot = 0, half_scale = 0;
+  for (size_t i = 0; i < kHalves; ++i) {
+    halves[i] = static_cast<uint16_t>(40503u * (i + 1) & 0xbbff);  // |h| < 1
+    floats[i] = 1.0f - 0.05f * i;
+    half_dot += static_cast<double>(Simd::HalfToFloat(halves[i])) * floats[i];
+    half_scale += fabs(Simd::HalfToFloat(halves[i]) * floats[i]);
+  }
+  for (int level = SIMD_SCALAR; level <= Simd::Detect(); ++level) {
+    Simd::Select(static_cast<SimdLevel>(level));
+    EXPECT_EQ(int8_dot, Simd::DotInt8(int8_a, int8_b, kInt8s))
+        << "level " << level;
+    EXPECT_NEAR(half_dot, Simd::DotHalf(halves, floats, kHalves),
+        1e-6 * half_scale) << "level " << level;
+    for (size_t row = 0; row < x->Height(); ++row) {
+      Vector *a = x->Row(row);
+      Vector *b = test->Row(row % test->Height());
+      double dot = 0, d2 = 0, scale = 0;
+      for (size_t d = 0; d < a->Size(); ++d) {
+        dot += a->Get(d) * b->Get(d);
+        d2 += (a->Get(d) - b->Get(d)) * (a->Get(d) - b->Get(d));
+        scale += fabs(a->Get(d) * b->Get(d));
+      }
+      EXPECT_NEAR(dot, a->Multiply(b), 1e-12 * scale) << "level " << level;
+      delete b;
+      delete a;
+    }
+    GaussianKernel *kernel = new GaussianKernel(x, test, 1);
+    kernel->Init();
+    EXPECT_LE(MaxAbsDiff(kernel, expected), 1e-12) << "level " << level;
+    Matrix *block = kernel->Block(x, test);
+    EXPECT_LE(MaxAbsDiff(block, expected), 1e-12) << "level " << level;
+    delete block;
+    delete kernel;
+    LinearKernel *linear_kernel = new LinearKernel(x, test);
+    linear_kernel->Init();
+    EXPECT_LE(MaxAbsDiff(linear_kernel, linear), 1e-12) << "level " << level;
+    delete linear_kernel;
+
+    table->P(points, batch, kPoints);
+    for (size_t i = 0; i < kPoints; ++i) {
+      double scalar = table->P(points[i]);
+      EXPECT_EQ(0, memcmp(&scalar, &batch[i], sizeof(scalar)))
+          << "level " << level << " x " << points[i];
+    }
+    EXPECT_EQ(gsl_cdf_ugaussian_P(points[0]), batch[0]) << "level " << level;
+    EXPECT_GT(batch[0], 0) << "level " << level;
+  }
+  Reduction::SetMode(REDUCTION_REPRODUCIBLE);
+  EXPECT_EQ(SIMD_SCALAR, Simd::Level());
+  delete linear;
+  delete expected;
+  delete[] batch;
+  delete[] points;
+  delete table;
+}
+
+// Sizes either side of the 64 row GEMM panels, two to five classes.
+const Shape kShapes[] = {
+  { 40, 2, 2 },
+  { 90, 4, 3 },
+  { 150, 7, 5 },
+  { 260, 12, 4 }
+};
+
+INSTANTIATE_TEST_CASE_P(Generated, DifferentialTest,
+    ::testing::ValuesIn(kShapes));
+
+// Row r of the cache tests: 2 features and 3 probabilities, all distinct
+// per row.
+void CacheRow(size_t r, double *x, double *probabilities) {
+  x[0] = r;
+  x[1] = 0.5 * r;
+  for (size_t c = 0; c < 3; ++c) {
+    probabilities[c] = r + 0.25 * c;
+  }
+}
+
+bool CacheHas(PredictionCache *cache, size_t r, uint64_t version) {
+  double x[2], expected[3], out[3];
+  CacheRow(r, x, expected);
+  return cache->Lookup(x, 2, version, out, 3)
+      && memcmp(out, expected, sizeof(out)) == 0;
+}
+
+void CacheInsert(PredictionCache *cache, size_t r, uint64_t version) {
+  double x[2], probabilities[3];
+  CacheRow(r, x, probabilities);
+  cache->Insert(x, 2, version, probabilities, 3);
+}
+
+// A stored row is returned with the same bits, and counted as a hit; other
+// rows and other class counts miss.
+TEST(PredictionCacheTest, HitsAfterInsert) {
+  PredictionCache *cache = new PredictionCache(1 << 20, 4);
+  CacheInsert(cache, 1, 1);
+  EXPECT_TRUE(CacheHas(cache, 1, 1));
+  EXPECT_FALSE(CacheHas(cache, 2, 1));
+  double x[2], probabilities[3], out[2];
+  CacheRow(1, x, probabilities);
+  EXPECT_FALSE(cache->Lookup(x, 2, 1, out, 2));
+  EXPECT_EQ(1u, cache->Hits());
+  EXPECT_EQ(2u, cache->Misses());
+  delete cache;
+}
+
+// With room for three entries next to the buckets, a fourth evicts the
+// least recently used one, which a lookup renews.
+TEST(PredictionCacheTest, EvictsLeastRecentlyUsed) {
+  PredictionCache *probe = new PredictionCache(1 << 20, 1);
+  size_t buckets = probe->Bytes();
+  CacheInsert(probe, 0, 1);
+  size_t entry = probe->Bytes() - buckets;
+  delete probe;
+
+  PredictionCache *cache = new PredictionCache(buckets + 3 * entry, 1);
+  CacheInsert(cache, 1, 1);
+  CacheInsert(cache, 2, 1);
+  CacheInsert(cache, 3, 1);
+  EXPECT_TRUE(CacheHas(cache, 1, 1));
+  CacheInsert(cache, 4, 1);
+  EXPECT_FALSE(CacheHas(cache, 2, 1));
+  EXPECT_TRUE(CacheHas(cache, 1, 1));
+  EXPECT_TRUE(CacheHas(cache, 3, 1));
+  EXPECT_TRUE(CacheHas(cache, 4, 1));
+  CacheInsert(cache, 5, 1);
+  EXPECT_FALSE(CacheHas(cache, 1, 1));
+  EXPECT_TRUE(CacheHas(cache, 5, 1));
+  delete cache;
+}
+
+// Bytes() stays within the cap after every insert, on one shard and on
+// several, while the bucket arrays double past their initial size and
+// once they can no longer grow.
+TEST(PredictionCacheTest, BytesStayUnderCap) {
+  const size_t kShardCap = 16384;
+  const size_t kRows = 4000;
+  for (size_t shards = 1; shards <= 4; shards *= 4) {
+    size_t cap = kShardCap * shards;
+    PredictionCache *cache = new PredictionCache(cap, shards);
+    size_t buckets = cache->Bytes();
+    CacheInsert(cache, 0, 1);
+    size_t entry = cache->Bytes() - buckets;
+    for (size_t r = 1; r < kRows; ++r) {
+      CacheInsert(cache, r, 1);
+      ASSERT_LE(cache->Bytes(), cap) << shards << " shards, row " << r;
+    }
+    size_t stored = 0;
+    for (size_t r = 0; r < kRows; ++r) {
+      stored += CacheHas(cache, r, 1);
+    }
+    EXPECT_GT(stored, 0u);
+    EXPECT_GT(cache->Bytes() - stored * entry, buckets)
+        << shards << " shards: the buckets never grew";
+    delete cache;
+  }
+}
+
+// Entries are keyed by model version: a new version misses until it is
+// stored, and does not displace the old one.
+TEST(PredictionCacheTest, MissesOnNewVersion) {
+  PredictionCache *cache = new PredictionCache(1 << 20, 4);
+  CacheInsert(cache, 1, 1);
+  EXPECT_FALSE(CacheHas(cache, 1, 2));
+  CacheInsert(cache, 1, 2);
+  EXPECT_TRUE(CacheHas(cache, 1, 2));
+  EXPECT_TRUE(CacheHas(cache, 1, 1));
+  delete cache;
+}
+// Whether the POSIX shared memory segment `name` exists.
+bool SegmentExists(const char *name) {
+  int fd = shm_open(name, O_RDONLY, 0);
+  if (fd < 0) {
+    return false;
+  }
+  close(fd);
+  return true;
+}
+
+// Probabilities of every row of x from a C API model.
+double *RegistryPredictions(mrvm_model *model, double *x, size_t samples,
+    size_t features) {
+  double *out = new double[samples * mrvm_classes(model)];
+  EXPECT_EQ(MRVM_OK, mrvm_predict(model, x, samples, features, out));
+  return out;
+}
+
+// A model published under a name unique to this process is attached
+// without copying and predicts with the same bits as the original;
+// mrvm_refresh() swaps to a newer publication once, then reports the
+// model current.  Attaching a name nothing was published under fails
+// without creating a segment.  Every segment is unlinked afterwards.
+TEST(ModelRegistryTest, PublishAttachRefresh) {
+  verbosity = 0;
+  Scheduler::Configure(TEST_THREADS, NULL);
+  Shape shape = { 90, 4, 3 };
+  Matrix *m;
+  Vector *t;
+  Generate(shape, 7, &m, &t);
+  double *x = new double[shape.samples * shape.features];
+  int *labels = new int[shape.samples];
+  for (size_t n = 0; n < shape.samples; ++n) {
+    for (size_t d = 0; d < shape.features; ++d) {
+      x[n * shape.features + d] = m->Get(n, d);
+    }
+    labels[n] = t->Get(n);
+  }
+  delete t;
+  delete m;
+  mrvm_params params;
+  mrvm_default_params(&params);
+  params.kernel = MRVM_GAUSSIAN;
+  params.seed = 5;
+  mrvm_model *first, *second;
+  ASSERT_EQ(MRVM_OK, mrvm_train(x, labels, shape.samples, shape.features,
+      &params, &first));
+  params.kernel_param = 2;
+  ASSERT_EQ(MRVM_OK, mrvm_train(x, labels, shape.samples, shape.features,
+      &params, &second));
+  double *first_out = RegistryPredictions(first, x, shape.samples,
+      shape.features);
+  double *second_out = RegistryPredictions(second, x, shape.samples,
+      shape.features);
+  size_t values = shape.samples * shape.classes;
+
+  char name[32], control[64];
+  snprintf(name, sizeof(name), "mrvm_test_%d", static_cast<int>(getpid()));
+  snprintf(control, sizeof(control), "/%s", name);
+  ASSERT_EQ(MRVM_OK, mrvm_publish(first, name));
+  mrvm_model *attached;
+  ASSERT_EQ(MRVM_OK, mrvm_attach(name, &attached));
+  EXPECT_EQ(mrvm_relevance_vectors(first), mrvm_relevance_vectors(attached));
+  double *out = RegistryPredictions(attached, x, shape.samples,
+      shape.features);
+  EXPECT_EQ(0, memcmp(out, first_out, values * sizeof(*out)));
+  delete[] out;
+  EXPECT_EQ(0, mrvm_refresh(&attached));
+
+  ASSERT_EQ(MRVM_OK, mrvm_publish(second, name));
+  EXPECT_EQ(1, mrvm_refresh(&attached));
+  EXPECT_EQ(0, mrvm_refresh(&attached));
+  out = RegistryPredictions(attached, x, shape.samples, shape.features);
+  EXPECT_EQ(0, memcmp(out, second_out, values * sizeof(*out)));
+  delete[] out;
+
+  char unpublished[64];
+  snprintf(unpublished, sizeof(unpublished), "%s_none", name);
+  mrvm_model *missing = NULL;
+  EXPECT_EQ(MRVM_ERROR_IO, mrvm_attach(unpublished, &missing));
+  EXPECT_TRUE(missing == NULL);
+  snprintf(unpublished, sizeof(unpublished), "/%s_none", name);
+  EXPECT_FALSE(SegmentExists(unpublished));
+
+  ModelRegistry *registry = new ModelRegistry(name);
+  char segment[64];
+  snprintf(segment, sizeof(segment), "/%s.%llu", name,
+      static_cast<unsigned long long>(registry->Current()));
+  delete registry;
+  mrvm_free(attached);
+  EXPECT_EQ(0, shm_unlink(segment));
+  EXPECT_EQ(0, shm_unlink(control));
+  snprintf(segment, sizeof(segment), "/%s.1", name);
+  EXPECT_FALSE(SegmentExists(segment)) << "first generation not unlinked";
+
+  delete[] second_out;
+  delete[] first_out;
+  mrvm_free(second);
+  mrvm_free(first);
+  delete[] labels;
+  delete[] x;
+}
+}  // namespace
+}  // namespace jason